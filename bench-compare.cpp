@@ -0,0 +1,331 @@
+/** file: bench-compare.cpp
+ ** brief: Compares two bench JSON files and fails on regressions
+ **/
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Usage:
+//   ./bench --json current.json
+//   ./bench-compare baseline.json current.json
+// or, in one go,
+//   ./bench | ./bench-compare baseline.json -
+//
+// A benchmark regresses when its samples are slower than the baseline
+// ones according to a two-sided Mann-Whitney U test at level --alpha
+// AND its median is more than --threshold slower. The ratio of the
+// medians is reported with a bootstrap 95% confidence interval. The
+// exit status is 1 if any benchmark regressed, 2 on errors.
+//
+// Timings only compare on the same host with the same compiler, which
+// bench records in the JSON; files from different ones are refused.
+// Benchmarks whose kernel takes less than --floor ns per call (size
+// times ns_per_element) are mostly loop and timer overhead and move by
+// more than the threshold from run to run, so they are listed but not
+// gated.
+//
+// The bench-gate task compares against bench-baseline.json, which is
+// not under version control: record one on the machine first with the
+// bench-baseline task, that is
+//   ./bench --max-size 10000 --reps 8 --json bench-baseline.json
+
+/* ---------------------------------------------------------------- */
+// reading bench output
+/* ---------------------------------------------------------------- */
+
+struct Benchmark {
+  std::string key ;
+  long size ;
+  std::vector<double> samples ;
+} ;
+
+typedef std::map<std::string,std::string> Fields ;
+
+// Just enough JSON for what bench writes: the "context" object and the
+// objects of the "benchmarks" array, with string, number or
+// number-array values.
+
+class Parser {
+  public:
+    Parser(const std::string & text) : text(text), pos(0) { }
+
+    bool parse(Fields & context, std::vector<Benchmark> & benchmarks) {
+      size_t start = text.find("\"context\"") ;
+      if (start != std::string::npos) {
+        pos = text.find('{', start) ;
+        std::vector<double> none ;
+        if (pos == std::string::npos || !object(context, none)) return false ;
+      }
+      start = text.find("\"benchmarks\"") ;
+      if (start == std::string::npos) return false ;
+      pos = text.find('[', start) ;
+      if (pos == std::string::npos) return false ;
+      ++ pos ;
+      for (;;) {
+        skip() ;
+        if (peek() == ']') return true ;
+        if (peek() == ',') { ++ pos ; continue ; }
+        Benchmark b ;
+        Fields fields ;
+        if (!object(fields, b.samples)) return false ;
+        b.key = fields["name"] + " size=" + fields["size"] + " threads=" + fields["threads"]
+              + " " + fields["layout"] + " " + fields["mode"] ;
+        b.size = std::atol(fields["size"].c_str()) ;
+        benchmarks.push_back(b) ;
+      }
+    }
+
+  private:
+    const std::string & text ;
+    size_t pos ;
+
+    char peek() const { return pos < text.size() ? text[pos] : '\0' ; }
+    void skip() { while (pos < text.size() && std::isspace((unsigned char)text[pos])) ++ pos ; }
+
+    bool string(std::string & value) {
+      skip() ;
+      if (peek() != '"') return false ;
+      size_t end = text.find('"', pos + 1) ;
+      if (end == std::string::npos) return false ;
+      value = text.substr(pos + 1, end - pos - 1) ;
+      pos = end + 1 ;
+      return true ;
+    }
+
+    bool number(double & value) {
+      skip() ;
+      const char * begin = text.c_str() + pos ;
+      char * end ;
+      value = std::strtod(begin, &end) ;
+      if (end == begin) return false ;
+      pos += end - begin ;
+      return true ;
+    }
+
+    // the "samples" array goes to samples, other arrays are skipped
+    bool object(Fields & fields, std::vector<double> & samples) {
+      skip() ;
+      if (peek() != '{') return false ;
+      ++ pos ;
+      for (;;) {
+        skip() ;
+        if (peek() == '}') { ++ pos ; break ; }
+        if (peek() == ',') { ++ pos ; continue ; }
+        std::string name, value ;
+        if (!string(name)) return false ;
+        skip() ;
+        if (peek() != ':') return false ;
+        ++ pos ;
+        skip() ;
+        if (peek() == '"') {
+          if (!string(value)) return false ;
+          fields[name] = value ;
+        } else if (peek() == '[') {
+          ++ pos ;
+          for (;;) {
+            skip() ;
+            if (peek() == ']') { ++ pos ; break ; }
+            if (peek() == ',') { ++ pos ; continue ; }
+            double x ;
+            if (!number(x)) return false ;
+            if (name == "samples") samples.push_back(x) ;
+          }
+        } else {
+          size_t begin = pos ;
+          double x ;
+          if (!number(x)) return false ;
+          fields[name] = text.substr(begin, pos - begin) ;
+        }
+      }
+      return true ;
+    }
+} ;
+
+static bool load(const char * fileName, Fields & context, std::vector<Benchmark> & benchmarks) {
+  std::stringstream text ;
+  if (!std::strcmp(fileName, "-")) {
+    text << std::cin.rdbuf() ;
+  } else {
+    std::ifstream file(fileName) ;
+    if (!file) {
+      std::cerr << "bench-compare: cannot open " << fileName << std::endl ;
+      return false ;
+    }
+    text << file.rdbuf() ;
+  }
+  std::string contents = text.str() ;
+  Parser parser(contents) ;
+  if (!parser.parse(context, benchmarks)) {
+    std::cerr << "bench-compare: cannot parse " << fileName << std::endl ;
+    return false ;
+  }
+  return true ;
+}
+
+/* ---------------------------------------------------------------- */
+// statistics
+/* ---------------------------------------------------------------- */
+
+static double median(std::vector<double> values) {
+  if (values.empty()) return 0 ;
+  std::sort(values.begin(), values.end()) ;
+  size_t n = values.size() ;
+  return (n % 2) ? values[n/2] : 0.5 * (values[n/2 - 1] + values[n/2]) ;
+}
+
+// U statistic of a against b, counting ties as one half
+static double mannWhitneyU(const std::vector<double> & a, const std::vector<double> & b) {
+  double u = 0 ;
+  for (size_t i = 0 ; i < a.size() ; ++i) {
+    for (size_t j = 0 ; j < b.size() ; ++j) {
+      u += (a[i] > b[j]) ? 1.0 : (a[i] == b[j] ? 0.5 : 0.0) ;
+    }
+  }
+  return u ;
+}
+
+// Two-sided p-value of U. For small samples the exact null
+// distribution is counted (ignoring ties); otherwise the normal
+// approximation with continuity correction is used.
+static double mannWhitneyP(double u, int n1, int n2) {
+  double mean = 0.5 * n1 * n2 ;
+  double distance = std::fabs(u - mean) ;
+  if (n1 <= 20 && n2 <= 20) {
+    // count[m][n][u]: orderings of m and n samples with statistic u
+    int maxU = n1 * n2 ;
+    std::vector<std::vector<double> > previous(n2 + 1), current(n2 + 1) ;
+    for (int n = 0 ; n <= n2 ; ++n) { previous[n].assign(maxU + 1, 0) ; previous[n][0] = 1 ; }
+    for (int m = 1 ; m <= n1 ; ++m) {
+      current[0].assign(maxU + 1, 0) ;
+      current[0][0] = 1 ;
+      for (int n = 1 ; n <= n2 ; ++n) {
+        current[n].assign(maxU + 1, 0) ;
+        for (int k = 0 ; k <= m * n ; ++k) {
+          // the largest sample comes from the first group (beating all n)
+          // or from the second one
+          current[n][k] = (k >= n ? previous[n][k - n] : 0) + current[n - 1][k] ;
+        }
+      }
+      previous.swap(current) ;
+    }
+    const std::vector<double> & count = previous[n2] ;
+    double total = 0, tail = 0 ;
+    for (int k = 0 ; k <= maxU ; ++k) {
+      total += count[k] ;
+      if (std::fabs(k - mean) >= distance - 1e-9) tail += count[k] ;
+    }
+    return tail / total ;
+  }
+  double sigma = std::sqrt(n1 * n2 * (n1 + n2 + 1) / 12.0) ;
+  double z = std::max(0.0, distance - 0.5) / sigma ;
+  return std::erfc(z / std::sqrt(2.0)) ;
+}
+
+// bootstrap 95% interval of median(current) / median(baseline)
+static void bootstrapRatio(const std::vector<double> & baseline, const std::vector<double> & current,
+                           double & low, double & high) {
+  const int rounds = 2000 ;
+  std::mt19937 random(0) ;
+  std::vector<double> ratios(rounds), a(baseline.size()), b(current.size()) ;
+  for (int r = 0 ; r < rounds ; ++r) {
+    for (size_t i = 0 ; i < a.size() ; ++i) a[i] = baseline[random() % baseline.size()] ;
+    for (size_t i = 0 ; i < b.size() ; ++i) b[i] = current[random() % current.size()] ;
+    double m = median(a) ;
+    ratios[r] = m > 0 ? median(b) / m : 1 ;
+  }
+  std::sort(ratios.begin(), ratios.end()) ;
+  low = ratios[(int)(0.025 * rounds)] ;
+  high = ratios[(int)(0.975 * rounds) - 1] ;
+}
+
+/* ---------------------------------------------------------------- */
+// main
+/* ---------------------------------------------------------------- */
+
+static void usage() {
+  std::cerr << "usage: bench-compare [--threshold F] [--alpha A] [--floor NS] BASELINE CURRENT" << std::endl
+            << "  CURRENT may be - to read from stdin." << std::endl
+            << "  --threshold  relative slowdown tolerated (default 0.05)" << std::endl
+            << "  --alpha      significance level (default 0.05)" << std::endl
+            << "  --floor      shortest kernel call gated, in ns (default 1000)" << std::endl ;
+}
+
+int main(int argc, char** argv) {
+  double threshold = 0.05 ;
+  double alpha = 0.05 ;
+  double floor = 1000 ;
+  std::vector<const char *> files ;
+  for (int i = 1 ; i < argc ; ++i) {
+    if (!std::strcmp(argv[i], "--threshold") && i + 1 < argc) threshold = std::atof(argv[++i]) ;
+    else if (!std::strcmp(argv[i], "--alpha") && i + 1 < argc) alpha = std::atof(argv[++i]) ;
+    else if (!std::strcmp(argv[i], "--floor") && i + 1 < argc) floor = std::atof(argv[++i]) ;
+    else if (argv[i][0] != '-' || !std::strcmp(argv[i], "-")) files.push_back(argv[i]) ;
+    else { usage() ; return 2 ; }
+  }
+  if (files.size() != 2) { usage() ; return 2 ; }
+
+  Fields baselineContext, currentContext ;
+  std::vector<Benchmark> baseline, current ;
+  if (!load(files[0], baselineContext, baseline) || !load(files[1], currentContext, current)) return 2 ;
+  const char * context [] = {"host", "compiler"} ;
+  for (int k = 0 ; k < 2 ; ++k) {
+    const std::string & a = baselineContext[context[k]] ;
+    const std::string & b = currentContext[context[k]] ;
+    if (a.empty() || a != b) {
+      std::cerr << "bench-compare: the runs are from different " << (k ? "compilers" : "hosts")
+                << " (" << (a.empty() ? "not recorded" : a) << " and " << (b.empty() ? "not recorded" : b)
+                << "); record a baseline here with ./bench --json" << std::endl ;
+      return 2 ;
+    }
+  }
+
+  std::map<std::string,const Benchmark*> byKey ;
+  for (size_t i = 0 ; i < baseline.size() ; ++i) byKey[baseline[i].key] = &baseline[i] ;
+
+  int regressions = 0, improvements = 0, compared = 0, skipped = 0 ;
+  for (size_t i = 0 ; i < current.size() ; ++i) {
+    const Benchmark & b = current[i] ;
+    std::map<std::string,const Benchmark*>::const_iterator found = byKey.find(b.key) ;
+    if (found == byKey.end()) {
+      std::printf("new       %s\n", b.key.c_str()) ;
+      continue ;
+    }
+    const Benchmark & a = *found->second ;
+    if (a.samples.empty() || b.samples.empty()) continue ;
+    double ratio = median(b.samples) / median(a.samples) ;
+    if (median(a.samples) * b.size < floor) {
+      std::printf("%-9s %-60s %+7.1f%% (below the %g ns floor)\n", "skipped", b.key.c_str(), 100 * (ratio - 1), floor) ;
+      ++ skipped ;
+      continue ;
+    }
+    ++ compared ;
+
+    double p = mannWhitneyP(mannWhitneyU(b.samples, a.samples), (int)b.samples.size(), (int)a.samples.size()) ;
+    double low, high ;
+    bootstrapRatio(a.samples, b.samples, low, high) ;
+
+    const char * verdict = "same" ;
+    if (p < alpha && ratio > 1 + threshold) { verdict = "REGRESSED" ; ++ regressions ; }
+    else if (p < alpha && ratio < 1 - threshold) { verdict = "improved" ; ++ improvements ; }
+    std::printf("%-9s %-60s %+7.1f%% [%+.1f%%, %+.1f%%] p=%.3g\n", verdict, b.key.c_str(),
+                100 * (ratio - 1), 100 * (low - 1), 100 * (high - 1), p) ;
+  }
+
+  std::printf("%d compared, %d regressed, %d improved, %d below the floor (threshold %.1f%%, alpha %g)\n",
+              compared, regressions, improvements, skipped, 100 * threshold, alpha) ;
+  if (compared > 0 && std::min(baseline[0].samples.size(), current[0].samples.size()) < 4) {
+    std::printf("note: with fewer than 4 samples per side no difference can be significant at alpha 0.05\n") ;
+  }
+  return regressions ? 1 : 0 ;
+}
@@ -0,0 +1,366 @@
+/** file: bench.cpp
+ ** brief: Microbenchmarks of the Ball and SpringMass kernels
+ **/
+
+#include "ball.h"
+#include "springmass.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// Every benchmark runs its kernel repeatedly for at least --min-time
+// seconds per sample and reports, per element (ball, mass or spring):
+//   ns_per_element     median over the samples
+//   bytes_per_element  estimate of the data the kernel reads and writes
+//   bandwidth_gbs      bytes_per_element / ns_per_element
+// The raw samples are included in the JSON so that runs can be
+// compared statistically (see bench-compare), together with the host
+// and the compiler, since timings from different ones do not compare.
+
+/* ---------------------------------------------------------------- */
+// options and results
+/* ---------------------------------------------------------------- */
+
+struct Options {
+  long maxSize ;
+  std::vector<int> threads ;
+  int repetitions ;
+  double minTime ;
+  std::string filter ;
+  const char * output ;
+  Options() : maxSize(1000000), repetitions(5), minTime(0.05), output(NULL) { threads.push_back(1) ; }
+} ;
+
+struct Result {
+  std::string name ;
+  long size ;
+  int threads ;
+  std::string layout ;
+  std::string mode ;
+  double bytesPerElement ;
+  std::vector<double> samples ; // ns per element
+} ;
+
+static double now() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count() ;
+}
+
+static double median(std::vector<double> values) {
+  if (values.empty()) return 0 ;
+  std::sort(values.begin(), values.end()) ;
+  size_t n = values.size() ;
+  return (n % 2) ? values[n/2] : 0.5 * (values[n/2 - 1] + values[n/2]) ;
+}
+
+// time kernel(iterations) and return ns per element for each sample
+template <typename Kernel>
+static std::vector<double> measure(const Options & options, long elements, Kernel kernel) {
+  // calibrate the number of iterations per sample
+  long iterations = 1 ;
+  for (;;) {
+    double start = now() ;
+    kernel(iterations) ;
+    double elapsed = now() - start ;
+    if (elapsed >= options.minTime || iterations >= (1L << 30)) break ;
+    double scale = (elapsed > 0) ? 1.5 * options.minTime / elapsed : 100 ;
+    iterations = std::max(iterations + 1, (long)(iterations * std::min(scale, 100.0))) ;
+  }
+  std::vector<double> samples ;
+  for (int r = 0 ; r < options.repetitions ; ++r) {
+    double start = now() ;
+    kernel(iterations) ;
+    double elapsed = now() - start ;
+    samples.push_back(elapsed * 1e9 / ((double)iterations * elements)) ;
+  }
+  return samples ;
+}
+
+/* ---------------------------------------------------------------- */
+// scenes
+/* ---------------------------------------------------------------- */
+
+// Masses of a square cloth, either in one contiguous array in row
+// order, or allocated one by one in a shuffled order so that
+// neighbours in the cloth are far apart in memory.
+
+class Cloth {
+  public:
+    Cloth(long size, bool scattered) : scattered(scattered) {
+      long rows = std::max(2L, (long)std::sqrt((double)size)) ;
+      long n = rows * rows ;
+      const double spacing = 1.6 / rows ;
+      const double mass = 1.0 / n ;
+      const double radius = 0.5 * spacing ;
+
+      std::vector<Mass> prototypes ;
+      prototypes.reserve(n) ;
+      for (long i = 0 ; i < rows ; ++i) {
+        for (long j = 0 ; j < rows ; ++j) {
+          prototypes.push_back(Mass(Vector3(-0.8 + j * spacing, -0.8 + i * spacing, 0),
+                                    Vector3(0.01 * ((i + j) % 3), 0, 0), mass, radius)) ;
+        }
+      }
+
+      if (scattered) {
+        std::vector<long> order(n) ;
+        for (long k = 0 ; k < n ; ++k) order[k] = k ;
+        std::shuffle(order.begin(), order.end(), std::mt19937(0)) ;
+        pointers.resize(n) ;
+        for (long k = 0 ; k < n ; ++k) pointers[order[k]] = new Mass(prototypes[order[k]]) ;
+      } else {
+        masses.swap(prototypes) ;
+        for (long k = 0 ; k < n ; ++k) pointers.push_back(&masses[k]) ;
+      }
+
+      const double stiff = 1 ;
+      for (long i = 0 ; i < rows ; ++i) {
+        for (long j = 0 ; j < rows ; ++j) {
+          Mass * m = pointers[i * rows + j] ;
+          if (j + 1 < rows) springs.push_back(Spring(m, pointers[i * rows + j + 1], spacing, stiff)) ;
+          if (i + 1 < rows) springs.push_back(Spring(m, pointers[(i + 1) * rows + j], spacing, stiff)) ;
+        }
+      }
+    }
+
+    ~Cloth() {
+      if (scattered) {
+        for (size_t k = 0 ; k < pointers.size() ; ++k) delete pointers[k] ;
+      }
+    }
+
+    bool scattered ;
+    std::vector<Mass> masses ;
+    std::vector<Mass *> pointers ;
+    std::vector<Spring> springs ;
+} ;
+
+/* ---------------------------------------------------------------- */
+// benchmarks
+/* ---------------------------------------------------------------- */
+
+static bool selected(const Options & options, const char * name) {
+  return options.filter.empty() || std::strstr(name, options.filter.c_str()) ;
+}
+
+static void benchBall(const Options & options, long size, std::vector<Result> & results) {
+  std::vector<Ball> balls ;
+  for (long k = 0 ; k < size ; ++k) balls.push_back(Ball(0.5 * std::sin((double)k), 0.5 * std::cos((double)k))) ;
+  Result r ;
+  r.name = "Ball::step" ; r.size = size ; r.threads = 1 ; r.layout = "contiguous" ; r.mode = "serial" ;
+  r.bytesPerElement = 2.0 * sizeof(Ball) ;
+  r.samples = measure(options, size, [&](long iterations) {
+    for (long it = 0 ; it < iterations ; ++it) {
+      for (long k = 0 ; k < size ; ++k) balls[k].step(1e-3) ;
+    }
+  }) ;
+  results.push_back(r) ;
+}
+
+static void benchMass(const Options & options, long size, bool scattered, std::vector<Result> & results) {
+  Cloth cloth(size, scattered) ;
+  std::vector<Mass *> & masses = cloth.pointers ;
+  long n = (long)masses.size() ;
+  Result r ;
+  r.name = "Mass::step" ; r.size = n ; r.threads = 1 ;
+  r.layout = scattered ? "scattered" : "contiguous" ; r.mode = "serial" ;
+  r.bytesPerElement = 2.0 * sizeof(Mass) + sizeof(Mass *) ;
+  r.samples = measure(options, n, [&](long iterations) {
+    for (long it = 0 ; it < iterations ; ++it) {
+      for (long k = 0 ; k < n ; ++k) masses[k]->step(1e-3) ;
+    }
+  }) ;
+  results.push_back(r) ;
+}
+
+static void benchSpring(const Options & options, long size, bool scattered, std::vector<Result> & results) {
+  Cloth cloth(size, scattered) ;
+  std::vector<Spring> & springs = cloth.springs ;
+  long n = (long)springs.size() ;
+  Result r ;
+  r.name = "Spring::getForce" ; r.size = n ; r.threads = 1 ;
+  r.layout = scattered ? "scattered" : "contiguous" ; r.mode = "serial" ;
+  r.bytesPerElement = sizeof(Spring) + 2.0 * 2 * sizeof(Vector3) ; // spring, endpoint positions and velocities
+  volatile double sink = 0 ;
+  r.samples = measure(options, n, [&](long iterations) {
+    double total = 0 ;
+    for (long it = 0 ; it < iterations ; ++it) {
+      for (long k = 0 ; k < n ; ++k) total += springs[k].getForce().x ;
+    }
+    sink = sink + total ;
+  }) ;
+  results.push_back(r) ;
+}
+
+// reordered: the scattered cloth renumbered by SpringMass::reorder,
+// which also copies the masses into one block in the new order
+static void benchSpringMass(const Options & options, long size, bool scattered, bool reordered, int threads,
+                            bool deterministic, std::vector<Result> & results) {
+  Cloth cloth(size, scattered || reordered) ;
+  SpringMass springmass ;
+  springmass.addSpring(cloth.springs) ;
+  if (reordered) springmass.reorder() ;
+  springmass.setNumThreads(threads) ;
+  springmass.setDeterministic(deterministic) ;
+  long numMasses = springmass.getNumMasses() ;
+  long numSprings = (long)springmass.getSpringList().size() ;
+  std::string mode = deterministic ? "gather" : (threads > 1 ? "scatter" : "serial") ;
+  std::string layout = reordered ? "reordered" : (scattered ? "scattered" : "contiguous") ;
+
+  // per mass: the mass read and written, its pointer, and its share
+  // of the springs, each reading both endpoints and adding to them
+  double springBytes = sizeof(Spring) + 2.0 * 3 * sizeof(Vector3) + 2 * sizeof(double) ;
+  Result r ;
+  if (selected(options, "SpringMass::step")) {
+    r.name = "SpringMass::step" ; r.size = numMasses ; r.threads = threads ; r.layout = layout ; r.mode = mode ;
+    r.bytesPerElement = 2.0 * sizeof(Mass) + sizeof(Mass *) + springBytes * numSprings / numMasses ;
+    r.samples = measure(options, numMasses, [&](long iterations) {
+      for (long it = 0 ; it < iterations ; ++it) springmass.step(1e-4) ;
+    }) ;
+    results.push_back(r) ;
+  }
+
+  if (selected(options, "SpringMass::getEnergy")) {
+    // invalidate() so that the energy is recomputed rather than cached
+    r.name = "SpringMass::getEnergy" ; r.size = numMasses ; r.threads = threads ; r.layout = layout ; r.mode = mode ;
+    r.bytesPerElement = sizeof(Mass) + sizeof(Mass *) + (sizeof(Spring) + 2.0 * sizeof(Vector3)) * numSprings / numMasses ;
+    volatile double sink = 0 ;
+    r.samples = measure(options, numMasses, [&](long iterations) {
+      for (long it = 0 ; it < iterations ; ++it) {
+        springmass.invalidate() ;
+        sink = sink + springmass.getEnergy() ;
+      }
+    }) ;
+    results.push_back(r) ;
+  }
+}
+
+/* ---------------------------------------------------------------- */
+// output
+/* ---------------------------------------------------------------- */
+
+// quotes and backslashes dropped, which bench-compare does not read
+static std::string plain(const std::string & text) {
+  std::string result ;
+  for (size_t i = 0 ; i < text.size() ; ++i) {
+    if (text[i] != '"' && text[i] != '\\' && (unsigned char)text[i] >= ' ') result += text[i] ;
+  }
+  return result ;
+}
+
+static std::string hostName() {
+#ifdef _WIN32
+  const char * name = std::getenv("COMPUTERNAME") ;
+  return name ? name : "unknown" ;
+#else
+  char name [256] = "" ;
+  if (gethostname(name, sizeof(name) - 1)) return "unknown" ;
+  return name ;
+#endif
+}
+
+static std::string compilerName() {
+#if defined(__clang__)
+  return std::string("clang ") + __clang_version__ ;
+#elif defined(__GNUC__)
+  return std::string("gcc ") + __VERSION__ ;
+#elif defined(_MSC_VER)
+  return "msvc " + std::to_string(_MSC_FULL_VER) ;
+#else
+  return "unknown" ;
+#endif
+}
+
+static void writeJson(FILE * out, const std::vector<Result> & results) {
+  std::fprintf(out, "{\n  \"context\": {\"host\": \"%s\", \"compiler\": \"%s\", \"cpus\": %u},\n",
+               plain(hostName()).c_str(), plain(compilerName()).c_str(), std::thread::hardware_concurrency()) ;
+  std::fprintf(out, "  \"benchmarks\": [\n") ;
+  for (size_t i = 0 ; i < results.size() ; ++i) {
+    const Result & r = results[i] ;
+    double ns = median(r.samples) ;
+    std::fprintf(out, "    {\"name\": \"%s\", \"size\": %ld, \"threads\": %d, \"layout\": \"%s\", \"mode\": \"%s\",\n"
+                      "     \"ns_per_element\": %.6g, \"bytes_per_element\": %.6g, \"bandwidth_gbs\": %.6g,\n"
+                      "     \"samples\": [",
+                 r.name.c_str(), r.size, r.threads, r.layout.c_str(), r.mode.c_str(),
+                 ns, r.bytesPerElement, ns > 0 ? r.bytesPerElement / ns : 0.0) ;
+    for (size_t k = 0 ; k < r.samples.size() ; ++k) {
+      std::fprintf(out, "%s%.6g", k ? ", " : "", r.samples[k]) ;
+    }
+    std::fprintf(out, "]}%s\n", i + 1 < results.size() ? "," : "") ;
+  }
+  std::fprintf(out, "  ]\n}\n") ;
+}
+
+static void printRow(const Result & r) {
+  double ns = median(r.samples) ;
+  std::fprintf(stderr, "%-22s %9ld %3d %-10s %-8s %10.3f ns/elem %7.1f B/elem %7.2f GB/s\n",
+               r.name.c_str(), r.size, r.threads, r.layout.c_str(), r.mode.c_str(),
+               ns, r.bytesPerElement, ns > 0 ? r.bytesPerElement / ns : 0.0) ;
+}
+
+static void usage() {
+  std::cerr << "usage: bench [--max-size N] [--threads 1,2,4] [--reps R] [--min-time S]" << std::endl
+            << "             [--filter NAME] [--json FILE]" << std::endl
+            << "Sizes go from 10 to N (default 1000000) by factors of 10." << std::endl
+            << "A table goes to stderr, JSON to FILE or stdout." << std::endl ;
+}
+
+int main(int argc, char** argv) {
+  Options options ;
+  for (int i = 1 ; i < argc ; ++i) {
+    bool hasValue = i + 1 < argc ;
+    if (!std::strcmp(argv[i], "--max-size") && hasValue) options.maxSize = std::atol(argv[++i]) ;
+    else if (!std::strcmp(argv[i], "--reps") && hasValue) options.repetitions = std::max(1, std::atoi(argv[++i])) ;
+    else if (!std::strcmp(argv[i], "--min-time") && hasValue) options.minTime = std::atof(argv[++i]) ;
+    else if (!std::strcmp(argv[i], "--filter") && hasValue) options.filter = argv[++i] ;
+    else if (!std::strcmp(argv[i], "--json") && hasValue) options.output = argv[++i] ;
+    else if (!std::strcmp(argv[i], "--threads") && hasValue) {
+      options.threads.clear() ;
+      for (char * p = argv[++i] ; *p ; ) {
+        options.threads.push_back(std::max(1, (int)std::strtol(p, &p, 10))) ;
+        if (*p == ',') ++ p ; else if (*p) { usage() ; return 1 ; }
+      }
+    }
+    else { usage() ; return 1 ; }
+  }
+
+  std::vector<Result> results ;
+  for (long size = 10 ; size <= options.maxSize ; size *= 10) {
+    size_t first = results.size() ;
+    if (selected(options, "Ball::step")) benchBall(options, size, results) ;
+    for (int layout = 0 ; layout < 3 ; ++layout) {
+      bool scattered = (layout == 1) ;
+      bool reordered = (layout == 2) ;
+      if (selected(options, "Mass::step") && !reordered) benchMass(options, size, scattered, results) ;
+      if (selected(options, "Spring::getForce") && !reordered) benchSpring(options, size, scattered, results) ;
+      if (selected(options, "SpringMass")) {
+        for (size_t t = 0 ; t < options.threads.size() ; ++t) {
+          benchSpringMass(options, size, scattered, reordered, options.threads[t], false, results) ;
+          benchSpringMass(options, size, scattered, reordered, options.threads[t], true, results) ;
+        }
+      }
+    }
+    for (size_t k = first ; k < results.size() ; ++k) printRow(results[k]) ;
+  }
+
+  FILE * out = options.output ? std::fopen(options.output, "w") : stdout ;
+  if (!out) {
+    std::cerr << "bench: cannot open " << options.output << std::endl ;
+    return 1 ;
+  }
+  writeJson(out, results) ;
+  if (out != stdout) std::fclose(out) ;
+  return 0 ;
+}
@@ -0,0 +1,22 @@
+/** file: canvas.h
+ ** brief: Canvas class (an interface)
+ **/
+
+#ifndef __canvas__
+#define __canvas__
+
+#include <string>
+
+// Something that draws in scene coordinates: the GLUT Figure or the
+// offscreen Raster. Radii are in scene units, line thicknesses and
+// text in pixels.
+
+class Canvas {
+  public:
+    virtual ~Canvas() { }
+    virtual void drawString(double x, double y, std::string str) = 0 ;
+    virtual void drawCircle(double x, double y, double radius) = 0 ;
+    virtual void drawLine(double x1, double y1, double x2, double y2, double thickness) = 0 ;
+} ;
+
+#endif /* defined(__canvas__) */
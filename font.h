@@ -0,0 +1,23 @@
+/** file: font.h
+ ** brief: Small bitmap font
+ **/
+
+#ifndef __font__
+#define __font__
+
+#include <cstdint>
+
+// 5x8 font for ASCII 32-126, one byte per column, least significant
+// bit at the top; rows 0-6 are above the baseline, row 7 is the
+// descender. Characters advance by FONT_ADVANCE pixels.
+
+#define FONT_FIRST_CHAR 32
+#define FONT_NUM_GLYPHS 95
+#define FONT_WIDTH 5
+#define FONT_HEIGHT 8
+#define FONT_ASCENT 7
+#define FONT_ADVANCE 6
+
+extern const uint8_t font5x8 [FONT_NUM_GLYPHS][5] ;
+
+#endif /* defined(__font__) */
@@ -4,13 +4,17 @@
  **/
 
 #include "graphics.h"
+#include "font.h"
 
 #include <cassert>
 #include <cmath>
+#include <cstdlib>
 #include <iostream>
 #include <algorithm>
-#include <sstream>
-#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <charconv>
 
 #include <tgmath.h>
 
@@ -27,11 +31,14 @@ void Drawable::draw() {}
 // class Figure : public Drawable
 /* ---------------------------------------------------------------- */
 
-Figure::Figure(std::string name) : xmin(-1), xmax(1), ymin(-1), ymax(1), glGrid(0), glCircle(0) {
+Figure::Figure(std::string name) : windowWidth(320), windowHeight(256), xmin(-1), xmax(1), ymin(-1), ymax(1),
+  glGrid(0), glDisc(0), glFont(0), numLineBatches(0) {
+  std::fill(glCircles, glCircles + FIGURE_CIRCLE_LODS, 0) ;
+  pixelSize = (ymax - ymin) / windowHeight ; // until the first reshape
   
   glutInitDisplayMode(GLUT_DEPTH | GLUT_DOUBLE | GLUT_RGBA);
   glutInitWindowPosition(128,128);
-  glutInitWindowSize(320,256);
+  glutInitWindowSize(windowWidth,windowHeight);
   id = glutCreateWindow(name.c_str()) ;
 
   // snychronise buffer swapping with OpenGL
@@ -49,7 +56,9 @@ Figure::Figure(std::string name) : xmin(-1), xmax(1), ymin(-1), ymax(1), glGrid(
   glutReshapeFunc(Figure::handleReshape) ;
 }
 
-// A display list to show the grid
+// A display list to show the grid lines; the labels are formatted
+// once here and drawn as text every frame, since their offset from the
+// lines is in pixels
 void Figure::updateGrid() {
   
   if (glGrid) {
@@ -59,7 +68,8 @@ void Figure::updateGrid() {
   glGrid = glGenLists(1) ;
   glNewList(glGrid, GL_COMPILE) ;
   double x, y ;
-  std::stringstream sstr ;
+  Label label ;
+  gridLabels.clear() ;
   glColor3f(0.8f, 0.8f, 0.8f);
   for (x = xmin ; x <= xmax ; x += (xmax-xmin)/10.0) {
     x = round(x * 10.0) / 10.0 ;
@@ -67,10 +77,10 @@ void Figure::updateGrid() {
     glVertex2d(x,-1) ;
     glVertex2d(x,+1) ;
     glEnd() ;
-    sstr.str("") ;
-    sstr<<std::fixed
-		<<std::setprecision(1)<<x;
-    drawString(x+2*pixelSize,2*pixelSize,sstr.str()) ;
+    label.x = x ;
+    label.y = 0 ;
+    *std::to_chars(label.text, label.text + sizeof(label.text) - 1, x, std::chars_format::fixed, 1).ptr = '\0' ;
+    gridLabels.push_back(label) ;
   }
   for (y = ymin ; y <= ymax ; y += (ymax-ymin)/10.0) {
     y = round(y * 10.0) / 10.0 ;
@@ -78,17 +88,21 @@ void Figure::updateGrid() {
     glVertex2d(-1,y) ;
     glVertex2d(1,y) ;
     glEnd() ;
-    sstr.str("") ;
-    sstr<<std::fixed
-		<<std::setprecision(1)<<y;
-    drawString(2*pixelSize,y+2*pixelSize,sstr.str()) ;
+    label.x = 0 ;
+    label.y = y ;
+    *std::to_chars(label.text, label.text + sizeof(label.text) - 1, y, std::chars_format::fixed, 1).ptr = '\0' ;
+    gridLabels.push_back(label) ;
   }
   glEndList() ;
 }
 
 
 Figure::~Figure() {
-  if (glCircle) glDeleteLists(glCircle, 1) ;
+  for (int k = 0 ; k < FIGURE_CIRCLE_LODS ; ++k) {
+    if (glCircles[k]) glDeleteLists(glCircles[k], 1) ;
+  }
+  if (glDisc) glDeleteTextures(1, &glDisc) ;
+  if (glFont) glDeleteTextures(1, &glFont) ;
   if (glGrid) glDeleteLists(glGrid, 1) ;
   glutDestroyWindow(id) ;
   figures.erase(std::remove(figures.begin(), figures.end(), this), figures.end());
@@ -153,7 +167,6 @@ void Figure::reshape(int width, int height) {
   glMatrixMode(GL_PROJECTION);
   glLoadIdentity();
   // gluOrtho2D(-aspect*ysize/2+x0,aspect*ysize/2+x0,ymin,ymax) ;
-  updateGrid() ;
   glutPostRedisplay() ;
 }
 
@@ -167,6 +180,10 @@ void Figure::draw() {
   glClearColor(1.0, 1.0, 1.0, 1.0) ;
   glClear(GL_COLOR_BUFFER_BIT);
   glCallList(glGrid) ;
+  glColor3f(0.8f, 0.8f, 0.8f);
+  for (std::vector<Label>::const_iterator it = gridLabels.begin() ; it != gridLabels.end() ; ++it) {
+    drawString(it->x + 2*pixelSize, it->y + 2*pixelSize, it->text) ;
+  }
 
   for(Figure::objects_t::iterator iter = objects.begin() ;
       iter != objects.end() ;
@@ -175,21 +192,74 @@ void Figure::draw() {
     glLoadIdentity();
     (*iter)->draw() ;
   }
+  drawBatch() ;
 
   glutSwapBuffers();
 }
 
 void Figure::drawString(double x, double y, std::string str) {
-  glRasterPos2f(x, y);
-  for (char const * cstr = str.c_str() ;
-       *cstr ;
-       ++cstr) {
-    glutBitmapCharacter(GLUT_BITMAP_HELVETICA_10, *cstr);
+  drawString(x, y, str.c_str()) ;
+}
+
+// (x,y) is the left end of the baseline, as for glRasterPos; the
+// color is the current one, as it would be latched by glRasterPos
+void Figure::drawString(double x, double y, const char * str) {
+  GLfloat current [4] ;
+  glGetFloatv(GL_CURRENT_COLOR, current) ;
+  GLubyte color [4] ;
+  for (int k = 0 ; k < 4 ; ++k) color[k] = (GLubyte)(255 * current[k] + 0.5f) ;
+
+  // glyph cells of the atlas are FONT_ATLAS_CELL texels wide and high,
+  // FONT_ATLAS_COLUMNS to a row
+  const double dx = (xmax - xmin) / windowWidth ;
+  const double dy = (ymax - ymin) / windowHeight ;
+  const GLfloat du = (GLfloat)FONT_ADVANCE / FONT_ATLAS_WIDTH ;
+  const GLfloat dv = (GLfloat)FONT_HEIGHT / FONT_ATLAS_HEIGHT ;
+  GLfloat x0 = (GLfloat)x ;
+  GLfloat x1 = (GLfloat)(x + FONT_ADVANCE * dx) ;
+  GLfloat y0 = (GLfloat)(y - (FONT_HEIGHT - FONT_ASCENT) * dy) ;
+  GLfloat y1 = (GLfloat)(y + FONT_ASCENT * dy) ;
+  for ( ; *str ; ++str) {
+    int glyph = (unsigned char)*str - FONT_FIRST_CHAR ;
+    if (glyph > 0 && glyph < FONT_NUM_GLYPHS) {
+      GLfloat u = (GLfloat)(glyph % FONT_ATLAS_COLUMNS * FONT_ATLAS_CELL) / FONT_ATLAS_WIDTH ;
+      GLfloat v = (GLfloat)(glyph / FONT_ATLAS_COLUMNS * FONT_ATLAS_CELL) / FONT_ATLAS_HEIGHT ;
+      const GLfloat corners [4][4] = {{x0, y0, u, v + dv}, {x1, y0, u + du, v + dv},
+                                      {x1, y1, u + du, v}, {x0, y1, u, v}} ;
+      for (int k = 0 ; k < 4 ; ++k) {
+        textVertices.push_back(corners[k][0]) ;
+        textVertices.push_back(corners[k][1]) ;
+        textTexCoords.push_back(corners[k][2]) ;
+        textTexCoords.push_back(corners[k][3]) ;
+        textColors.insert(textColors.end(), color, color + 4) ;
+      }
+    }
+    GLfloat advance = (GLfloat)(FONT_ADVANCE * dx) ;
+    x0 += advance ;
+    x1 += advance ;
   }
 }
 
+void Figure::drawNumber(double x, double y, double value, int precision) {
+  char buffer [64] ;
+  std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer) - 1, value,
+                                              std::chars_format::general, precision) ;
+  *result.ptr = '\0' ;
+  drawString(x, y, buffer) ;
+}
+
+bool Figure::isVisible(double x0, double y0, double x1, double y1) const {
+  return x1 >= xmin && x0 <= xmax && y1 >= ymin && y0 <= ymax ;
+}
+
+bool Figure::isSubPixel(double pixelRadius) {
+  return pixelRadius < 1 ;
+}
+
 void Figure::drawLine(double x1, double y1, double x2, double y2, double thickness) {
-  glPushMatrix() ;
+  double margin = 0.5 * std::max(thickness, 1.0) * pixelSize ;
+  if (!isVisible(std::min(x1, x2) - margin, std::min(y1, y2) - margin,
+                 std::max(x1, x2) + margin, std::max(y1, y2) + margin)) return ;
   glPushAttrib(GL_LINE_BIT) ;
   glLineWidth(thickness) ;
   glBegin(GL_LINES) ;
@@ -199,50 +269,259 @@ void Figure::drawLine(double x1, double y1, double x2, double y2, double thickne
   glPopAttrib() ;
 }
 
-void Figure::drawCircle(double x, double y, double r) {
-  if (glCircle == 0) {
-    glCircle = glGenLists(1) ;
-    glNewList(glCircle, GL_COMPILE) ;
+// The display list of the coarsest circle whose outline stays within a
+// quarter of a pixel of the true one: r (1 - cos(pi/n)) <= 1/4.
+GLuint Figure::getCircleList(double pixelRadius) {
+  int lod = 0 ;
+  while (lod + 1 < FIGURE_CIRCLE_LODS &&
+         pixelRadius * (1 - std::cos(M_PI / (8 << lod))) > 0.25) ++ lod ;
+  if (glCircles[lod] == 0) {
+    glCircles[lod] = glGenLists(1) ;
+    glNewList(glCircles[lod], GL_COMPILE) ;
     glBegin(GL_TRIANGLE_FAN);
     glColor3d(0,0,1) ;
     glVertex2d(0,0) ;
-    int numSegments = 128;
+    int numSegments = 8 << lod ;
     for (int i = 0; i <= numSegments; i++) {
-      double angle = i * 2.0 * 3.1468 / numSegments;
+      double angle = i * 2.0 * M_PI / numSegments;
       glVertex2d(std::cos(angle),
                  std::sin(angle));
     }
     glEnd();
     glEndList() ;
   }
+  return glCircles[lod] ;
+}
 
+void Figure::drawCircle(double x, double y, double r) {
+  if (!isVisible(x - r, y - r, x + r, y + r)) return ;
+  double pixelRadius = r / pixelSize ;
+  if (isSubPixel(pixelRadius)) {
+    glColor3d(0,0,1) ;
+    glBegin(GL_POINTS) ;
+    glVertex2d(x, y) ;
+    glEnd() ;
+    return ;
+  }
+
+  GLuint list = getCircleList(pixelRadius) ;
   glPushMatrix() ;
   glTranslated(x,y,0) ;
   glScaled(r,r,r) ;
-  glCallList(glCircle) ;
+  glCallList(list) ;
   glPopMatrix() ;
 }
 
+void Figure::batchCircle(double x, double y, double r) {
+  if (!isVisible(x - r, y - r, x + r, y + r)) return ;
+  if (isSubPixel(r / pixelSize)) {
+    pointVertices.push_back((GLfloat)x) ;
+    pointVertices.push_back((GLfloat)y) ;
+    return ;
+  }
+  const GLfloat corners [4][2] = {{-1,-1}, {1,-1}, {1,1}, {-1,1}} ;
+  for (int k = 0 ; k < 4 ; ++k) {
+    circleVertices.push_back((GLfloat)(x + r * corners[k][0])) ;
+    circleVertices.push_back((GLfloat)(y + r * corners[k][1])) ;
+    circleTexCoords.push_back(0.5f * (corners[k][0] + 1)) ;
+    circleTexCoords.push_back(0.5f * (corners[k][1] + 1)) ;
+  }
+}
+
+void Figure::batchLine(double x1, double y1, double x2, double y2, double thickness) {
+  double margin = 0.5 * std::max(thickness, 1.0) * pixelSize ;
+  if (!isVisible(std::min(x1, x2) - margin, std::min(y1, y2) - margin,
+                 std::max(x1, x2) + margin, std::max(y1, y2) + margin)) return ;
+
+  // springs mostly share a few thicknesses: look for it among the
+  // batches used so far
+  size_t b = 0 ;
+  while (b < numLineBatches && lineBatches[b].first != (GLfloat)thickness) ++ b ;
+  if (b == numLineBatches) {
+    if (b == lineBatches.size()) lineBatches.resize(b + 1) ;
+    lineBatches[b].first = (GLfloat)thickness ;
+    ++ numLineBatches ;
+  }
+  std::vector<GLfloat> & vertices = lineBatches[b].second ;
+  vertices.push_back((GLfloat)x1) ;
+  vertices.push_back((GLfloat)y1) ;
+  vertices.push_back((GLfloat)x2) ;
+  vertices.push_back((GLfloat)y2) ;
+}
+
+// A disc with a one texel soft edge, alpha only; GL_MODULATE takes the
+// color from the current one.
+#define DISC_TEXTURE_SIZE 64
+
+static void setAlphaTexture(GLuint texture, int width, int height, const GLubyte * alpha, GLint filter) {
+  glBindTexture(GL_TEXTURE_2D, texture) ;
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1) ;
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter) ;
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter) ;
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP) ;
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP) ;
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, width, height, 0, GL_ALPHA, GL_UNSIGNED_BYTE, alpha) ;
+}
+
+void Figure::drawBatch() {
+  if (circleVertices.empty() && pointVertices.empty() && numLineBatches == 0 && textVertices.empty()) return ;
+
+  glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_LINE_BIT | GL_POINT_BIT | GL_TEXTURE_BIT | GL_CURRENT_BIT) ;
+  glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT) ;
+  glEnableClientState(GL_VERTEX_ARRAY) ;
+  glColor3d(0,0,1) ;
+
+  if (!circleVertices.empty()) {
+    if (glDisc == 0) {
+      std::vector<GLubyte> alpha(DISC_TEXTURE_SIZE * DISC_TEXTURE_SIZE) ;
+      const double c = 0.5 * DISC_TEXTURE_SIZE ;
+      for (int i = 0 ; i < DISC_TEXTURE_SIZE ; ++i) {
+        for (int j = 0 ; j < DISC_TEXTURE_SIZE ; ++j) {
+          double d = c - std::sqrt((i + 0.5 - c) * (i + 0.5 - c) + (j + 0.5 - c) * (j + 0.5 - c)) ;
+          alpha[i * DISC_TEXTURE_SIZE + j] = (GLubyte)(255 * std::min(1.0, std::max(0.0, d))) ;
+        }
+      }
+      glGenTextures(1, &glDisc) ;
+      setAlphaTexture(glDisc, DISC_TEXTURE_SIZE, DISC_TEXTURE_SIZE, alpha.data(), GL_LINEAR) ;
+    }
+    glEnable(GL_TEXTURE_2D) ;
+    glBindTexture(GL_TEXTURE_2D, glDisc) ;
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE) ;
+    glEnable(GL_BLEND) ;
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) ;
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY) ;
+    glVertexPointer(2, GL_FLOAT, 0, circleVertices.data()) ;
+    glTexCoordPointer(2, GL_FLOAT, 0, circleTexCoords.data()) ;
+    glDrawArrays(GL_QUADS, 0, (GLsizei)(circleVertices.size() / 2)) ;
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY) ;
+    glDisable(GL_TEXTURE_2D) ;
+    glDisable(GL_BLEND) ;
+  }
+
+  if (!pointVertices.empty()) {
+    glPointSize(1) ;
+    glVertexPointer(2, GL_FLOAT, 0, pointVertices.data()) ;
+    glDrawArrays(GL_POINTS, 0, (GLsizei)(pointVertices.size() / 2)) ;
+  }
+
+  for (size_t b = 0 ; b < numLineBatches ; ++b) {
+    std::vector<GLfloat> & vertices = lineBatches[b].second ;
+    glLineWidth(lineBatches[b].first) ;
+    glVertexPointer(2, GL_FLOAT, 0, vertices.data()) ;
+    glDrawArrays(GL_LINES, 0, (GLsizei)(vertices.size() / 2)) ;
+    vertices.clear() ;
+  }
+
+  if (!textVertices.empty()) {
+    if (glFont == 0) {
+      // texel (i,j) of glyph g is row i, column j of its cell
+      std::vector<GLubyte> alpha(FONT_ATLAS_WIDTH * FONT_ATLAS_HEIGHT, 0) ;
+      for (int g = 0 ; g < FONT_NUM_GLYPHS ; ++g) {
+        int u = g % FONT_ATLAS_COLUMNS * FONT_ATLAS_CELL ;
+        int v = g / FONT_ATLAS_COLUMNS * FONT_ATLAS_CELL ;
+        for (int j = 0 ; j < FONT_WIDTH ; ++j) {
+          for (int i = 0 ; i < FONT_HEIGHT ; ++i) {
+            if (font5x8[g][j] & (1 << i)) alpha[(v + i) * FONT_ATLAS_WIDTH + u + j] = 255 ;
+          }
+        }
+      }
+      glGenTextures(1, &glFont) ;
+      setAlphaTexture(glFont, FONT_ATLAS_WIDTH, FONT_ATLAS_HEIGHT, alpha.data(), GL_NEAREST) ;
+    }
+    glEnable(GL_TEXTURE_2D) ;
+    glBindTexture(GL_TEXTURE_2D, glFont) ;
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE) ;
+    glEnable(GL_BLEND) ;
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) ;
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY) ;
+    glEnableClientState(GL_COLOR_ARRAY) ;
+    glVertexPointer(2, GL_FLOAT, 0, textVertices.data()) ;
+    glTexCoordPointer(2, GL_FLOAT, 0, textTexCoords.data()) ;
+    glColorPointer(4, GL_UNSIGNED_BYTE, 0, textColors.data()) ;
+    glDrawArrays(GL_QUADS, 0, (GLsizei)(textVertices.size() / 2)) ;
+    textVertices.clear() ;
+    textTexCoords.clear() ;
+    textColors.clear() ;
+  }
+
+  glPopClientAttrib() ;
+  glPopAttrib() ;
+  circleVertices.clear() ;
+  circleTexCoords.clear() ;
+  pointVertices.clear() ;
+  numLineBatches = 0 ;
+}
+
 Simulation * runningSimulation = NULL ;
 double runningSimulationTime ;
 double runningSimulationTimeStep ;
+double runningAccumulator = 0 ;
+double runningInterpolation = 1 ;
+int runningMaxStepsPerFrame = 0 ;
+RunStats runningStats = RunStats() ;
+
+static double wallTime() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count() ;
+}
 
+static void printRunStats() {
+  if (runningStats.droppedTime > 0) {
+    std::cerr << "run: " << runningStats.frames << " frames, " << runningStats.steps << " steps, "
+              << runningStats.droppedTime << " s of simulated time dropped in "
+              << runningStats.cappedFrames << " frames" << std::endl ;
+  }
+}
+
+// Fixed time step: wall time accumulates and is consumed in steps of
+// exactly timeStep. The remainder becomes the interpolation factor
+// between the last two states. At most maxStepsPerFrame steps are
+// taken per frame, so that a stall does not snowball into ever longer
+// catch-up bursts; the time beyond that is dropped.
 void handleTimer(int id) {
   if (runningSimulation) {
-    double now = glutGet(GLUT_ELAPSED_TIME) / 1000.0 ;
-    double dt = now - runningSimulationTime ;
+    double now = wallTime() ;
     double dt0 = runningSimulationTimeStep ;
+    runningAccumulator += now - runningSimulationTime ;
     runningSimulationTime = now ;
-    double n = std::ceil(dt / dt0) ;
-    for (int i = 0 ; i < n ; ++i) {
-      runningSimulation->step(dt / n) ;
+    int n = (int)std::min((double)runningMaxStepsPerFrame, std::floor(runningAccumulator / dt0)) ;
+    if (n > 0) {
+      // only the last two states are needed to interpolate
+      if (n > 1) {
+        runningSimulation->stepN(dt0, n - 1) ;
+        runningSimulation->publish() ;
+      }
+      runningSimulation->step(dt0) ;
+      runningSimulation->publish() ;
+      runningAccumulator -= n * dt0 ;
+    }
+    if (runningAccumulator >= dt0) {
+      double dropped = std::floor(runningAccumulator / dt0) * dt0 ;
+      runningAccumulator -= dropped ;
+      runningStats.droppedTime += dropped ;
+      ++ runningStats.cappedFrames ;
     }
+    runningStats.steps += n ;
+    runningStats.maxStepsPerFrame = std::max(runningStats.maxStepsPerFrame, n) ;
+    ++ runningStats.frames ;
+    runningInterpolation = runningAccumulator / dt0 ;
     runningSimulation->display() ;
   }
   glutTimerFunc((unsigned int)
                 (0.99 * 1000 * runningSimulationTimeStep), handleTimer, 0);
 }
 
+void setMaxStepsPerFrame(int maxSteps) {
+  runningMaxStepsPerFrame = maxSteps ;
+}
+
+double getInterpolation() {
+  return runningInterpolation ;
+}
+
+const RunStats & getRunStats() {
+  return runningStats ;
+}
+
 void run() {
   run (NULL, 0) ;
 }
@@ -250,12 +529,65 @@ void run() {
 void run(Simulation * simulation, double timeStep) {
   
   runningSimulationTimeStep = timeStep ;
-  runningSimulationTime = glutGet(GLUT_ELAPSED_TIME) / 1000.0 ;
+  runningSimulationTime = wallTime() ;
+  runningAccumulator = 0 ;
+  if (runningMaxStepsPerFrame <= 0 && timeStep > 0) {
+    runningMaxStepsPerFrame = std::max(1, (int)std::ceil(RUN_MAX_FRAME_TIME / timeStep)) ;
+  }
   
   if (simulation) {
     runningSimulation = simulation ;
+    std::atexit(printRunStats) ;
     glutTimerFunc(0, handleTimer, 0);
   }
   
   glutMainLoop() ;
 }
+
+std::thread simulationThread ;
+std::atomic<bool> simulationStopping(false) ;
+double runningFrameTime ;
+
+static void simulationLoop(Simulation * simulation, double timeStep) {
+  typedef std::chrono::steady_clock clock ;
+  clock::duration period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(timeStep)) ;
+  clock::duration maxLag = std::max(period, clock::duration(std::chrono::milliseconds(100))) ;
+  clock::time_point next = clock::now() ;
+  while (!simulationStopping.load(std::memory_order_relaxed)) {
+    simulation->step(timeStep) ;
+    simulation->publish() ;
+    next += period ;
+    clock::time_point now = clock::now() ;
+    if (now < next) {
+      std::this_thread::sleep_until(next) ;
+    } else if (now - next > maxLag) {
+      next = now ; // too slow for real time: fall behind rather than burst
+    }
+  }
+}
+
+static void stopSimulationThread() {
+  simulationStopping = true ;
+  if (simulationThread.joinable()) simulationThread.join() ;
+}
+
+static void handleFrameTimer(int) {
+  if (runningSimulation) runningSimulation->display() ;
+  glutTimerFunc((unsigned int)(1000 * runningFrameTime), handleFrameTimer, 0) ;
+}
+
+void runThreaded(Simulation * simulation, double timeStep, double frameTime) {
+  runningSimulation = simulation ;
+  runningInterpolation = 1 ; // always the latest state
+  runningSimulationTimeStep = timeStep ;
+  runningFrameTime = frameTime ;
+
+  // glutMainLoop() may leave through exit()
+  simulationStopping = false ;
+  simulationThread = std::thread(simulationLoop, simulation, timeStep) ;
+  std::atexit(stopSimulationThread) ;
+
+  glutTimerFunc(0, handleFrameTimer, 0) ;
+  glutMainLoop() ;
+  stopSimulationThread() ;
+}
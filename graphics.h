@@ -7,6 +7,7 @@
 #define __graphics__
 
 #include "simulation.h"
+#include "canvas.h"
 
 // STL
 #include <string>
@@ -25,6 +26,30 @@
 void run() ;
 void run(Simulation * simulation, double timeStep) ;
 
+// run() steps by exactly timeStep, at most this many steps per frame
+// (by default as many as RUN_MAX_FRAME_TIME seconds take)
+#define RUN_MAX_FRAME_TIME (1.0/15)
+void setMaxStepsPerFrame(int maxSteps) ;
+
+// How far between the previous and the latest published state the
+// frame being drawn is, in [0,1]: draw() should show
+// previous + getInterpolation() * (latest - previous).
+double getInterpolation() ;
+
+struct RunStats {
+  long frames ;
+  long steps ;
+  int maxStepsPerFrame ;
+  long cappedFrames ;    // frames that hit the steps limit
+  double droppedTime ;   // simulated seconds skipped because of it
+} ;
+const RunStats & getRunStats() ;
+
+// Steps the simulation on its own thread, in real time, and only
+// redraws on the GLUT thread. The simulation must hand its state to
+// draw() through publish(), e.g. with a TripleBuffer.
+void runThreaded(Simulation * simulation, double timeStep, double frameTime = 1.0/60) ;
+
 /* ---------------------------------------------------------------- */
 // class Drawable
 /* ---------------------------------------------------------------- */
@@ -38,7 +63,19 @@ class Drawable {
 // class Figure
 /* ---------------------------------------------------------------- */
 
-class Figure : public Drawable {
+// Circles are drawn with as few segments as keep the outline within a
+// quarter of a pixel of the true circle, as points when smaller than a
+// pixel, and not at all when outside the view; so are lines.
+
+#define FIGURE_CIRCLE_LODS 5
+
+// the font atlas: 16 x 6 cells of 8 x 8 texels
+#define FONT_ATLAS_CELL 8
+#define FONT_ATLAS_COLUMNS 16
+#define FONT_ATLAS_WIDTH 128
+#define FONT_ATLAS_HEIGHT 64
+
+class Figure : public Drawable, public Canvas {
   public:
     Figure(std::string name) ;
     ~Figure() ;
@@ -54,6 +91,20 @@ class Figure : public Drawable {
     void drawCircle(double x, double y, double radius) ;
     void drawLine(double x1, double y1, double x2, double y2, double thickness) ;
 
+    // Text is drawn from a texture atlas of a small bitmap font and
+    // batched like circles and lines, in the current color. These two
+    // do not allocate, so they are cheap for per-frame labels.
+    void drawString(double x, double y, const char * str) ;
+    void drawNumber(double x, double y, double value, int precision = 6) ;
+
+    // Batched drawing for large scenes: the shapes are collected into
+    // vertex arrays and drawn once all the Drawables are done: all
+    // circles with one call (a textured quad each), all lines with one
+    // call per distinct thickness and then all text with one call.
+    void batchCircle(double x, double y, double radius) ;
+    void batchLine(double x1, double y1, double x2, double y2, double thickness) ;
+    void drawBatch() ;
+
   private:
     int id ;
     int windowWidth ;
@@ -64,7 +115,23 @@ class Figure : public Drawable {
     double ymin ;
     double ymax ;
     GLuint glGrid ;
-    GLuint glCircle ;
+    GLuint glCircles [FIGURE_CIRCLE_LODS] ; // 8, 16, ... segments
+    GLuint glDisc ;
+    GLuint glFont ;
+
+    // batch vertex arrays, reused from frame to frame
+    std::vector<GLfloat> circleVertices ;    // x y per corner
+    std::vector<GLfloat> circleTexCoords ;   // u v per corner
+    std::vector<GLfloat> pointVertices ;     // x y of sub-pixel circles
+    std::vector<GLfloat> textVertices ;      // x y per glyph corner
+    std::vector<GLfloat> textTexCoords ;     // u v per glyph corner
+    std::vector<GLubyte> textColors ;        // r g b a per glyph corner
+
+    // grid labels, formatted once
+    struct Label { double x ; double y ; char text [8] ; } ;
+    std::vector<Label> gridLabels ;
+    std::vector<std::pair<GLfloat, std::vector<GLfloat> > > lineBatches ; // by thickness
+    size_t numLineBatches ;
 
     typedef std::vector<Drawable*> objects_t ;
     objects_t objects ;
@@ -74,6 +141,9 @@ class Figure : public Drawable {
     static Figure * findByWindowId(int id) ;
     void updateGrid() ;
     void makeCurrent() const ;
+    bool isVisible(double x0, double y0, double x1, double y1) const ;
+    static bool isSubPixel(double pixelRadius) ;
+    GLuint getCircleList(double pixelRadius) ;
 } ;
 
 #endif /* defined(__graphics__) */
@@ -1,16 +1,22 @@
-load('springmass.txt');
+% springmass.csv from trajectory-slice: the time, then x,y,z of each
+% mass; springmass.txt from test-springmass: x,y,z of each mass
+if exist('springmass.csv', 'file')
+    springmass = load('springmass.csv');
+    springmass = springmass(:, 2:end);
+else
+    springmass = load('springmass.txt');
+end
+x = springmass(:, 1:3:end);
+y = springmass(:, 2:3:end);
 
 hold on 
-mass1 = plot(springmass(1, 1), springmass(1, 2), 'o');
-mass2 = plot(springmass(1, 3), springmass(1, 4), 'o');
+masses = plot(x(1, :), y(1, :), 'o');
 xlim([-1, 1])
 ylim([-1, 1])
 axis square
 
 for i = 2:size(springmass, 1)
-    mass1.XData = springmass(i, 1);
-    mass1.YData = springmass(i, 2);
-    mass2.XData = springmass(i, 3);
-    mass2.YData = springmass(i, 4);
+    masses.XData = x(i, :);
+    masses.YData = y(i, :);
     drawnow
 end
\ No newline at end of file
@@ -0,0 +1,145 @@
+/** file: profiler.cpp
+ ** brief: Per-phase timing of the simulation step - implementation
+ **/
+
+#include "profiler.h"
+
+#include <iomanip>
+
+/* ---------------------------------------------------------------- */
+// class PhaseStats
+/* ---------------------------------------------------------------- */
+
+// bucket of a duration: the power of two it falls in, refined by the
+// next PROFILE_SUB_BITS bits below the leading one
+static int bucketOf(uint64_t ns) {
+  if (ns < PROFILE_SUB_BUCKETS) return (int)ns ;
+  int msb = 63 ;
+  while (!(ns >> msb)) -- msb ;
+  int sub = (int)((ns >> (msb - PROFILE_SUB_BITS)) & (PROFILE_SUB_BUCKETS - 1)) ;
+  return (msb - PROFILE_SUB_BITS + 1) * PROFILE_SUB_BUCKETS + sub ;
+}
+
+// lower edge of a bucket
+static uint64_t bucketValue(int bucket) {
+  if (bucket < PROFILE_SUB_BUCKETS) return (uint64_t)bucket ;
+  int msb = bucket / PROFILE_SUB_BUCKETS + PROFILE_SUB_BITS - 1 ;
+  int sub = bucket % PROFILE_SUB_BUCKETS ;
+  return ((uint64_t)(PROFILE_SUB_BUCKETS + sub)) << (msb - PROFILE_SUB_BITS) ;
+}
+
+PhaseStats::PhaseStats() {
+  reset() ;
+}
+
+void PhaseStats::reset() {
+  count.store(0, std::memory_order_relaxed) ;
+  total.store(0, std::memory_order_relaxed) ;
+  min.store(~(uint64_t)0, std::memory_order_relaxed) ;
+  max.store(0, std::memory_order_relaxed) ;
+  for (int b = 0 ; b < PROFILE_BUCKETS ; ++b) histogram[b].store(0, std::memory_order_relaxed) ;
+}
+
+void PhaseStats::add(uint64_t ns) {
+  count.fetch_add(1, std::memory_order_relaxed) ;
+  total.fetch_add(ns, std::memory_order_relaxed) ;
+  uint64_t m = min.load(std::memory_order_relaxed) ;
+  while (ns < m && !min.compare_exchange_weak(m, ns, std::memory_order_relaxed)) { }
+  m = max.load(std::memory_order_relaxed) ;
+  while (ns > m && !max.compare_exchange_weak(m, ns, std::memory_order_relaxed)) { }
+  histogram[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed) ;
+}
+
+double PhaseStats::getTotal() const { return total.load(std::memory_order_relaxed) * 1e-9 ; }
+double PhaseStats::getMin() const { return getCount() ? min.load(std::memory_order_relaxed) * 1e-9 : 0 ; }
+double PhaseStats::getMax() const { return max.load(std::memory_order_relaxed) * 1e-9 ; }
+double PhaseStats::getMean() const {
+  uint64_t n = getCount() ;
+  return n ? (double)total.load(std::memory_order_relaxed) / n * 1e-9 : 0 ;
+}
+
+double PhaseStats::getPercentile(double p) const {
+  uint64_t n = getCount() ;
+  if (n == 0) return 0 ;
+  uint64_t rank = (uint64_t)(p * (n - 1)) ;
+  uint64_t lo = min.load(std::memory_order_relaxed) ;
+  uint64_t hi = max.load(std::memory_order_relaxed) ;
+  uint64_t seen = 0 ;
+  for (int b = 0 ; b < PROFILE_BUCKETS ; ++b) {
+    seen += histogram[b].load(std::memory_order_relaxed) ;
+    if (seen > rank) {
+      uint64_t value = bucketValue(b) ;
+      if (value < lo) value = lo ;
+      if (value > hi) value = hi ;
+      return value * 1e-9 ;
+    }
+  }
+  return getMax() ;
+}
+
+/* ---------------------------------------------------------------- */
+// class Profiler
+/* ---------------------------------------------------------------- */
+
+Profiler::Profiler() : steps(0), interval(0), stream(&std::cerr) { }
+
+Profiler & Profiler::instance() {
+  static Profiler profiler ;
+  return profiler ;
+}
+
+const char * Profiler::getPhaseName(ProfilePhase phase) {
+  switch (phase) {
+    case PHASE_STEP: return "step" ;
+    case PHASE_FORCE_RESET: return "force reset" ;
+    case PHASE_SPRING_FORCES: return "spring forces" ;
+    case PHASE_INTEGRATION: return "integration" ;
+    case PHASE_OUTPUT: return "output" ;
+    default: return "?" ;
+  }
+}
+
+void Profiler::record(ProfilePhase phase, uint64_t ns) {
+  stats[phase].add(ns) ;
+}
+
+const PhaseStats & Profiler::getStats(ProfilePhase phase) const {
+  return stats[phase] ;
+}
+
+void Profiler::reset() {
+  for (int p = 0 ; p < NUM_PROFILE_PHASES ; ++p) stats[p].reset() ;
+  steps = 0 ;
+}
+
+void Profiler::setSummaryInterval(long _interval, std::ostream * _stream) {
+  interval = _interval ;
+  stream = _stream ;
+}
+
+void Profiler::endStep() {
+  ++ steps ;
+  if (interval > 0 && stream && steps % interval == 0) printSummary(*stream) ;
+}
+
+void Profiler::printSummary(std::ostream & out) const {
+  std::ios::fmtflags flags = out.flags() ;
+  out << "profile after " << steps << " steps (microseconds)" << std::endl
+      << std::setw(16) << "phase" << std::setw(10) << "count"
+      << std::setw(12) << "min" << std::setw(12) << "mean"
+      << std::setw(12) << "p99" << std::setw(12) << "max"
+      << std::setw(12) << "total ms" << std::endl
+      << std::fixed << std::setprecision(2) ;
+  for (int p = 0 ; p < NUM_PROFILE_PHASES ; ++p) {
+    const PhaseStats & s = stats[p] ;
+    if (s.getCount() == 0) continue ;
+    out << std::setw(16) << getPhaseName((ProfilePhase)p)
+        << std::setw(10) << s.getCount()
+        << std::setw(12) << s.getMin() * 1e6
+        << std::setw(12) << s.getMean() * 1e6
+        << std::setw(12) << s.getPercentile(0.99) * 1e6
+        << std::setw(12) << s.getMax() * 1e6
+        << std::setw(12) << s.getTotal() * 1e3 << std::endl ;
+  }
+  out.flags(flags) ;
+}
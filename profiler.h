@@ -0,0 +1,126 @@
+/** file: profiler.h
+ ** brief: Per-phase timing of the simulation step
+ **/
+
+#ifndef __profiler__
+#define __profiler__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+// Compile with -DSPRINGMASS_PROFILE to enable the PROFILE_* macros;
+// otherwise they expand to nothing and cost nothing.
+
+enum ProfilePhase {
+  PHASE_STEP,           // the whole SpringMass::step
+  PHASE_FORCE_RESET,    // setting forces to gravity (first step only,
+                        // afterwards fused into the integration pass)
+  PHASE_SPRING_FORCES,  // spring pass
+  PHASE_INTEGRATION,    // mass pass, including the wall collisions
+                        // resolved inside Mass::step
+  PHASE_OUTPUT,         // display() and trajectory writers
+  NUM_PROFILE_PHASES
+} ;
+
+/* ---------------------------------------------------------------- */
+// class PhaseStats
+/* ---------------------------------------------------------------- */
+
+// Durations are kept exactly for min, mean and max, and in a
+// log-linear histogram (16 buckets per power of two) for percentiles,
+// which are the lower edge of their bucket, so up to 1/16 (6.25%) low.
+// The counters are relaxed atomics, so that several threads can add
+// to the same phase; a reading taken meanwhile may miss the samples
+// being added.
+
+#define PROFILE_SUB_BITS 4
+#define PROFILE_SUB_BUCKETS (1 << PROFILE_SUB_BITS)
+#define PROFILE_BUCKETS (64 * PROFILE_SUB_BUCKETS)
+
+class PhaseStats {
+  public:
+    PhaseStats() ;
+    void reset() ;
+    void add(uint64_t ns) ;
+
+    uint64_t getCount() const { return count.load(std::memory_order_relaxed) ; }
+    double getTotal() const ;       // seconds
+    double getMin() const ;         // seconds
+    double getMax() const ;         // seconds
+    double getMean() const ;        // seconds
+    double getPercentile(double p) const ; // seconds, p in [0,1]
+
+  private:
+    std::atomic<uint64_t> count ;
+    std::atomic<uint64_t> total ;
+    std::atomic<uint64_t> min ;
+    std::atomic<uint64_t> max ;
+    std::atomic<uint32_t> histogram [PROFILE_BUCKETS] ;
+
+    PhaseStats(const PhaseStats &) ;
+    PhaseStats & operator= (const PhaseStats &) ;
+} ;
+
+/* ---------------------------------------------------------------- */
+// class Profiler
+/* ---------------------------------------------------------------- */
+
+// Process-wide. Phases can be recorded from any thread (e.g. the step
+// phases on the simulation thread and display() on the GL thread in
+// threaded mode); endStep() and the summary belong to the thread that
+// steps.
+
+class Profiler {
+  public:
+    static Profiler & instance() ;
+
+    void record(ProfilePhase phase, uint64_t ns) ;
+    const PhaseStats & getStats(ProfilePhase phase) const ;
+    void reset() ;
+
+    // print a summary every interval steps (0 disables)
+    void setSummaryInterval(long interval, std::ostream * stream = &std::cerr) ;
+    void endStep() ;
+    void printSummary(std::ostream & stream) const ;
+
+    static const char * getPhaseName(ProfilePhase phase) ;
+
+  private:
+    Profiler() ;
+    PhaseStats stats [NUM_PROFILE_PHASES] ;
+    long steps ;
+    long interval ;
+    std::ostream * stream ;
+} ;
+
+/* ---------------------------------------------------------------- */
+// class ProfileScope
+/* ---------------------------------------------------------------- */
+
+class ProfileScope {
+  public:
+    ProfileScope(ProfilePhase phase) : phase(phase), start(std::chrono::steady_clock::now()) { }
+    ~ProfileScope() {
+      std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start ;
+      Profiler::instance().record(phase, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) ;
+    }
+
+  private:
+    ProfilePhase phase ;
+    std::chrono::steady_clock::time_point start ;
+} ;
+
+#define PROFILE_CONCAT_(a,b) a##b
+#define PROFILE_CONCAT(a,b) PROFILE_CONCAT_(a,b)
+
+#if defined(SPRINGMASS_PROFILE)
+#define PROFILE_SCOPE(phase) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(phase)
+#define PROFILE_END_STEP() Profiler::instance().endStep()
+#else
+#define PROFILE_SCOPE(phase)
+#define PROFILE_END_STEP()
+#endif
+
+#endif /* defined(__profiler__) */
@@ -0,0 +1,311 @@
+/** file: raster.cpp
+ ** brief: Offscreen CPU rendering - implementation
+ **/
+
+#include "raster.h"
+#include "font.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RASTER_SSE
+#endif
+
+/* ---------------------------------------------------------------- */
+// class Float4
+/* ---------------------------------------------------------------- */
+
+// Four floats, in an SSE register when available, so that the
+// coverage kernels below are written once.
+
+#if defined(RASTER_SSE)
+struct Float4 {
+  __m128 v ;
+  Float4(__m128 v) : v(v) { }
+  Float4(float x) : v(_mm_set1_ps(x)) { }
+  static Float4 ramp() { return Float4(_mm_set_ps(3, 2, 1, 0)) ; }
+  static Float4 load(const float * p) { return Float4(_mm_loadu_ps(p)) ; }
+  void store(float * p) const { _mm_storeu_ps(p, v) ; }
+} ;
+inline Float4 operator+ (Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v) ; }
+inline Float4 operator- (Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v) ; }
+inline Float4 operator* (Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v) ; }
+inline Float4 min(Float4 a, Float4 b) { return _mm_min_ps(a.v, b.v) ; }
+inline Float4 max(Float4 a, Float4 b) { return _mm_max_ps(a.v, b.v) ; }
+inline Float4 sqrt(Float4 a) { return _mm_sqrt_ps(a.v) ; }
+#else
+struct Float4 {
+  float v [4] ;
+  Float4() { }
+  Float4(float x) { v[0] = v[1] = v[2] = v[3] = x ; }
+  static Float4 ramp() { Float4 r ; for (int k = 0 ; k < 4 ; ++k) r.v[k] = (float)k ; return r ; }
+  static Float4 load(const float * p) { Float4 r ; for (int k = 0 ; k < 4 ; ++k) r.v[k] = p[k] ; return r ; }
+  void store(float * p) const { for (int k = 0 ; k < 4 ; ++k) p[k] = v[k] ; }
+} ;
+#define FLOAT4_OP(name, expr) \
+  inline Float4 name(Float4 a, Float4 b) { Float4 r ; for (int k = 0 ; k < 4 ; ++k) r.v[k] = (expr) ; return r ; }
+FLOAT4_OP(operator+, a.v[k] + b.v[k])
+FLOAT4_OP(operator-, a.v[k] - b.v[k])
+FLOAT4_OP(operator*, a.v[k] * b.v[k])
+FLOAT4_OP(min, std::min(a.v[k], b.v[k]))
+FLOAT4_OP(max, std::max(a.v[k], b.v[k]))
+inline Float4 sqrt(Float4 a) { Float4 r ; for (int k = 0 ; k < 4 ; ++k) r.v[k] = std::sqrt(a.v[k]) ; return r ; }
+#endif
+
+inline Float4 clamp01(Float4 a) { return min(max(a, Float4(0.0f)), Float4(1.0f)) ; }
+
+// blend color into four pixels of the R, G, B planes
+inline void blend4(float * r, float * g, float * b, const float * color, Float4 coverage) {
+  Float4 x = Float4::load(r) ; (x + (Float4(color[0]) - x) * coverage).store(r) ;
+  x = Float4::load(g) ; (x + (Float4(color[1]) - x) * coverage).store(g) ;
+  x = Float4::load(b) ; (x + (Float4(color[2]) - x) * coverage).store(b) ;
+}
+
+/* ---------------------------------------------------------------- */
+// class Raster : public Canvas
+/* ---------------------------------------------------------------- */
+
+Raster::Raster(int width, int height, int numThreads)
+: width(std::max(width, 1)), height(std::max(height, 1)), pool(NULL) {
+  tilesX = (this->width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE ;
+  tilesY = (this->height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE ;
+  pixels.assign(4 * (size_t)this->width * this->height, 255) ;
+  bins.resize(tilesX * tilesY) ;
+  setNumThreads(numThreads) ;
+  setColor(0, 0, 0) ;
+}
+
+Raster::~Raster() {
+  delete pool ;
+}
+
+void Raster::setNumThreads(int numThreads) {
+  numThreads = std::max(numThreads, 1) ;
+  if (numThreads == getNumThreads()) return ;
+  delete pool ;
+  pool = (numThreads > 1) ? new ThreadPool(numThreads) : NULL ;
+}
+
+int Raster::getNumThreads() const {
+  return pool ? pool->getNumThreads() : 1 ;
+}
+
+void Raster::setColor(double r, double g, double b) {
+  color[0] = (float)std::min(1.0, std::max(0.0, r)) ;
+  color[1] = (float)std::min(1.0, std::max(0.0, g)) ;
+  color[2] = (float)std::min(1.0, std::max(0.0, b)) ;
+}
+
+void Raster::clear() {
+  primitives.clear() ;
+}
+
+void Raster::drawGrid() {
+  setColor(0.8, 0.8, 0.8) ;
+  char label [16] ;
+  for (int k = -5 ; k <= 5 ; ++k) {
+    double t = k * 0.2 ;
+    std::snprintf(label, sizeof(label), "%.1f", t) ;
+    drawLine(t, -1, t, 1, 1) ;
+    drawString(t + 4.0 / width, 4.0 / height, label) ;
+    drawLine(-1, t, 1, t, 1) ;
+    drawString(4.0 / width, t + 4.0 / height, label) ;
+  }
+}
+
+// record a primitive whose box is grown by margin and clipped
+void Raster::add(Primitive & p, double margin) {
+  p.c0 = std::max(0, (int)std::floor(p.c0 - margin)) ;
+  p.r0 = std::max(0, (int)std::floor(p.r0 - margin)) ;
+  p.c1 = std::min(width - 1, (int)std::ceil(p.c1 + margin)) ;
+  p.r1 = std::min(height - 1, (int)std::ceil(p.r1 + margin)) ;
+  if (p.c0 > p.c1 || p.r0 > p.r1) return ;
+  p.color[0] = color[0] ;
+  p.color[1] = color[1] ;
+  p.color[2] = color[2] ;
+  primitives.push_back(p) ;
+}
+
+void Raster::drawCircle(double x, double y, double radius) {
+  // the circle maps to an ellipse when the image is not square
+  Primitive p ;
+  p.kind = CIRCLE ;
+  double cx = toColumn(x), cy = toRow(y) ;
+  double rx = radius * 0.5 * width, ry = radius * 0.5 * height ;
+  if (!(rx > 0 && ry > 0)) return ;
+  if (cx + rx < -1 || cx - rx > width + 1 || cy + ry < -1 || cy - ry > height + 1) return ;
+  p.x0 = (float)cx ; p.y0 = (float)cy ; p.x1 = (float)rx ; p.y1 = (float)ry ; p.size = 0 ;
+  p.c0 = (int)std::floor(cx - rx) ; p.c1 = (int)std::ceil(cx + rx) ;
+  p.r0 = (int)std::floor(cy - ry) ; p.r1 = (int)std::ceil(cy + ry) ;
+  add(p, 1) ;
+}
+
+void Raster::drawLine(double x1, double y1, double x2, double y2, double thickness) {
+  // as in OpenGL, lines are at least one pixel wide
+  Primitive p ;
+  p.kind = LINE ;
+  double half = 0.5 * std::max(thickness, 1.0) ;
+  double ax = toColumn(x1), ay = toRow(y1), bx = toColumn(x2), by = toRow(y2) ;
+  double c0 = std::min(ax, bx) - half, c1 = std::max(ax, bx) + half ;
+  double r0 = std::min(ay, by) - half, r1 = std::max(ay, by) + half ;
+  if (c1 < -1 || c0 > width + 1 || r1 < -1 || r0 > height + 1) return ;
+  p.x0 = (float)ax ; p.y0 = (float)ay ; p.x1 = (float)bx ; p.y1 = (float)by ; p.size = (float)half ;
+  p.c0 = (int)std::floor(c0) ; p.c1 = (int)std::ceil(c1) ;
+  p.r0 = (int)std::floor(r0) ; p.r1 = (int)std::ceil(r1) ;
+  add(p, 1) ;
+}
+
+void Raster::drawString(double x, double y, std::string str) {
+  // (x,y) is the left end of the baseline, as for glRasterPos
+  int column = (int)std::floor(toColumn(x)) ;
+  int row = (int)std::floor(toRow(y)) - FONT_ASCENT ;
+  for (std::string::const_iterator it = str.begin() ; it != str.end() ; ++it, column += FONT_ADVANCE) {
+    if (*it <= 32 || *it > 126) continue ;
+    Primitive p ;
+    p.kind = GLYPH ;
+    p.x0 = (float)column ; p.y0 = (float)row ; p.x1 = p.y1 = 0 ; p.size = (float)(*it - 32) ;
+    p.c0 = column ; p.c1 = column + 4 ;
+    p.r0 = row ; p.r1 = row + 7 ;
+    add(p, 0) ;
+  }
+}
+
+void Raster::render() {
+  // bin
+  for (size_t t = 0 ; t < bins.size() ; ++t) bins[t].clear() ;
+  for (size_t i = 0 ; i < primitives.size() ; ++i) {
+    const Primitive & p = primitives[i] ;
+    for (int ty = p.r0 / RASTER_TILE_SIZE ; ty <= p.r1 / RASTER_TILE_SIZE ; ++ty) {
+      for (int tx = p.c0 / RASTER_TILE_SIZE ; tx <= p.c1 / RASTER_TILE_SIZE ; ++tx) {
+        bins[ty * tilesX + tx].push_back((int)i) ;
+      }
+    }
+  }
+
+  // rasterize
+  int numThreads = getNumThreads() ;
+  tileBuffers.resize(numThreads) ;
+  for (int t = 0 ; t < numThreads ; ++t) tileBuffers[t].resize(3 * RASTER_TILE_SIZE * RASTER_TILE_SIZE) ;
+  ThreadPool::Body body = [&](size_t begin, size_t end, int thread) {
+    for (size_t tile = begin ; tile < end ; ++tile) renderTile((int)tile, tileBuffers[thread].data()) ;
+  } ;
+  if (pool) pool->parallelFor(bins.size(), 1, body) ;
+  else body(0, bins.size(), 0) ;
+}
+
+void Raster::renderTile(int tile, float * buffer) {
+  const int T = RASTER_TILE_SIZE ;
+  float * red = buffer ;
+  float * green = buffer + T * T ;
+  float * blue = buffer + 2 * T * T ;
+  std::fill(buffer, buffer + 3 * T * T, 1.0f) ;
+
+  int left = (tile % tilesX) * T ;
+  int top = (tile / tilesX) * T ;
+  const Float4 ramp = Float4::ramp() ;
+  const std::vector<int> & bin = bins[tile] ;
+
+  for (std::vector<int>::const_iterator it = bin.begin() ; it != bin.end() ; ++it) {
+    const Primitive & p = primitives[*it] ;
+    // rows and columns of the tile to cover; coverage is exact outside
+    // the box too, so columns are widened to a multiple of four
+    int r0 = std::max(p.r0, top) - top ;
+    int r1 = std::min(p.r1, top + T - 1) - top ;
+    int c0 = (std::max(p.c0, left) - left) & ~3 ;
+    int c1 = std::min(p.c1, left + T - 1) - left ;
+
+    if (p.kind == CIRCLE) {
+      // signed distance to the edge, approximated from the normalized
+      // radius for ellipses, and coverage of a one pixel box filter
+      const Float4 cx(p.x0 - left - 0.5f) ;
+      const Float4 invRx(1.0f / p.x1) ;
+      const Float4 scale(std::min(p.x1, p.y1)) ;
+      const Float4 bias(0.5f + std::min(p.x1, p.y1)) ;
+      for (int r = r0 ; r <= r1 ; ++r) {
+        float dy = (r + top + 0.5f - p.y0) / p.y1 ;
+        const Float4 dy2(dy * dy) ;
+        for (int c = c0 ; c <= c1 ; c += 4) {
+          Float4 dx = (Float4((float)c) + ramp - cx) * invRx ;
+          Float4 coverage = clamp01(bias - sqrt(dx * dx + dy2) * scale) ;
+          int k = r * T + c ;
+          blend4(red + k, green + k, blue + k, p.color, coverage) ;
+        }
+      }
+    } else if (p.kind == LINE) {
+      // distance to the segment and coverage of a one pixel box filter
+      float dx = p.x1 - p.x0, dy = p.y1 - p.y0 ;
+      float length2 = dx * dx + dy * dy ;
+      const Float4 ddx(dx), ddy(dy) ;
+      const Float4 invLength2(length2 > 0 ? 1.0f / length2 : 0.0f) ;
+      const Float4 ax(p.x0 - left - 0.5f) ;
+      const Float4 bias(p.size + 0.5f) ;
+      for (int r = r0 ; r <= r1 ; ++r) {
+        const Float4 py(r + top + 0.5f - p.y0) ;
+        for (int c = c0 ; c <= c1 ; c += 4) {
+          Float4 px = Float4((float)c) + ramp - ax ;
+          Float4 t = clamp01((px * ddx + py * ddy) * invLength2) ;
+          Float4 ex = px - t * ddx, ey = py - t * ddy ;
+          Float4 coverage = clamp01(bias - sqrt(ex * ex + ey * ey)) ;
+          int k = r * T + c ;
+          blend4(red + k, green + k, blue + k, p.color, coverage) ;
+        }
+      }
+    } else {
+      const uint8_t * glyph = font5x8[(int)p.size] ;
+      int column = (int)p.x0 - left, row = (int)p.y0 - top ;
+      for (int r = r0 ; r <= r1 ; ++r) {
+        for (int c = std::max(c0, column) ; c <= c1 && c < column + 5 ; ++c) {
+          if (!(glyph[c - column] & (1 << (r - row)))) continue ;
+          int k = r * T + c ;
+          red[k] = p.color[0] ; green[k] = p.color[1] ; blue[k] = p.color[2] ;
+        }
+      }
+    }
+  }
+
+  // to RGBA
+  int rows = std::min(T, height - top), columns = std::min(T, width - left) ;
+  for (int r = 0 ; r < rows ; ++r) {
+    uint8_t * out = &pixels[4 * ((size_t)(top + r) * width + left)] ;
+    for (int c = 0 ; c < columns ; ++c, out += 4) {
+      int k = r * T + c ;
+      out[0] = (uint8_t)(255 * red[k] + 0.5f) ;
+      out[1] = (uint8_t)(255 * green[k] + 0.5f) ;
+      out[2] = (uint8_t)(255 * blue[k] + 0.5f) ;
+      out[3] = 255 ;
+    }
+  }
+}
+bool Raster::writePPM(std::string fileName) const {
+  FILE * file = std::fopen(fileName.c_str(), "wb") ;
+  if (!file) {
+    std::cerr << "Raster: cannot open " << fileName << std::endl ;
+    return false ;
+  }
+  bool ok = writePPM(file) ;
+  ok = (std::fclose(file) == 0) && ok ;
+  return ok ;
+}
+
+bool Raster::writePPM(FILE * file) const {
+  std::vector<uint8_t> rgb(3 * (size_t)width * height) ;
+  for (size_t k = 0 ; k < (size_t)width * height ; ++k) {
+    rgb[3*k] = pixels[4*k] ;
+    rgb[3*k+1] = pixels[4*k+1] ;
+    rgb[3*k+2] = pixels[4*k+2] ;
+  }
+  std::fprintf(file, "P6\n%d %d\n255\n", width, height) ;
+  bool ok = std::fwrite(rgb.data(), 1, rgb.size(), file) == rgb.size() ;
+  if (!ok) std::cerr << "Raster: write failed" << std::endl ;
+  return ok ;
+}
+
+bool Raster::writeRaw(FILE * file) const {
+  bool ok = std::fwrite(pixels.data(), 1, pixels.size(), file) == pixels.size() ;
+  if (!ok) std::cerr << "Raster: write failed" << std::endl ;
+  return ok ;
+}
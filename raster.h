@@ -0,0 +1,100 @@
+/** file: raster.h
+ ** brief: Offscreen CPU rendering
+ **/
+
+#ifndef __raster__
+#define __raster__
+
+#include "canvas.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class ThreadPool ;
+
+/* ---------------------------------------------------------------- */
+// class Raster : public Canvas
+/* ---------------------------------------------------------------- */
+
+// Draws what a Figure draws (grid, circles, lines and strings) into
+// an RGBA image in memory, with no window, display or GPU. As in
+// Figure, the view [-1,1] x [-1,1] fills the whole image and shapes
+// take the current color, like glColor.
+//
+// Drawing only records the shapes; render() produces the image. The
+// shapes are binned into tiles of RASTER_TILE_SIZE pixels and the
+// tiles are rasterized independently, on several threads if asked,
+// four pixels at a time with SSE. Circles and lines are anti-aliased
+// by their analytic coverage of each pixel. Each tile applies its
+// shapes in drawing order, so the image does not depend on the number
+// of threads.
+//
+// Frames can be written as binary PPM (one file each, or a stream of
+// them to a pipe) or as raw RGBA for a video encoder, e.g.
+//   run-springmass -r raw:- | ffmpeg -f rawvideo -pix_fmt rgba -s 512x512 -i - out.mp4
+
+#define RASTER_TILE_SIZE 64
+
+class Raster : public Canvas {
+  public:
+    Raster(int width, int height, int numThreads = 1) ;
+    ~Raster() ;
+
+    int getWidth() const { return width ; }
+    int getHeight() const { return height ; }
+    const uint8_t * getPixels() const { return pixels.data() ; } // RGBA, top row first
+
+    void setNumThreads(int numThreads) ;
+    int getNumThreads() const ;
+
+    void setColor(double r, double g, double b) ;
+    void clear() ;     // start a new frame, white as Figure
+    void drawGrid() ;  // the grid and labels of Figure
+
+    void drawString(double x, double y, std::string str) ;
+    void drawCircle(double x, double y, double radius) ;
+    void drawLine(double x1, double y1, double x2, double y2, double thickness) ;
+
+    void render() ;
+
+    bool writePPM(std::string fileName) const ;
+    bool writePPM(FILE * file) const ;
+    bool writeRaw(FILE * file) const ;
+
+  protected:
+    enum Kind { CIRCLE, LINE, GLYPH } ;
+
+    // in pixels: a circle's center and radii, a line's end points and
+    // half width, a glyph's top left corner; the box is inclusive and
+    // clipped to the image
+    struct Primitive {
+      Kind kind ;
+      float color [3] ;
+      float x0, y0, x1, y1, size ;
+      int c0, r0, c1, r1 ;
+    } ;
+
+    int width ;
+    int height ;
+    int tilesX ;
+    int tilesY ;
+    std::vector<uint8_t> pixels ;
+    float color [3] ;
+    std::vector<Primitive> primitives ;
+    std::vector<std::vector<int> > bins ;         // primitives per tile
+    std::vector<std::vector<float> > tileBuffers ; // R, G, B planes per thread
+    ThreadPool * pool ;
+
+    double toColumn(double x) const { return (x + 1) * 0.5 * width ; }
+    double toRow(double y) const { return (1 - y) * 0.5 * height ; }
+    void add(Primitive & primitive, double margin) ;
+    void renderTile(int tile, float * buffer) ;
+
+  private:
+    Raster(const Raster &) ;
+    Raster & operator= (const Raster &) ;
+} ;
+
+#endif /* defined(__raster__) */
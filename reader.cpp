@@ -0,0 +1,353 @@
+/** file: reader.cpp
+ ** brief: Random-access trajectory reader - implementation
+ **/
+
+#include "reader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define INDEX_CACHE_MAGIC "SMTRFIX2"
+
+// bytes at the end of a trajectory hashed into its cached index, which
+// cover the footer and the last records
+#define INDEX_CHECK_BYTES 65536
+
+/* ---------------------------------------------------------------- */
+// class MappedFile
+/* ---------------------------------------------------------------- */
+
+#if defined(_WIN32)
+
+MappedFile::MappedFile() : data(NULL), size(0), modificationTime(0), fileHandle(NULL), mappingHandle(NULL) { }
+
+bool MappedFile::open(std::string fileName) {
+  close() ;
+  HANDLE f = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL) ;
+  if (f == INVALID_HANDLE_VALUE) return false ;
+  LARGE_INTEGER length ;
+  FILETIME written ;
+  if (! GetFileSizeEx(f, &length) || length.QuadPart == 0 ||
+      ! GetFileTime(f, NULL, NULL, &written)) { CloseHandle(f) ; return false ; }
+  HANDLE m = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL) ;
+  if (! m) { CloseHandle(f) ; return false ; }
+  data = (const uint8_t *)MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0) ;
+  if (! data) { CloseHandle(m) ; CloseHandle(f) ; return false ; }
+  size = (size_t)length.QuadPart ;
+  modificationTime = (int64_t)written.dwHighDateTime << 32 | written.dwLowDateTime ;
+  fileHandle = f ;
+  mappingHandle = m ;
+  return true ;
+}
+
+void MappedFile::close() {
+  if (data) UnmapViewOfFile(data) ;
+  if (mappingHandle) CloseHandle((HANDLE)mappingHandle) ;
+  if (fileHandle) CloseHandle((HANDLE)fileHandle) ;
+  data = NULL ;
+  size = 0 ;
+  modificationTime = 0 ;
+  fileHandle = mappingHandle = NULL ;
+}
+
+#else
+
+MappedFile::MappedFile() : data(NULL), size(0), modificationTime(0) { }
+
+bool MappedFile::open(std::string fileName) {
+  close() ;
+  int fd = ::open(fileName.c_str(), O_RDONLY) ;
+  if (fd < 0) return false ;
+  struct stat st ;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) { ::close(fd) ; return false ; }
+  void * p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0) ;
+  ::close(fd) ; // the mapping keeps the file alive
+  if (p == MAP_FAILED) return false ;
+  data = (const uint8_t *)p ;
+  size = (size_t)st.st_size ;
+#if defined(__APPLE__)
+  modificationTime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec ;
+#else
+  modificationTime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec ;
+#endif
+  return true ;
+}
+
+void MappedFile::close() {
+  if (data) munmap((void *)data, size) ;
+  data = NULL ;
+  size = 0 ;
+  modificationTime = 0 ;
+}
+
+#endif
+
+MappedFile::~MappedFile() {
+  close() ;
+}
+
+/* ---------------------------------------------------------------- */
+// class TrajectoryReader
+/* ---------------------------------------------------------------- */
+
+template <typename T>
+static T readValue(const uint8_t * p) {
+  T value ;
+  std::memcpy(&value, p, sizeof(T)) ;
+  return value ;
+}
+
+TrajectoryReader::TrajectoryReader()
+: format(RAW), numMasses(0), numFrames(0), decodedFrame(-1), decodedFirst(0), decodedLast(0) { }
+
+bool TrajectoryReader::open(std::string fileName, bool cacheIndex) {
+  numMasses = 0 ;
+  numFrames = 0 ;
+  offsets.clear() ;
+  codec = TrajectoryCodec() ;
+  decodedFrame = -1 ;
+  if (! file.open(fileName)) {
+    std::cerr << "TrajectoryReader: cannot map " << fileName << std::endl ;
+    return false ;
+  }
+  bool ok = false ;
+  if (file.getSize() >= 8 && std::memcmp(file.getData(), RAW_TRAJECTORY_MAGIC, 8) == 0) {
+    format = RAW ;
+    ok = openRaw() ;
+  } else if (file.getSize() >= 8 && std::memcmp(file.getData(), COMPRESSED_TRAJECTORY_MAGIC, 8) == 0) {
+    format = COMPRESSED ;
+    ok = openCompressed(fileName + ".idx", cacheIndex) ;
+  }
+  if (!ok) {
+    std::cerr << "TrajectoryReader: " << fileName << " is not a trajectory" << std::endl ;
+    numMasses = 0 ;
+    numFrames = 0 ;
+    offsets.clear() ;
+  }
+  return ok ;
+}
+
+// A trailing partial frame (e.g. the writer was killed) is ignored.
+bool TrajectoryReader::openRaw() {
+  if (file.getSize() < RAW_HEADER_SIZE) return false ;
+  numMasses = readValue<int32_t>(file.getData() + 8) ;
+  if (numMasses <= 0) return false ;
+  numFrames = (long)((file.getSize() - RAW_HEADER_SIZE) / rawFrameSize(numMasses)) ;
+  return true ;
+}
+
+bool TrajectoryReader::openCompressed(std::string indexName, bool cacheIndex) {
+  const uint8_t * p = file.getData() ;
+  if (file.getSize() < COMPRESSED_HEADER_SIZE) return false ;
+  numMasses = readValue<int32_t>(p + 8) ;
+  int keyframeInterval = readValue<int32_t>(p + 12) ;
+  double tolerance = readValue<double>(p + 16) ;
+  Vector3 boxMin = readValue<Vector3>(p + 24) ;
+  Vector3 boxMax = readValue<Vector3>(p + 48) ;
+  if (numMasses <= 0 || keyframeInterval < 1) return false ;
+
+  bool loaded = loadIndex(indexName) ;
+  if (! loaded && ! buildIndex()) return false ;
+
+  // every record holds at least the width bytes of its blocks, so a
+  // header claiming more masses than the first record can hold is
+  // corrupt; the codec is only sized once that is known
+  if (numFrames > 0) {
+    size_t length = readValue<uint32_t>(p + offsets[0]) ;
+    size_t blocks = (3 * (size_t)numMasses + CODEC_BLOCK_SIZE - 1) / CODEC_BLOCK_SIZE ;
+    if (length + 4 < COMPRESSED_RECORD_HEADER_SIZE + blocks) return false ;
+    codec = TrajectoryCodec(numMasses, boxMin, boxMax, tolerance, keyframeInterval) ;
+  }
+  if (! loaded && cacheIndex) saveIndex(indexName) ;
+  return true ;
+}
+
+bool TrajectoryReader::buildIndex() {
+  const uint8_t * p = file.getData() ;
+  size_t size = file.getSize() ;
+
+  // with a footer the number of records is known, otherwise (e.g. the
+  // writer was killed) read records until one does not fit
+  long expected = -1 ;
+  if (size >= COMPRESSED_HEADER_SIZE + 24 &&
+      std::memcmp(p + size - 8, COMPRESSED_INDEX_MAGIC, 8) == 0) {
+    expected = (long)readValue<int64_t>(p + size - 16) ;
+  }
+
+  offsets.clear() ;
+  size_t offset = COMPRESSED_HEADER_SIZE ;
+  while (expected < 0 || (long)offsets.size() < expected) {
+    if (offset + COMPRESSED_RECORD_HEADER_SIZE > size) break ;
+    uint32_t length = readValue<uint32_t>(p + offset) ;
+    uint8_t kind = p[offset + 4] ;
+    if (length < COMPRESSED_RECORD_HEADER_SIZE - 4 || offset + 4 + length > size || kind > 1) break ;
+    offsets.push_back((int64_t)offset) ;
+    offset += 4 + length ;
+  }
+  if (expected >= 0 && (long)offsets.size() != expected) {
+    std::cerr << "TrajectoryReader: index lists " << expected << " frames, found "
+              << offsets.size() << std::endl ;
+  }
+  numFrames = (long)offsets.size() ;
+  return true ;
+}
+
+// FNV-1a of the header and of the last INDEX_CHECK_BYTES of the file,
+// which covers the keyframe offsets of the footer: with the size and
+// modification time, it catches a trajectory rewritten by a run of the
+// same size, even on a file system with a coarse clock
+uint64_t TrajectoryReader::getChecksum() const {
+  const uint8_t * p = file.getData() ;
+  size_t size = file.getSize() ;
+  size_t head = std::min(size, (size_t)COMPRESSED_HEADER_SIZE) ;
+  size_t tail = std::max(head, size - std::min(size, (size_t)INDEX_CHECK_BYTES)) ;
+  uint64_t hash = 14695981039346656037ULL ;
+  for (size_t i = 0 ; i < head ; ++i) hash = (hash ^ p[i]) * 1099511628211ULL ;
+  for (size_t i = tail ; i < size ; ++i) hash = (hash ^ p[i]) * 1099511628211ULL ;
+  return hash ;
+}
+
+// the offsets must increase by at least a record header and leave a
+// record header inside the file, checked without touching the records
+// (decodeRecord checks each record's length when it reads it)
+bool TrajectoryReader::checkOffsets() const {
+  int64_t size = (int64_t)file.getSize() ;
+  int64_t next = COMPRESSED_HEADER_SIZE ;
+  for (size_t k = 0 ; k < offsets.size() ; ++k) {
+    if (offsets[k] < next || offsets[k] + COMPRESSED_RECORD_HEADER_SIZE > size) return false ;
+    next = offsets[k] + COMPRESSED_RECORD_HEADER_SIZE ;
+  }
+  return true ;
+}
+
+bool TrajectoryReader::loadIndex(std::string indexName) {
+  FILE * f = std::fopen(indexName.c_str(), "rb") ;
+  if (!f) return false ;
+  char magic [8] ;
+  int64_t fileSize = 0, fileTime = 0, count = 0 ;
+  uint64_t checksum = 0 ;
+  bool ok = std::fread(magic, 1, 8, f) == 8 &&
+            std::memcmp(magic, INDEX_CACHE_MAGIC, 8) == 0 &&
+            std::fread(&fileSize, sizeof(fileSize), 1, f) == 1 &&
+            std::fread(&fileTime, sizeof(fileTime), 1, f) == 1 &&
+            std::fread(&checksum, sizeof(checksum), 1, f) == 1 &&
+            std::fread(&count, sizeof(count), 1, f) == 1 &&
+            fileSize == (int64_t)file.getSize() && fileTime == file.getModificationTime() &&
+            checksum == getChecksum() &&
+            count >= 0 && count <= fileSize / COMPRESSED_RECORD_HEADER_SIZE ;
+  if (ok) {
+    offsets.resize((size_t)count) ;
+    ok = std::fread(offsets.data(), sizeof(int64_t), offsets.size(), f) == offsets.size() &&
+         checkOffsets() ;
+  }
+  std::fclose(f) ;
+  if (!ok) {
+    offsets.clear() ;
+    return false ;
+  }
+  numFrames = (long)offsets.size() ;
+  return true ;
+}
+
+void TrajectoryReader::saveIndex(std::string indexName) const {
+  FILE * f = std::fopen(indexName.c_str(), "wb") ;
+  if (!f) return ; // read-only directory: the index is just not cached
+  int64_t fileSize = (int64_t)file.getSize() ;
+  int64_t fileTime = file.getModificationTime() ;
+  uint64_t checksum = getChecksum() ;
+  int64_t count = (int64_t)offsets.size() ;
+  std::fwrite(INDEX_CACHE_MAGIC, 1, 8, f) ;
+  std::fwrite(&fileSize, sizeof(fileSize), 1, f) ;
+  std::fwrite(&fileTime, sizeof(fileTime), 1, f) ;
+  std::fwrite(&checksum, sizeof(checksum), 1, f) ;
+  std::fwrite(&count, sizeof(count), 1, f) ;
+  std::fwrite(offsets.data(), sizeof(int64_t), offsets.size(), f) ;
+  std::fclose(f) ;
+}
+
+double TrajectoryReader::getTime(long k) const {
+  if (k < 0 || k >= numFrames) return 0 ;
+  if (format == RAW) {
+    return readValue<double>(file.getData() + RAW_HEADER_SIZE + k * rawFrameSize(numMasses)) ;
+  }
+  return readValue<double>(file.getData() + offsets[k] + 5) ;
+}
+
+// decode the coordinates [first, last) of compressed frame k, resuming
+// from the previous call when it decoded frame k-1 with the same range
+bool TrajectoryReader::decodeRecord(long k, size_t first, size_t last, double * out) {
+  long K = codec.getKeyframeInterval() ;
+  long start = k - k % K ;
+  if (decodedFrame < start || decodedFrame >= k || decodedFirst != first || decodedLast != last) {
+    decodedFrame = start - 1 ;
+  }
+  std::vector<double> scratch(last - first) ;
+  for (long j = decodedFrame + 1 ; j <= k ; ++j) {
+    const uint8_t * record = file.getData() + offsets[j] ;
+    uint32_t length = readValue<uint32_t>(record) ;
+    if (length < COMPRESSED_RECORD_HEADER_SIZE - 4 || offsets[j] + 4 + (int64_t)length > (int64_t)file.getSize() ||
+        record[4] > 1) {
+      std::cerr << "TrajectoryReader: bad record at frame " << j << std::endl ;
+      decodedFrame = -1 ;
+      return false ;
+    }
+    TrajectoryCodec::Kind kind = (TrajectoryCodec::Kind)record[4] ;
+    double * target = (j == k) ? out : scratch.data() ;
+    if (! codec.decodeRange(kind, record + COMPRESSED_RECORD_HEADER_SIZE,
+                            length + 4 - COMPRESSED_RECORD_HEADER_SIZE, first, last, target)) {
+      decodedFrame = -1 ;
+      return false ;
+    }
+  }
+  decodedFrame = k ;
+  decodedFirst = first ;
+  decodedLast = last ;
+  return true ;
+}
+
+bool TrajectoryReader::readFrame(long k, Frame & frame) {
+  if (k < 0 || k >= numFrames) return false ;
+  frame.positions.resize(3 * (size_t)numMasses) ;
+  frame.time = getTime(k) ;
+  if (format == RAW) {
+    const uint8_t * p = file.getData() + RAW_HEADER_SIZE + k * rawFrameSize(numMasses) ;
+    std::memcpy(frame.positions.data(), p + sizeof(double), frame.positions.size() * sizeof(double)) ;
+    return true ;
+  }
+  return decodeRecord(k, 0, frame.positions.size(), frame.positions.data()) ;
+}
+
+bool TrajectoryReader::readMass(int mass, long first, long last, long stride,
+                                std::vector<double> & times, std::vector<double> & xyz) {
+  times.clear() ;
+  xyz.clear() ;
+  if (mass < 0 || mass >= numMasses || stride < 1) return false ;
+  first = std::max(first, 0L) ;
+  last = std::min(last, numFrames) ;
+
+  for (long k = first ; k < last ; k += stride) {
+    double p [3] ;
+    if (format == RAW) {
+      const uint8_t * frame = file.getData() + RAW_HEADER_SIZE + k * rawFrameSize(numMasses) ;
+      std::memcpy(p, frame + sizeof(double) * (1 + 3 * (long)mass), sizeof(p)) ;
+    } else if (! decodeRecord(k, 3 * (size_t)mass, 3 * (size_t)mass + 3, p)) {
+      return false ;
+    }
+    times.push_back(getTime(k)) ;
+    xyz.insert(xyz.end(), p, p + 3) ;
+  }
+  return true ;
+}
@@ -0,0 +1,100 @@
+/** file: reader.h
+ ** brief: Random-access trajectory reader
+ **/
+
+#ifndef __reader__
+#define __reader__
+
+#include "trajectory.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* ---------------------------------------------------------------- */
+// class MappedFile
+/* ---------------------------------------------------------------- */
+
+// Read-only memory mapping of a whole file.
+
+class MappedFile {
+  public:
+    MappedFile() ;
+    ~MappedFile() ;
+    bool open(std::string fileName) ;
+    void close() ;
+    const uint8_t * getData() const { return data ; }
+    size_t getSize() const { return size ; }
+    int64_t getModificationTime() const { return modificationTime ; } // in file system ticks
+
+  private:
+    const uint8_t * data ;
+    size_t size ;
+    int64_t modificationTime ;
+#if defined(_WIN32)
+    void * fileHandle ;
+    void * mappingHandle ;
+#endif
+
+    MappedFile(const MappedFile &) ;
+    MappedFile & operator= (const MappedFile &) ;
+} ;
+
+/* ---------------------------------------------------------------- */
+// class TrajectoryReader
+/* ---------------------------------------------------------------- */
+
+// Reads raw (RawTrajectoryWriter) and compressed
+// (CompressedTrajectoryWriter) trajectories through a memory mapping,
+// so only the pages actually touched are loaded from disk.
+//
+// Raw frames have a fixed size and are located arithmetically. For
+// compressed files a table with the offset of every frame is built by
+// hopping over the record headers, and cached next to the file as
+// FILE.idx, keyed on the size and modification time of the file and
+// a checksum of its header and tail; the cached offsets are also checked against the file
+// before use. Decoding frame k starts from the keyframe preceding it.
+
+class TrajectoryReader {
+  public:
+    enum Format { RAW, COMPRESSED } ;
+
+    TrajectoryReader() ;
+    bool open(std::string fileName, bool cacheIndex = true) ;
+
+    Format getFormat() const { return format ; }
+    int getNumMasses() const { return numMasses ; }
+    long getNumFrames() const { return numFrames ; }
+    double getTime(long k) const ;
+
+    bool readFrame(long k, Frame & frame) ;
+
+    // time series of one mass at frames first, first + stride, ... < last;
+    // xyz receives three coordinates per sample
+    bool readMass(int mass, long first, long last, long stride,
+                  std::vector<double> & times, std::vector<double> & xyz) ;
+
+  protected:
+    MappedFile file ;
+    Format format ;
+    int numMasses ;
+    long numFrames ;
+
+    // compressed only
+    TrajectoryCodec codec ;
+    std::vector<int64_t> offsets ;
+    long decodedFrame ;
+    size_t decodedFirst ;
+    size_t decodedLast ;
+
+    bool openRaw() ;
+    bool openCompressed(std::string indexName, bool cacheIndex) ;
+    bool buildIndex() ;
+    bool loadIndex(std::string indexName) ;
+    void saveIndex(std::string indexName) const ;
+    uint64_t getChecksum() const ;
+    bool checkOffsets() const ;
+    bool decodeRecord(long k, size_t first, size_t last, double * out) ;
+} ;
+
+#endif /* defined(__reader__) */
@@ -0,0 +1,347 @@
+/** file: run-springmass.cpp
+ ** brief: Runs a spring mass simulation headless, as fast as possible
+ **/
+
+#include "profiler.h"
+#include "raster.h"
+#include "springmass.h"
+#include "textwriter.h"
+#include "trajectory.h"
+#include "writer.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <string>
+
+// power iterations of the stable time step estimate for -a
+#define STABLE_TIME_STEP_ITERATIONS 30
+
+// Unlike run() in graphics.cpp nothing here is tied to the wall clock:
+// the simulation is stepped back to back and the throughput is
+// reported at the end, on stderr so that text output can go to stdout.
+
+static void usage() {
+  std::cerr << "usage: run-springmass [options]" << std::endl
+            << "  -s SCENE   sample, cloth:ROWSxCOLUMNS, clusters:COUNT or a checkpoint file" << std::endl
+            << "             (default: sample)" << std::endl
+            << "  -n STEPS   number of steps (default: 1000)" << std::endl
+            << "  -t TIME    simulated seconds instead of a number of steps" << std::endl
+            << "  -d DT      time step (default: 1/240)" << std::endl
+            << "  -a SAFETY  time step of SAFETY (e.g. 0.5) times the estimated stable one" << std::endl
+            << "  -j THREADS worker threads (default: 1)" << std::endl
+            << "  -D         deterministic parallel stepping" << std::endl
+            << "  -I         island-parallel stepping" << std::endl
+            << "  -i NAME    integrator: constant (default) or symplectic" << std::endl
+            << "  -z ENERGY  put islands to sleep below ENERGY kinetic energy per mass" << std::endl
+            << "  -O ORDER   renumber the masses for locality after loading: rcm or morton;" << std::endl
+            << "             ORDER:EVERY renumbers again every EVERY steps (not with -o or -r)" << std::endl
+            << "  -o SINK    none (default), text:FILE, raw:FILE or compressed:FILE;" << std::endl
+            << "             text:- writes to standard output" << std::endl
+            << "  -r SINK    render frames offscreen: ppm:PATTERN (e.g. frame%05d.ppm), ppm:- for" << std::endl
+            << "             a stream of PPM images or raw:FILE for raw RGBA (raw:- to stdout)" << std::endl
+            << "  -g WxH     rendered frame size (default: 512x512)" << std::endl
+            << "  -e EVERY   write and render every EVERY steps (default: 1)" << std::endl
+            << "  -c FILE    save a checkpoint at the end" << std::endl
+            << "  -P EVERY   print the step profile every EVERY steps and at the end (0: at" << std::endl
+            << "             the end only); needs a build with -DSPRINGMASS_PROFILE, such as" << std::endl
+            << "             the run-springmass-profile task" << std::endl ;
+}
+
+static bool loadScene(SpringMass & springmass, const std::string & scene) {
+  int rows, columns, count ;
+  if (scene == "sample") {
+    springmass.loadSample() ;
+  } else if (std::sscanf(scene.c_str(), "cloth:%dx%d", &rows, &columns) == 2) {
+    if (rows < 1 || columns < 1 || rows * columns < 2) {
+      std::cerr << "run-springmass: bad cloth size " << scene << std::endl ;
+      return false ;
+    }
+    springmass.loadCloth(rows, columns) ;
+  } else if (std::sscanf(scene.c_str(), "clusters:%d", &count) == 1) {
+    if (count < 1) {
+      std::cerr << "run-springmass: bad cluster count " << scene << std::endl ;
+      return false ;
+    }
+    springmass.loadClusters(count) ;
+  } else if (!springmass.restoreCheckpoint(scene)) {
+    return false ;
+  }
+  return true ;
+}
+
+// what test-springmass-graphics draws
+static void render(Raster & raster, SpringMass & springmass) {
+  raster.clear() ;
+  raster.drawGrid() ;
+  raster.setColor(0, 0, 1) ;
+  const std::vector<Mass *> & masses = springmass.getMassList() ;
+  for (std::vector<Mass *>::const_iterator it = masses.begin() ; it != masses.end() ; ++it) {
+    Vector3 position = (*it)->getPosition() ;
+    raster.drawCircle(position.x, position.y, (*it)->getScaledR()) ;
+  }
+  const std::vector<Spring> & springs = springmass.getSpringList() ;
+  for (std::vector<Spring>::const_iterator it = springs.begin() ; it != springs.end() ; ++it) {
+    Vector3 p1 = it->getMass1()->getPosition() ;
+    Vector3 p2 = it->getMass2()->getPosition() ;
+    raster.drawLine(p1.x, p1.y, p2.x, p2.y, it->getStiffness()) ;
+  }
+  char energy [32] ;
+  std::snprintf(energy, sizeof(energy), "%g", springmass.getEnergy()) ;
+  raster.drawString(0, 0, energy) ;
+  raster.render() ;
+}
+
+int main(int argc, char** argv) {
+
+  // parse arguments
+  std::string scene = "sample" ;
+  std::string sinkName = "none" ;
+  std::string renderName = "none" ;
+  int frameWidth = 512 ;
+  int frameHeight = 512 ;
+  const char * checkpoint = NULL ;
+  long numSteps = 1000 ;
+  double duration = -1 ;
+  double dt = 1.0/240 ;
+  double safety = 0 ;
+  double sleepEnergy = 0 ;
+  int numThreads = 1 ;
+  bool deterministic = false ;
+  bool islandParallel = false ;
+  Integrator integrator = CONSTANT_ACCELERATION ;
+  long every = 1 ;
+  long profileEvery = -1 ;
+  std::string orderName = "none" ;
+  for (int i = 1 ; i < argc ; ++i) {
+    bool hasValue = i + 1 < argc ;
+    if (!std::strcmp(argv[i], "-s") && hasValue) scene = argv[++i] ;
+    else if (!std::strcmp(argv[i], "-n") && hasValue) numSteps = std::atol(argv[++i]) ;
+    else if (!std::strcmp(argv[i], "-t") && hasValue) duration = std::atof(argv[++i]) ;
+    else if (!std::strcmp(argv[i], "-d") && hasValue) dt = std::atof(argv[++i]) ;
+    else if (!std::strcmp(argv[i], "-a") && hasValue) safety = std::atof(argv[++i]) ;
+    else if (!std::strcmp(argv[i], "-z") && hasValue) sleepEnergy = std::atof(argv[++i]) ;
+    else if (!std::strcmp(argv[i], "-j") && hasValue) numThreads = std::atoi(argv[++i]) ;
+    else if (!std::strcmp(argv[i], "-D")) deterministic = true ;
+    else if (!std::strcmp(argv[i], "-I")) islandParallel = true ;
+    else if (!std::strcmp(argv[i], "-o") && hasValue) sinkName = argv[++i] ;
+    else if (!std::strcmp(argv[i], "-e") && hasValue) every = std::atol(argv[++i]) ;
+    else if (!std::strcmp(argv[i], "-c") && hasValue) checkpoint = argv[++i] ;
+    else if (!std::strcmp(argv[i], "-P") && hasValue) profileEvery = std::atol(argv[++i]) ;
+    else if (!std::strcmp(argv[i], "-O") && hasValue) orderName = argv[++i] ;
+    else if (!std::strcmp(argv[i], "-r") && hasValue) renderName = argv[++i] ;
+    else if (!std::strcmp(argv[i], "-g") && hasValue) {
+      if (std::sscanf(argv[++i], "%dx%d", &frameWidth, &frameHeight) != 2) { usage() ; return 1 ; }
+    }
+    else if (!std::strcmp(argv[i], "-i") && hasValue) {
+      const char * name = argv[++i] ;
+      if (!std::strcmp(name, "constant")) integrator = CONSTANT_ACCELERATION ;
+      else if (!std::strcmp(name, "symplectic")) integrator = SYMPLECTIC_EULER ;
+      else { usage() ; return 1 ; }
+    }
+    else { usage() ; return 1 ; }
+  }
+  if (dt <= 0 || safety < 0 || every < 1 || numThreads < 1 || frameWidth < 1 || frameHeight < 1) { usage() ; return 1 ; }
+#if !defined(SPRINGMASS_PROFILE)
+  if (profileEvery >= 0) {
+    std::cerr << "run-springmass: -P needs a build with -DSPRINGMASS_PROFILE" << std::endl ;
+    return 1 ;
+  }
+#endif
+  Ordering ordering = REVERSE_CUTHILL_MCKEE ;
+  long reorderEvery = 0 ;
+  if (orderName != "none") {
+    size_t colon = orderName.find(':') ;
+    std::string name = orderName.substr(0, colon) ;
+    if (colon != std::string::npos) reorderEvery = std::atol(orderName.c_str() + colon + 1) ;
+    if (name == "rcm") ordering = REVERSE_CUTHILL_MCKEE ;
+    else if (name == "morton") ordering = MORTON ;
+    else { usage() ; return 1 ; }
+    if (colon != std::string::npos && reorderEvery < 1) { usage() ; return 1 ; }
+  }
+  if (reorderEvery > 0 && (sinkName != "none" || renderName != "none")) {
+    std::cerr << "run-springmass: -O with EVERY changes the order of the masses in the middle of the output" << std::endl ;
+    return 1 ;
+  }
+
+  // scene
+  SpringMass springmass ;
+  if (!loadScene(springmass, scene)) return 1 ;
+  if (orderName != "none") {
+    ReorderReport report = springmass.reorder(ordering) ;
+    std::fprintf(stderr, "renumbered: mean spring span %.6g -> %.6g, simulated cache misses %ld -> %ld\n",
+                 report.spanBefore, report.spanAfter, report.missesBefore, report.missesAfter) ;
+  }
+  springmass.setNumThreads(numThreads) ;
+  springmass.setDeterministic(deterministic) ;
+  springmass.setIslandParallel(islandParallel) ;
+  springmass.setIntegrator(integrator) ;
+  springmass.setSleeping(sleepEnergy) ;
+  int numMasses = springmass.getNumMasses() ;
+  if (safety > 0) {
+    double stable = springmass.getStableTimeStep(STABLE_TIME_STEP_ITERATIONS) ;
+    if (std::isfinite(stable)) {
+      dt = safety * stable ;
+      std::fprintf(stderr, "stable time step %.6g s, using %.6g s\n", stable, dt) ;
+    } else {
+      std::fprintf(stderr, "no stable time step limit, using %.6g s\n", dt) ;
+    }
+  }
+  if (duration >= 0) numSteps = (long)std::ceil(duration / dt - 1e-9) ;
+
+  // output
+  TextWriter * text = NULL ;
+  FrameSink * sink = NULL ;
+  size_t colon = sinkName.find(':') ;
+  std::string kind = sinkName.substr(0, colon) ;
+  std::string fileName = (colon == std::string::npos) ? "" : sinkName.substr(colon + 1) ;
+  if (kind == "text" && fileName == "-") {
+    text = new TextWriter(1) ;
+  } else if (kind == "text" && !fileName.empty()) {
+    text = new TextWriter(fileName) ;
+  } else if (kind == "raw" && !fileName.empty()) {
+    sink = new RawTrajectoryWriter(fileName, numMasses) ;
+  } else if (kind == "compressed" && !fileName.empty()) {
+    sink = new CompressedTrajectoryWriter(fileName, springmass) ;
+  } else if (sinkName != "none") {
+    usage() ;
+    return 1 ;
+  }
+  if (text) text->setTime(true) ;
+  if ((text && !text->isOpen()) ||
+      (kind == "raw" && !((RawTrajectoryWriter*)sink)->isOpen()) ||
+      (kind == "compressed" && !((CompressedTrajectoryWriter*)sink)->isOpen())) {
+    delete text ;
+    delete sink ;
+    return 1 ;
+  }
+  AsyncWriter * writer = sink ? new AsyncWriter(sink, numMasses) : NULL ;
+  if (writer) {
+    // frames come straight from the arrays the mass pass fills
+    springmass.addObserver([writer](const StateView & state) { writer->push(state) ; }, every) ;
+  }
+
+  // rendering
+  Raster * raster = NULL ;
+  FILE * frames = NULL ;
+  std::string framePattern ;
+  long numFrames = 0 ;
+  double rendering = 0 ;
+  colon = renderName.find(':') ;
+  std::string renderKind = renderName.substr(0, colon) ;
+  std::string renderFile = (colon == std::string::npos) ? "" : renderName.substr(colon + 1) ;
+  if (renderName != "none") {
+    if ((renderKind != "ppm" && renderKind != "raw") || renderFile.empty() ||
+        (renderFile == "-" && text && fileName == "-")) {
+      usage() ;
+      return 1 ;
+    }
+    if (renderFile == "-") {
+      frames = stdout ;
+    } else if (renderKind == "raw" || renderFile.find('%') == std::string::npos) {
+      frames = std::fopen(renderFile.c_str(), "wb") ;
+      if (!frames) {
+        std::cerr << "run-springmass: cannot open " << renderFile << std::endl ;
+        return 1 ;
+      }
+    } else {
+      framePattern = renderFile ;
+    }
+    raster = new Raster(frameWidth, frameHeight, numThreads) ;
+  }
+
+  // text and rendered frames of the state after k steps
+  auto output = [&](long k) {
+    if (k % every != 0) return true ;
+    if (text) text->write(springmass) ;
+    if (raster) {
+      std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now() ;
+      render(*raster, springmass) ;
+      bool ok ;
+      if (!framePattern.empty()) {
+        char name [1024] ;
+        std::snprintf(name, sizeof(name), framePattern.c_str(), (int)numFrames) ;
+        ok = raster->writePPM(name) ;
+      } else {
+        ok = (renderKind == "ppm") ? raster->writePPM(frames) : raster->writeRaw(frames) ;
+      }
+      ++ numFrames ;
+      rendering += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() ;
+      if (!ok) return false ;
+    }
+    return true ;
+  } ;
+
+  // run, starting from the initial state; the time spent between
+  // batches (renumbering, text and rendering) is not counted as
+  // stepping. Renumbering is done between batches, so these stop at both
+  long batch = reorderEvery > 0 ? std::gcd(every, reorderEvery) : every ;
+  long numReorders = 0 ;
+  double between = 0 ;
+  if (profileEvery >= 0) {
+    Profiler::instance().reset() ;
+    Profiler::instance().setSummaryInterval(profileEvery, &std::cerr) ;
+  }
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now() ;
+  if (writer) writer->push(springmass) ;
+  bool outputOk = output(0) ;
+  between += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() ;
+  if (outputOk) springmass.run(dt, numSteps, [&](long k) {
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now() ;
+    if (reorderEvery > 0 && k % reorderEvery == 0 && k < numSteps) {
+      springmass.reorder(ordering) ;
+      ++ numReorders ;
+    }
+    outputOk = output(k) ;
+    between += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() ;
+    return outputOk ;
+  }, batch) ;
+  double stepping = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() - between ;
+  bool outputFailed = !outputOk ;
+  if (writer) writer->close() ;
+  if (sink && !sink->close()) outputFailed = true ;
+  if (text) text->flush() ;
+  if (frames) std::fflush(frames) ;
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() ;
+
+  // summary
+  std::fprintf(stderr, "%ld steps of %g s, %d masses, %d springs, %d thread(s)\n",
+               numSteps, dt, numMasses, (int)springmass.getSpringList().size(), springmass.getNumThreads()) ;
+  if (numReorders > 0) std::fprintf(stderr, "%ld renumberings during the run\n", numReorders) ;
+  if (sleepEnergy > 0) {
+    std::fprintf(stderr, "%d of %d islands asleep\n", springmass.getNumSleepingIslands(), springmass.getNumIslands()) ;
+  }
+  std::fprintf(stderr, "simulated %.6g s in %.6g s of stepping (%.6g s wall including output)\n",
+               springmass.getTime(), stepping, elapsed) ;
+  if (stepping > 0) {
+    std::fprintf(stderr, "%.6g steps/s, %.6g mass updates/s, %.6gx real time\n",
+                 numSteps / stepping, (double)numSteps * numMasses / stepping, numSteps * dt / stepping) ;
+  }
+  if (writer) {
+    std::fprintf(stderr, "%ld frames written, %ld dropped\n", writer->getWrittenFrames(), writer->getDroppedFrames()) ;
+  }
+  if (raster) {
+    std::fprintf(stderr, "%ld frames rendered in %.6g s (%.6g ms/frame)\n",
+                 numFrames, rendering, numFrames ? 1e3 * rendering / numFrames : 0.0) ;
+  }
+  Diagnostics diagnostics = springmass.getDiagnostics() ;
+  std::fprintf(stderr, "final energy %.9g (kinetic %.6g, potential %.6g, elastic %.6g)\n",
+               springmass.getEnergy(), diagnostics.kinetic, diagnostics.potential, diagnostics.elastic) ;
+  std::fprintf(stderr, "momentum (%.6g, %.6g, %.6g), max speed %.6g, max strain %.6g\n",
+               diagnostics.momentum.x, diagnostics.momentum.y, diagnostics.momentum.z,
+               diagnostics.maxSpeed, diagnostics.maxStrain) ;
+  if (profileEvery == 0 || (profileEvery > 0 && numSteps % profileEvery)) Profiler::instance().printSummary(std::cerr) ;
+
+  delete writer ;
+  delete sink ;
+  delete text ;
+  delete raster ;
+  if (frames && frames != stdout) std::fclose(frames) ;
+
+  if (checkpoint && !springmass.saveCheckpoint(checkpoint)) return 1 ;
+  return outputFailed ? 1 : 0 ;
+}
@@ -0,0 +1,74 @@
+/** file: seqlock.h
+ ** brief: Sequence lock for a small value
+ **/
+
+#ifndef __seqlock__
+#define __seqlock__
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/* ---------------------------------------------------------------- */
+// class Seqlock
+/* ---------------------------------------------------------------- */
+
+// Hands the latest value from one writer thread to any number of
+// readers. The writer never waits: it makes the sequence number odd,
+// stores the value and makes it even again. A reader copies the value
+// and starts over if the sequence number was odd or changed meanwhile,
+// which for a value of a few cache lines written once per step is
+// rare. The value is stored as relaxed atomic words, so a torn copy is
+// well defined, and detected.
+
+template <typename T>
+class Seqlock {
+  static_assert(std::is_trivially_copyable<T>::value, "Seqlock needs a trivially copyable type") ;
+
+  public:
+    Seqlock() : sequence(0) {
+      for (int k = 0 ; k < NUM_WORDS ; ++k) words[k].store(0, std::memory_order_relaxed) ;
+    }
+
+    // writer side
+    void store(const T & value) {
+      uint64_t buffer [NUM_WORDS] = { 0 } ;
+      std::memcpy(buffer, &value, sizeof(T)) ;
+      unsigned long s = sequence.load(std::memory_order_relaxed) ;
+      sequence.store(s + 1, std::memory_order_relaxed) ;
+      std::atomic_thread_fence(std::memory_order_release) ;
+      for (int k = 0 ; k < NUM_WORDS ; ++k) words[k].store(buffer[k], std::memory_order_relaxed) ;
+      sequence.store(s + 2, std::memory_order_release) ;
+    }
+
+    // reader side
+    T load() const {
+      uint64_t buffer [NUM_WORDS] ;
+      unsigned long s0, s1 ;
+      do {
+        s0 = sequence.load(std::memory_order_acquire) ;
+        for (int k = 0 ; k < NUM_WORDS ; ++k) buffer[k] = words[k].load(std::memory_order_relaxed) ;
+        std::atomic_thread_fence(std::memory_order_acquire) ;
+        s1 = sequence.load(std::memory_order_relaxed) ;
+      } while ((s0 & 1) || s0 != s1) ;
+      T value ;
+      std::memcpy(&value, buffer, sizeof(T)) ;
+      return value ;
+    }
+
+    // number of values stored so far
+    unsigned long getVersion() const {
+      return sequence.load(std::memory_order_acquire) / 2 ;
+    }
+
+  private:
+    enum { NUM_WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t) } ;
+    alignas(64) std::atomic<unsigned long> sequence ;
+    std::atomic<uint64_t> words [NUM_WORDS] ;
+
+    Seqlock(const Seqlock &) ;
+    Seqlock & operator= (const Seqlock &) ;
+} ;
+
+#endif /* defined(__seqlock__) */
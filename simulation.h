@@ -6,10 +6,75 @@
 #ifndef __simulation__
 #define __simulation__
 
+#include <algorithm>
+#include <functional>
+
 class Simulation {
   public:
     virtual void step(double dt) = 0 ;
     virtual void display() = 0 ;
+
+    // called by run() after stepping, on the simulation thread when
+    // running threaded: copy here whatever draw() needs
+    virtual void publish() { }
+
+    // n steps in one call, so that an implementation can hoist its
+    // per-step setup out of the loop; the same result as calling
+    // step(dt) n times
+    virtual void stepN(double dt, long n) {
+      for (long k = 0 ; k < n ; ++k) step(dt) ;
+    }
+
+    // n steps, calling observer(steps done so far) after every
+    // every-th step (every >= 1) and after the last one; stops early
+    // if the observer returns false. Returns the number of steps taken.
+    typedef std::function<bool (long)> Observer ;
+    long run(double dt, long n, const Observer & observer, long every = 1) {
+      long done = 0 ;
+      while (done < n) {
+        long k = std::min(every - done % every, n - done) ;
+        stepN(dt, k) ;
+        done += k ;
+        if (observer && !observer(done)) break ;
+      }
+      return done ;
+    }
+} ;
+
+/* ---------------------------------------------------------------- */
+// class StaticSimulation : public Simulation
+/* ---------------------------------------------------------------- */
+
+// For drivers that know the type of the simulation, e.g.
+//   class Ball : public StaticSimulation<Ball> { ... } ;
+//   ball.run(dt, n, [&](long k) { ... ; return true ; }, 10) ;
+// stepN() and run() call Derived::stepN and Derived::step without
+// going through the vtable, and the observer is inlined. Derived
+// may define its own stepN; a further subclass overriding step or
+// stepN is not seen by these calls.
+
+template <typename Derived>
+class StaticSimulation : public Simulation {
+  public:
+    void stepN(double dt, long n) {
+      Derived & self = static_cast<Derived &>(*this) ;
+      for (long k = 0 ; k < n ; ++k) self.Derived::step(dt) ;
+    }
+
+    // a template parameter named Observer would be hidden by the
+    // typedef in Simulation
+    template <typename Function>
+    long run(double dt, long n, Function observer, long every = 1) {
+      Derived & self = static_cast<Derived &>(*this) ;
+      long done = 0 ;
+      while (done < n) {
+        long k = std::min(every - done % every, n - done) ;
+        self.Derived::stepN(dt, k) ;
+        done += k ;
+        if (!observer(done)) break ;
+      }
+      return done ;
+    }
 } ;
 
 #endif /* defined(__simulation__) */
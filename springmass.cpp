@@ -4,14 +4,30 @@
  **/
 
 #include "springmass.h"
+#include "threadpool.h"
+#include "profiler.h"
+#include "textwriter.h"
 
 #include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <list>
+#include <random>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
 
 /* ---------------------------------------------------------------- */
 // class Mass
 /* ---------------------------------------------------------------- */
 
-Mass::Mass() : position(), velocity(), force(), mass(1), radius(1) {}
+Mass::Mass() : position(), velocity(), force(), mass(1), radius(1), xmin(-1),xmax(1),ymin(-1),ymax(1),zmin(-1),zmax(1) {}
 
 Mass::Mass(Vector3 position, Vector3 velocity, double mass, double radius) 
 : position(position), velocity(velocity), force(), mass(mass), radius(radius), xmin(-1),xmax(1),ymin(-1),ymax(1),zmin(-1),zmax(1) {}
@@ -24,6 +40,16 @@ void Mass::addForce(Vector3 f) {
   force = force + f ;
 }
 
+void Mass::setState(Vector3 _position, Vector3 _velocity) {
+  position = _position ;
+  velocity = _velocity ;
+}
+
+void Mass::setBox(Vector3 boxMin, Vector3 boxMax) {
+  xmin = boxMin.x ; ymin = boxMin.y ; zmin = boxMin.z ;
+  xmax = boxMax.x ; ymax = boxMax.y ; zmax = boxMax.z ;
+}
+
 Vector3 Mass::getForce() const {
   return force ;
 }
@@ -44,13 +70,29 @@ double Mass::getMass() const {
   return mass ;
 }
 
+Vector3 Mass::getBoxMin() const {
+  return Vector3(xmin, ymin, zmin) ;
+}
+
+Vector3 Mass::getBoxMax() const {
+  return Vector3(xmax, ymax, zmax) ;
+}
+
+double Mass::getKineticEnergy() const {
+  return 0.5 * mass * velocity.norm2();
+}
+
+double Mass::getPotentialEnergy(double gravity) const {
+  return mass * gravity * position.y;
+}
+
 double Mass::getEnergy(double gravity) const {
 
   // potential energy
-  double potential = mass * gravity * position.y;
+  double potential = getPotentialEnergy(gravity);
   
   // kinetic energy 
-  double kinetic = 0.5 * mass * velocity.norm2();
+  double kinetic = getKineticEnergy();
 
   // total energy
   double total = potential + kinetic;
@@ -59,12 +101,17 @@ double Mass::getEnergy(double gravity) const {
 
 }
 
-void Mass::step(double dt) {
+void Mass::step(double dt, Integrator integrator) {
   
   // new position and velocity
-  // assuming constant acceleration
-  Vector3 end_position = position + velocity * dt + 0.5 * force / mass * dt * dt; 
+  Vector3 end_position ;
   Vector3 end_velocity = velocity + force / mass * dt; 
+  if (integrator == SYMPLECTIC_EULER) {
+    end_position = position + end_velocity * dt ;
+  } else {
+    // assuming constant acceleration
+    end_position = position + velocity * dt + 0.5 * force / mass * dt * dt; 
+  }
 
   // x direction
   if (xmin <= end_position.x - radius && end_position.x + radius <= xmax) {
@@ -119,6 +166,12 @@ Mass * Spring::getMass2() const {
 }
 
 Vector3 Spring::getForce() const {
+  double length ;
+  return getForce(length) ;
+}
+
+// same as getForce(), also returning the length it computed
+Vector3 Spring::getForce(double & length) const {
   // mass information
   Vector3 x1 = mass1 -> getPosition();
   Vector3 x2 = mass2 -> getPosition();
@@ -126,7 +179,8 @@ Vector3 Spring::getForce() const {
   Vector3 v2 = mass2 -> getVelocity();
 
   // spring information
-  double l = getLength();                   // spring length
+  double l = (x2 - x1).norm();              // spring length
+  length = l;
   Vector3 u12 = 1/l * (x2 - x1);            // spring direction
   Vector3 v12 = dot((v2 - v1), u12) * u12;  // contraction/expansion speed in spring direction
   
@@ -147,6 +201,14 @@ double Spring::getStiffness() const {
   return stiffness;
 }
 
+double Spring::getNaturalLength() const {
+  return naturalLength;
+}
+
+double Spring::getDamping() const {
+  return damping;
+}
+
 
 double Spring::getEnergy() const {
   double length = getLength() ;
@@ -181,11 +243,56 @@ std::ostream& operator << (std::ostream& os, const Spring& s) {
 
 
 /* ---------------------------------------------------------------- */
-// class SpringMass : public Simulation
+// class SpringMass : public StaticSimulation<SpringMass>
 /* ---------------------------------------------------------------- */
 
 SpringMass::SpringMass() { 
   gravity = EARTH_GRAVITY;
+  time = 0;
+  integrator = CONSTANT_ACCELERATION;
+  topology_version = 0;
+  checkpoint_version = -1;
+  checkpoint_token = 0;
+  topology_cache_version = -1;
+  pool = NULL;
+  display_writer = NULL;
+  deterministic = false;
+  kinetic_energy = potential_energy = elastic_energy = 0;
+  max_speed2 = max_strain = 0;
+  num_steps = 0;
+  next_observer_id = 0;
+  sampling = false;
+  active_valid = false;
+  island_parallel = false;
+  sleep_threshold = 0;
+  sleep_steps = 60;
+  num_sleeping = 0;
+  sleeping_potential = sleeping_elastic = sleeping_max_strain = 0;
+  invalidate();
+}
+
+SpringMass::~SpringMass() {
+  clear();
+  delete pool;
+  delete display_writer;
+}
+
+Mass * SpringMass::allocateMasses(int n) {
+  Mass * block = new Mass [n] ;
+  owned_blocks.push_back(block);
+  return block;
+}
+
+void SpringMass::clear() {
+  spring_list.clear();
+  mass_list.clear();
+  mass_index.clear();
+  for (std::vector<Mass *>::iterator it = owned_blocks.begin(); it != owned_blocks.end(); ++it) {
+    delete [] (*it);
+  }
+  owned_blocks.clear();
+  ++ topology_version;
+  invalidate();
 }
 
 
@@ -198,6 +305,13 @@ void SpringMass::addSpring(std::vector<Spring> more_springs) {
     // add mass
     addMass(*it); 
   }
+  ++ topology_version;
+  // not invalidate(): the springs already there are unchanged, so the
+  // time step bound only needs the new ones (the islands are rebuilt,
+  // all awake, with the topology)
+  forces_valid = false;
+  energy_valid = false;
+  timestep_iterations = 0;
 }
 
 void SpringMass::addMass(Spring _spring) {
@@ -205,14 +319,13 @@ void SpringMass::addMass(Spring _spring) {
   Mass * mass2 = _spring.getMass2();
 
   // append if not present
-  if ( std::find(mass_list.begin(), mass_list.end(), mass1) == mass_list.end() ) {
+  if ( mass_index.insert(std::make_pair(mass1, (int)mass_list.size())).second ) {
     mass_list.push_back(mass1);
   }
-  if ( std::find(mass_list.begin(), mass_list.end(), mass2) == mass_list.end() ) {
+  if ( mass_index.insert(std::make_pair(mass2, (int)mass_list.size())).second ) {
     mass_list.push_back(mass2);
   }
 
-
 }
 
 
@@ -220,8 +333,11 @@ void SpringMass::loadSample() {
   // mass
   const double mass = 1 ;
   const double radius = 0.1 ;
-  Mass * m1 = new Mass(Vector3(-0.5,0,0), Vector3(0, 0, 0), mass, radius) ;
-  Mass * m2 = new Mass(Vector3(+0.5,0,0), Vector3(1, 2, 0), mass, radius) ; // need destructor
+  Mass * masses = allocateMasses(2) ;
+  masses[0] = Mass(Vector3(-0.5,0,0), Vector3(0, 0, 0), mass, radius) ;
+  masses[1] = Mass(Vector3(+0.5,0,0), Vector3(1, 2, 0), mass, radius) ;
+  Mass * m1 = &masses[0] ;
+  Mass * m2 = &masses[1] ;
   
   // spring
   const double naturalLength = 0;
@@ -236,64 +352,1494 @@ void SpringMass::loadSample() {
   addSpring(more_springs);
 }
 
+// a rows x columns sheet in the xy plane with structural and shear
+// springs, slightly shaken so that it does not just fall flat
+void SpringMass::loadCloth(int rows, int columns) {
+  const double mass = 0.01 ;
+  const double spacing = 1.6 / std::max(std::max(rows, columns), 2) ;
+  const double radius = 0.25 * spacing ;
+  const double stiff = 5 ;
+  const double damping = 0.01 ;
+  Mass * masses = allocateMasses(rows * columns) ;
+  for (int i = 0 ; i < rows ; ++i) {
+    for (int j = 0 ; j < columns ; ++j) {
+      Vector3 position(-0.8 + j * spacing, 0.8 - i * spacing, 0) ;
+      Vector3 velocity(0.1 * ((i * 7 + j * 3) % 5 - 2), 0.1 * ((i * 5 + j) % 3 - 1), 0) ;
+      masses[i * columns + j] = Mass(position, velocity, mass, radius) ;
+    }
+  }
+
+  std::vector<Spring> more_springs ;
+  for (int i = 0 ; i < rows ; ++i) {
+    for (int j = 0 ; j < columns ; ++j) {
+      Mass * m = &masses[i * columns + j] ;
+      if (j + 1 < columns) more_springs.push_back(Spring(m, m + 1, spacing, stiff, damping)) ;
+      if (i + 1 < rows) more_springs.push_back(Spring(m, m + columns, spacing, stiff, damping)) ;
+      if (i + 1 < rows && j + 1 < columns) {
+        more_springs.push_back(Spring(m, m + columns + 1, spacing * std::sqrt(2.0), stiff, damping)) ;
+      }
+    }
+  }
+  addSpring(more_springs);
+}
+
+// count small 3 x 3 sheets standing on the floor on a grid over x and
+// z, each shaken by a different amount with no net momentum, so that
+// they come to rest one after the other
+void SpringMass::loadClusters(int count) {
+  const double mass = 0.01 ;
+  const double spacing = 0.05 ;
+  const double radius = 0.01 ;
+  const double stiff = 5 ;
+  const double damping = 0.05 ;
+  int columns = (int)std::ceil(std::sqrt((double)count)) ;
+  double pitch = 1.8 / std::max(columns, 1) ;
+  Mass * masses = allocateMasses(9 * count) ;
+  std::vector<Spring> more_springs ;
+  for (int c = 0 ; c < count ; ++c) {
+    Vector3 origin(-0.9 + (c % columns + 0.5) * pitch - spacing, -1 + radius, -0.9 + (c / columns + 0.5) * pitch) ;
+    double shake = 0.05 * (1 + c % 7) ;
+    Mass * m = masses + 9 * c ;
+    for (int i = 0 ; i < 3 ; ++i) {
+      for (int j = 0 ; j < 3 ; ++j) {
+        Vector3 position = origin + Vector3(j * spacing, i * spacing, 0) ;
+        Vector3 velocity(shake * (j - 1), 0, shake * (i - 1) * (j - 1)) ;
+        m[3 * i + j] = Mass(position, velocity, mass, radius) ;
+      }
+    }
+    for (int i = 0 ; i < 3 ; ++i) {
+      for (int j = 0 ; j < 3 ; ++j) {
+        Mass * a = m + 3 * i + j ;
+        if (j + 1 < 3) more_springs.push_back(Spring(a, a + 1, spacing, stiff, damping)) ;
+        if (i + 1 < 3) more_springs.push_back(Spring(a, a + 3, spacing, stiff, damping)) ;
+        if (i + 1 < 3 && j + 1 < 3) {
+          more_springs.push_back(Spring(a, a + 4, spacing * std::sqrt(2.0), stiff, damping)) ;
+          more_springs.push_back(Spring(a + 1, a + 3, spacing * std::sqrt(2.0), stiff, damping)) ;
+        }
+      }
+    }
+  }
+  addSpring(more_springs);
+}
+
 void SpringMass::setGravity(double _gravity) {
   gravity = _gravity;
+  invalidate();
 }
 
 void SpringMass::display() {
-  // multiple mass per line
-  for (std::vector<Mass *>::iterator it = begin(mass_list); it != end (mass_list); ++it) {
-    Vector3 position = (*it) -> getPosition();
-    std::cout << position.x << " " << position.y << " " << position.z << " ";
-  } 
-  // end line
-  std::cout << std::endl;
+  PROFILE_SCOPE(PHASE_OUTPUT) ;
+  // multiple mass per line, as iostream would print them; flushed
+  // every call (after std::cout) so that lines still come out in order
+  // with the rest of the output
+  if (!display_writer) display_writer = new TextWriter(1, 1 << 16) ;
+  std::cout.flush() ;
+  display_writer->write(*this) ;
+  display_writer->flush() ;
+}
+
+double SpringMass::getTime() const {
+  return time;
+}
+
+int SpringMass::getNumMasses() const {
+  return (int)mass_list.size();
+}
+
+const std::vector<Mass *> & SpringMass::getMassList() const {
+  return mass_list;
+}
+
+const std::vector<Spring> & SpringMass::getSpringList() const {
+  return spring_list;
 }
 
 double SpringMass::getEnergy() {
-  double energy = 0 ;
-  
-  // mass
-  for (std::vector<Mass *>::iterator it = mass_list.begin(); it != mass_list.end(); ++it) {
-    energy += (*it)->getEnergy(gravity);
+  if (!energy_valid) computeEnergy() ;
+  return kinetic_energy + potential_energy + elastic_energy ;
+}
+
+double SpringMass::getKineticEnergy() {
+  if (!energy_valid) computeEnergy() ;
+  return kinetic_energy ;
+}
+
+double SpringMass::getPotentialEnergy() {
+  if (!energy_valid) computeEnergy() ;
+  return potential_energy ;
+}
+
+double SpringMass::getElasticEnergy() {
+  if (!energy_valid) computeEnergy() ;
+  return elastic_energy ;
+}
+
+void SpringMass::invalidate() {
+  forces_valid = false ;
+  energy_valid = false ;
+  timestep_springs = 0 ;
+  timestep_bound = std::numeric_limits<double>::infinity() ;
+  timestep_damping = 0 ;
+  timestep_eigenvalue = 0 ;
+  timestep_iterations = 0 ;
+  wakeAll() ;
+}
+
+Diagnostics SpringMass::getDiagnostics() const {
+  return diagnostics.load() ;
+}
+
+int SpringMass::addObserver(const StepObserver & observer, long every) {
+  ObserverEntry entry ;
+  entry.id = next_observer_id++ ;
+  entry.every = std::max(every, 1L) ;
+  entry.observer = observer ;
+  observers.push_back(entry) ;
+  return entry.id ;
+}
+
+void SpringMass::removeObserver(int id) {
+  for (std::vector<ObserverEntry>::iterator it = observers.begin() ; it != observers.end() ; ++it) {
+    if (it->id == id) {
+      observers.erase(it) ;
+      return ;
+    }
   }
+}
 
-  // spring
-  for (std::vector<Spring>::iterator it = spring_list.begin(); it != spring_list.end(); ++it) {
-    energy += (*it).getEnergy();
+bool SpringMass::isSampleDue(long step) const {
+  for (std::vector<ObserverEntry>::const_iterator it = observers.begin() ; it != observers.end() ; ++it) {
+    if (step % it->every == 0) return true ;
   }
-  
-  return energy ;
+  return false ;
+}
+
+void SpringMass::notifyObservers() {
+  StateView view ;
+  view.step = num_steps ;
+  view.time = time ;
+  view.numMasses = (int)mass_list.size() ;
+  view.positions = sample_positions.data() ;
+  view.velocities = sample_velocities.data() ;
+  // an observer may remove itself or others: it is called through a
+  // copy, and the index only moves on if the entry is still there
+  for (size_t k = 0 ; k < observers.size() ; ) {
+    int id = observers[k].id ;
+    if (num_steps % observers[k].every == 0) {
+      StepObserver observer = observers[k].observer ;
+      observer(view) ;
+    }
+    if (k < observers.size() && observers[k].id == id) ++ k ;
+  }
+}
+
+void SpringMass::setSleeping(double threshold, int steps) {
+  sleep_threshold = threshold ;
+  sleep_steps = std::max(steps, 1) ;
+  if (threshold <= 0) wakeAll() ;
+}
+
+int SpringMass::getNumIslands() {
+  updateTopology() ;
+  return (int)island_asleep.size() ;
+}
+
+int SpringMass::getNumSleepingIslands() const {
+  return num_sleeping ;
+}
+
+// forces of the masses asleep were left behind, so they are all
+// evaluated again
+void SpringMass::wake(const Mass * mass) {
+  std::unordered_map<const Mass *, int>::const_iterator it = mass_index.find(mass) ;
+  if (it == mass_index.end() || topology_cache_version != topology_version) return ;
+  int j = mass_island[it->second] ;
+  island_quiet_steps[j] = 0 ;
+  if (!island_asleep[j]) return ;
+  island_asleep[j] = 0 ;
+  -- num_sleeping ;
+  updateSleepingTotals() ;
+  active_valid = false ;
+  forces_valid = false ;
+}
+
+void SpringMass::wakeAll() {
+  std::fill(island_quiet_steps.begin(), island_quiet_steps.end(), 0) ;
+  if (num_sleeping == 0) return ;
+  std::fill(island_asleep.begin(), island_asleep.end(), 0) ;
+  num_sleeping = 0 ;
+  updateSleepingTotals() ;
+  active_valid = false ;
+  forces_valid = false ;
+}
+
+void SpringMass::publishDiagnostics() {
+  Diagnostics d ;
+  d.steps = num_steps ;
+  d.time = time ;
+  d.energy = kinetic_energy + potential_energy + elastic_energy ;
+  d.kinetic = kinetic_energy ;
+  d.potential = potential_energy ;
+  d.elastic = elastic_energy ;
+  d.momentum = momentum ;
+  d.maxSpeed = std::sqrt(max_speed2) ;
+  d.maxStrain = max_strain ;
+  diagnostics.store(d) ;
 }
 
 void SpringMass::step(double dt) {
+  SpringMass::stepN(dt, 1) ;
+}
+
+void SpringMass::stepN(double dt, long n) {
+  if (n <= 0) return ;
+  updateTopology() ;
+  if (!active_valid) updateActive() ;
+  if (!observers.empty()) {
+    sample_positions.resize(3 * mass_list.size()) ;
+    sample_velocities.resize(3 * mass_list.size()) ;
+  }
+  for (long k = 0 ; k < n ; ++k) {
+    {
+      PROFILE_SCOPE(PHASE_STEP) ;
+      sampling = !observers.empty() && isSampleDue(num_steps + 1) ;
+
+      // forces of the current state, unless the previous step left them
+      if (!forces_valid) {
+        resetForces() ;
+        springPass() ;
+      }
+
+      // update, then forces of the new state for the next step
+      massPass(dt) ;
+      springPass() ;
+      if (!island_tasks.empty()) islandPass(dt, forces_valid) ;
+
+      forces_valid = true ;
+      energy_valid = true ;
+      time += dt;
+      ++ num_steps ;
+
+      if (sleep_threshold > 0) {
+        updateSleeping() ;
+        if (!active_valid) updateActive() ;
+      }
+    }
+    if (sampling) notifyObservers() ;
+    PROFILE_END_STEP() ;
+  }
+  publishDiagnostics() ;
+}
+
+/* ---------------------------------------------------------------- */
+// stable time step
+/* ---------------------------------------------------------------- */
+
+// Symplectic Euler on x'' = -w2 x - gamma x' is stable as long as
+// w2 dt^2 + 2 gamma dt < 4 (Jury's test on its 2 x 2 update), that is
+// for dt below
+static double stableTimeStep(double w2, double gamma) {
+  if (w2 <= 0) return (gamma > 0) ? 2 / gamma : std::numeric_limits<double>::infinity() ;
+  return (std::sqrt(gamma * gamma + 4 * w2) - gamma) / w2 ;
+}
+
+double SpringMass::getStableTimeStep(int powerIterations) {
+  // the new springs, by themselves
+  for ( ; timestep_springs < spring_list.size() ; ++ timestep_springs) {
+    const Spring & spring = spring_list[timestep_springs] ;
+    double m1 = spring.getMass1()->getMass() ;
+    double m2 = spring.getMass2()->getMass() ;
+    double mu = m1 * m2 / (m1 + m2) ;
+    double w2 = spring.getStiffness() / mu ;
+    double gamma = spring.getDamping() / mu ;
+    timestep_bound = std::min(timestep_bound, stableTimeStep(w2, gamma)) ;
+    timestep_damping = std::max(timestep_damping, gamma) ;
+  }
+  if (powerIterations <= 0) return timestep_bound ;
+
+  // largest eigenvalue of M^-1/2 K M^-1/2, K the stiffness of the
+  // springs along their current directions; rerun only if something
+  // changed or more iterations are asked for
+  if (powerIterations > timestep_iterations) {
+    updateTopology() ;
+    size_t numMasses = mass_list.size() ;
+    std::vector<double> scale(numMasses) ;
+    for (size_t i = 0 ; i < numMasses ; ++i) scale[i] = 1 / std::sqrt(mass_list[i]->getMass()) ;
+    std::vector<Vector3> direction(spring_list.size()) ;
+    for (size_t s = 0 ; s < spring_list.size() ; ++s) {
+      Vector3 d = spring_list[s].getMass2()->getPosition() - spring_list[s].getMass1()->getPosition() ;
+      double l = d.norm() ;
+      if (l > 0) direction[s] = d / l ;
+    }
+    std::vector<double> & x = timestep_vector ;
+    if (x.size() != 3 * numMasses) {
+      std::mt19937 generator(1) ;
+      std::uniform_real_distribution<double> uniform(-1, 1) ;
+      x.resize(3 * numMasses) ;
+      for (size_t k = 0 ; k < x.size() ; ++k) x[k] = uniform(generator) ;
+    }
+    std::vector<double> y(3 * numMasses) ;
+    double eigenvalue = 0 ;
+    for (int it = 0 ; it < powerIterations ; ++it) {
+      std::fill(y.begin(), y.end(), 0.0) ;
+      for (size_t s = 0 ; s < spring_list.size() ; ++s) {
+        int i1 = spring_mass1[s] ;
+        int i2 = spring_mass2[s] ;
+        const Vector3 & u = direction[s] ;
+        Vector3 x1 = scale[i1] * Vector3(x[3*i1], x[3*i1+1], x[3*i1+2]) ;
+        Vector3 x2 = scale[i2] * Vector3(x[3*i2], x[3*i2+1], x[3*i2+2]) ;
+        Vector3 f = (spring_list[s].getStiffness() * dot(u, x1 - x2)) * u ;
+        y[3*i1] += scale[i1] * f.x ; y[3*i1+1] += scale[i1] * f.y ; y[3*i1+2] += scale[i1] * f.z ;
+        y[3*i2] -= scale[i2] * f.x ; y[3*i2+1] -= scale[i2] * f.y ; y[3*i2+2] -= scale[i2] * f.z ;
+      }
+      // Rayleigh quotient, then normalize
+      double xy = 0, xx = 0, yy = 0 ;
+      for (size_t k = 0 ; k < x.size() ; ++k) {
+        xy += x[k] * y[k] ;
+        xx += x[k] * x[k] ;
+        yy += y[k] * y[k] ;
+      }
+      if (xx == 0 || yy == 0) break ;
+      eigenvalue = xy / xx ;
+      double norm = std::sqrt(yy) ;
+      for (size_t k = 0 ; k < x.size() ; ++k) x[k] = y[k] / norm ;
+    }
+    timestep_eigenvalue = eigenvalue ;
+    timestep_iterations = powerIterations ;
+  }
+  return std::min(timestep_bound, stableTimeStep(timestep_eigenvalue, timestep_damping)) ;
+}
+
+/* ---------------------------------------------------------------- */
+// renumbering
+/* ---------------------------------------------------------------- */
+
+// Reverse Cuthill-McKee: each connected component is numbered breadth
+// first from a pseudo-peripheral mass (found by repeated breadth first
+// searches from the least connected one of the last level), visiting
+// neighbours by increasing degree; the whole order is then reversed.
+static void reverseCuthillMcKee(const std::vector<int> & offsets, const std::vector<int> & neighbours,
+                                std::vector<int> & order) {
+  int n = (int)offsets.size() - 1 ;
+  std::vector<int> degree(n) ;
+  std::vector<int> byDegree(n) ;
+  for (int i = 0 ; i < n ; ++i) {
+    degree[i] = offsets[i + 1] - offsets[i] ;
+    byDegree[i] = i ;
+  }
+  std::stable_sort(byDegree.begin(), byDegree.end(), [&](int a, int b) { return degree[a] < degree[b] ; }) ;
+
+  std::vector<char> numbered(n, 0) ;
+  std::vector<int> seen(n, -1) ;
+  std::vector<int> depth(n) ;
+  std::vector<int> queue ;
+  int stamp = 0 ;
+
+  // breadth first over the masses not numbered yet, returns the depth
+  // reached; queue holds the masses in visiting order
+  auto levels = [&](int root) {
+    queue.assign(1, root) ;
+    seen[root] = ++ stamp ;
+    depth[root] = 0 ;
+    for (size_t k = 0 ; k < queue.size() ; ++k) {
+      int i = queue[k] ;
+      for (int e = offsets[i] ; e < offsets[i + 1] ; ++e) {
+        int j = neighbours[e] ;
+        if (seen[j] == stamp || numbered[j]) continue ;
+        seen[j] = stamp ;
+        depth[j] = depth[i] + 1 ;
+        queue.push_back(j) ;
+      }
+    }
+    return depth[queue.back()] ;
+  } ;
+
+  order.clear() ;
+  std::vector<int> next ;
+  for (int r = 0 ; r < n ; ++r) {
+    int root = byDegree[r] ;
+    if (numbered[root]) continue ;
+    int eccentricity = levels(root) ;
+    for (;;) {
+      int candidate = queue.back() ;
+      for (size_t k = queue.size() ; k-- > 0 && depth[queue[k]] == eccentricity ; ) {
+        if (degree[queue[k]] <= degree[candidate]) candidate = queue[k] ;
+      }
+      int e = levels(candidate) ;
+      if (e <= eccentricity) break ;
+      root = candidate ;
+      eccentricity = e ;
+    }
+
+    size_t first = order.size() ;
+    order.push_back(root) ;
+    numbered[root] = 1 ;
+    for (size_t k = first ; k < order.size() ; ++k) {
+      int i = order[k] ;
+      next.clear() ;
+      for (int e = offsets[i] ; e < offsets[i + 1] ; ++e) {
+        int j = neighbours[e] ;
+        if (numbered[j]) continue ;
+        numbered[j] = 1 ;
+        next.push_back(j) ;
+      }
+      std::stable_sort(next.begin(), next.end(), [&](int a, int b) { return degree[a] < degree[b] ; }) ;
+      order.insert(order.end(), next.begin(), next.end()) ;
+    }
+  }
+  std::reverse(order.begin(), order.end()) ;
+}
 
-  // set initial force 
+// 21 bits spread to every third bit
+static uint64_t spreadBits(uint64_t x) {
+  x &= 0x1fffff ;
+  x = (x | x << 32) & 0x1f00000000ffffULL ;
+  x = (x | x << 16) & 0x1f0000ff0000ffULL ;
+  x = (x | x << 8) & 0x100f00f00f00f00fULL ;
+  x = (x | x << 4) & 0x10c30c30c30c30c3ULL ;
+  x = (x | x << 2) & 0x1249249249249249ULL ;
+  return x ;
+}
+
+static void mortonOrder(const std::vector<Mass *> & masses, std::vector<int> & order) {
+  size_t n = masses.size() ;
+  Vector3 lo(HUGE_VAL, HUGE_VAL, HUGE_VAL) ;
+  Vector3 hi(-HUGE_VAL, -HUGE_VAL, -HUGE_VAL) ;
+  for (size_t i = 0 ; i < n ; ++i) {
+    Vector3 p = masses[i]->getPosition() ;
+    lo = Vector3(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z)) ;
+    hi = Vector3(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z)) ;
+  }
+  double extent = std::max(std::max(hi.x - lo.x, hi.y - lo.y), std::max(hi.z - lo.z, 1e-300)) ;
+  double scale = 0x1fffff / extent ;
+  std::vector<uint64_t> keys(n) ;
+  for (size_t i = 0 ; i < n ; ++i) {
+    Vector3 p = (masses[i]->getPosition() - lo) * scale ;
+    keys[i] = spreadBits((uint64_t)p.x) | spreadBits((uint64_t)p.y) << 1 | spreadBits((uint64_t)p.z) << 2 ;
+  }
+  order.resize(n) ;
+  for (size_t i = 0 ; i < n ; ++i) order[i] = (int)i ;
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return keys[a] < keys[b] ; }) ;
+}
+
+double SpringMass::getSpan() const {
+  if (spring_list.empty()) return 0 ;
+  double span = 0 ;
+  for (size_t s = 0 ; s < spring_list.size() ; ++s) {
+    span += std::abs(mass_index.find(spring_list[s].getMass1())->second -
+                     mass_index.find(spring_list[s].getMass2())->second) ;
+  }
+  return span / spring_list.size() ;
+}
+
+// the lines touched by a mass pass then a spring pass, in their order
+long SpringMass::simulateCacheMisses() const {
+  std::list<uintptr_t> lru ;
+  std::unordered_map<uintptr_t, std::list<uintptr_t>::iterator> cached ;
+  long misses = 0 ;
+  auto touch = [&](const void * object, size_t size) {
+    uintptr_t first = (uintptr_t)object / REORDER_LINE_SIZE ;
+    uintptr_t last = ((uintptr_t)object + size - 1) / REORDER_LINE_SIZE ;
+    for (uintptr_t line = first ; line <= last ; ++line) {
+      std::unordered_map<uintptr_t, std::list<uintptr_t>::iterator>::iterator it = cached.find(line) ;
+      if (it != cached.end()) {
+        lru.splice(lru.begin(), lru, it->second) ;
+        continue ;
+      }
+      ++ misses ;
+      lru.push_front(line) ;
+      cached[line] = lru.begin() ;
+      if (lru.size() > REORDER_CACHE_LINES) {
+        cached.erase(lru.back()) ;
+        lru.pop_back() ;
+      }
+    }
+  } ;
+  for (size_t i = 0 ; i < mass_list.size() ; ++i) touch(mass_list[i], sizeof(Mass)) ;
+  for (size_t s = 0 ; s < spring_list.size() ; ++s) {
+    touch(&spring_list[s], sizeof(Spring)) ;
+    touch(spring_list[s].getMass1(), sizeof(Mass)) ;
+    touch(spring_list[s].getMass2(), sizeof(Mass)) ;
+  }
+  return misses ;
+}
+
+ReorderReport SpringMass::reorder(Ordering ordering, bool relocate) {
+  ReorderReport report ;
+  report.spanBefore = getSpan() ;
+  report.missesBefore = simulateCacheMisses() ;
+  report.relocated = relocate ;
+
+  // the new order, as old indices
+  updateTopology() ;
+  size_t numMasses = mass_list.size() ;
+  std::vector<int> order ;
+  if (ordering == MORTON) {
+    mortonOrder(mass_list, order) ;
+  } else {
+    std::vector<int> offsets(incident_offsets) ;
+    std::vector<int> neighbours(incident_springs.size()) ;
+    for (size_t i = 0 ; i < numMasses ; ++i) {
+      for (int k = incident_offsets[i] ; k < incident_offsets[i + 1] ; ++k) {
+        int s = incident_springs[k] ;
+        neighbours[k] = (s > 0) ? spring_mass2[s - 1] : spring_mass1[-s - 1] ;
+      }
+    }
+    reverseCuthillMcKee(offsets, neighbours, order) ;
+  }
+
+  // masses, moved to a new block if asked
+  std::vector<Mass *> masses(numMasses) ;
+  std::vector<Mass *> moved(numMasses) ; // by old index
+  if (relocate && numMasses > 0) {
+    Mass * block = new Mass [numMasses] ;
+    for (size_t k = 0 ; k < numMasses ; ++k) block[k] = *mass_list[order[k]] ;
+    for (std::vector<Mass *>::iterator it = owned_blocks.begin(); it != owned_blocks.end(); ++it) {
+      delete [] (*it);
+    }
+    owned_blocks.assign(1, block) ;
+    for (size_t k = 0 ; k < numMasses ; ++k) moved[order[k]] = block + k ;
+  } else {
+    for (size_t i = 0 ; i < numMasses ; ++i) moved[i] = mass_list[i] ;
+  }
+  mass_index.clear() ;
+  for (size_t k = 0 ; k < numMasses ; ++k) {
+    masses[k] = moved[order[k]] ;
+    mass_index[masses[k]] = (int)k ;
+  }
+  mass_list.swap(masses) ;
+
+  // springs, by their lower then higher end
+  std::vector<int> rank(numMasses) ;
+  for (size_t k = 0 ; k < numMasses ; ++k) rank[order[k]] = (int)k ;
+  std::vector<int> sorted(spring_list.size()) ;
+  for (size_t s = 0 ; s < sorted.size() ; ++s) sorted[s] = (int)s ;
+  std::stable_sort(sorted.begin(), sorted.end(), [&](int a, int b) {
+    int a1 = rank[spring_mass1[a]], a2 = rank[spring_mass2[a]] ;
+    int b1 = rank[spring_mass1[b]], b2 = rank[spring_mass2[b]] ;
+    if (std::min(a1, a2) != std::min(b1, b2)) return std::min(a1, a2) < std::min(b1, b2) ;
+    return std::max(a1, a2) < std::max(b1, b2) ;
+  }) ;
+  std::vector<Spring> springs ;
+  springs.reserve(spring_list.size()) ;
+  for (size_t k = 0 ; k < sorted.size() ; ++k) {
+    const Spring & spring = spring_list[sorted[k]] ;
+    springs.push_back(Spring(moved[spring_mass1[sorted[k]]], moved[spring_mass2[sorted[k]]],
+                             spring.getNaturalLength(), spring.getStiffness(), spring.getDamping())) ;
+  }
+  spring_list.swap(springs) ;
+
+  // the masses and their connections are the same, only numbered
+  // differently: each island keeps its sleep state and the energies it
+  // sleeps with, found through any of its masses. The forces are
+  // evaluated again and the stable time step estimated again (its
+  // power vector is by mass index)
+  std::vector<int> oldIsland(mass_island) ;
+  std::vector<char> asleep(island_asleep) ;
+  std::vector<int> quietSteps(island_quiet_steps) ;
+  std::vector<double> potential(island_potential) ;
+  std::vector<double> elastic(island_elastic) ;
+  std::vector<double> maxStrain(island_max_strain) ;
+  ++ topology_version ;
+  updateTopology() ;
+  for (size_t j = 0 ; j < island_asleep.size() ; ++j) {
+    int i = oldIsland[order[island_masses[island_mass_offsets[j]]]] ;
+    island_asleep[j] = asleep[i] ;
+    island_quiet_steps[j] = quietSteps[i] ;
+    island_potential[j] = potential[i] ;
+    island_elastic[j] = elastic[i] ;
+    island_max_strain[j] = maxStrain[i] ;
+    if (island_asleep[j]) ++ num_sleeping ;
+  }
+  updateSleepingTotals() ;
+  forces_valid = false ;
+  energy_valid = false ;
+  timestep_vector.clear() ;
+  timestep_iterations = 0 ;
+  report.spanAfter = getSpan() ;
+  report.missesAfter = simulateCacheMisses() ;
+  return report ;
+}
+
+/* ---------------------------------------------------------------- */
+// checkpoint and restart
+/* ---------------------------------------------------------------- */
+
+// A checkpoint is a pair of files:
+//   NAME.topology.TOKEN  masses (mass, radius, box) and springs
+//                        (endpoint indices, natural length, stiffness,
+//                        damping)
+//   NAME                 time, gravity, the sleeping parameters, the
+//                        position, velocity and force of every mass,
+//                        whether those forces are the ones of the
+//                        state and, when sleeping is on, the sleep
+//                        state of every island (asleep, quiet steps
+//                        and the energies it sleeps with)
+// Both start with the same random token, which also names the
+// topology file. The topology is only written again when masses or
+// springs changed since the last checkpoint, so repeated checkpoints
+// cost one pass over the dynamic state. There is no random number
+// generator to save. A restart from valid forces does not evaluate
+// them again before its first step, just as the run it continues.
+//
+// Each file is replaced atomically, and the pair is too: a new
+// topology goes to a new name, then the state is renamed over NAME,
+// and only then is the topology of the previous NAME deleted. A
+// crash at any point leaves NAME with the topology it refers to.
+
+#define CHECKPOINT_TOPOLOGY_MAGIC "SMCKTOP1"
+#define CHECKPOINT_STATE_MAGIC "SMCKSTA3"
+
+// write to NAME.tmp, flush to disk, then rename over NAME
+static bool writeAtomically(std::string fileName, const std::vector<char> & data) {
+  std::string tmpName = fileName + ".tmp" ;
+  FILE * file = std::fopen(tmpName.c_str(), "wb") ;
+  if (!file) return false ;
+  bool ok = std::fwrite(data.data(), 1, data.size(), file) == data.size() ;
+  ok = (std::fflush(file) == 0) && ok ;
+#if !defined(_WIN32)
+  ok = (fsync(fileno(file)) == 0) && ok ;
+#endif
+  ok = (std::fclose(file) == 0) && ok ;
+#if defined(_WIN32)
+  ok = ok && MoveFileExA(tmpName.c_str(), fileName.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) ;
+#else
+  ok = ok && std::rename(tmpName.c_str(), fileName.c_str()) == 0 ;
+#endif
+  if (!ok) std::remove(tmpName.c_str()) ;
+  return ok ;
+}
+
+static std::string topologyName(std::string fileName, uint64_t token) {
+  char suffix [32] ;
+  std::snprintf(suffix, sizeof(suffix), ".topology.%016llx", (unsigned long long)token) ;
+  return fileName + suffix ;
+}
+
+// token of the checkpoint NAME, if there is one
+static bool readToken(std::string fileName, uint64_t & token) {
+  FILE * file = std::fopen(fileName.c_str(), "rb") ;
+  if (!file) return false ;
+  char magic [8] ;
+  bool ok = std::fread(magic, 1, 8, file) == 8 &&
+            std::memcmp(magic, CHECKPOINT_STATE_MAGIC, 8) == 0 &&
+            std::fread(&token, sizeof(token), 1, file) == 1 ;
+  std::fclose(file) ;
+  return ok ;
+}
+
+static bool readFile(std::string fileName, std::vector<char> & data) {
+  FILE * file = std::fopen(fileName.c_str(), "rb") ;
+  if (!file) return false ;
+  std::fseek(file, 0, SEEK_END) ;
+  long size = std::ftell(file) ;
+  std::fseek(file, 0, SEEK_SET) ;
+  data.resize(size > 0 ? size : 0) ;
+  bool ok = size >= 0 && std::fread(data.data(), 1, data.size(), file) == data.size() ;
+  std::fclose(file) ;
+  return ok ;
+}
+
+template <typename T>
+static void put(std::vector<char> & data, T value) {
+  const char * bytes = (const char *)&value ;
+  data.insert(data.end(), bytes, bytes + sizeof(T)) ;
+}
+
+template <typename T>
+static bool get(const std::vector<char> & data, size_t & offset, T & value) {
+  if (offset + sizeof(T) > data.size()) return false ;
+  std::memcpy(&value, &data[offset], sizeof(T)) ;
+  offset += sizeof(T) ;
+  return true ;
+}
+
+bool SpringMass::saveCheckpoint(std::string fileName) {
+  std::vector<char> data ;
+  uint64_t previousToken ;
+  bool replacing = readToken(fileName, previousToken) ;
+
+  // topology, only when it changed
+  if (checkpoint_version != topology_version || checkpoint_name != fileName) {
+    std::random_device random ;
+    uint64_t token = ((uint64_t)random() << 32) ^ (uint64_t)random() ;
+
+    data.reserve(40 + mass_list.size() * 8 * sizeof(double) + spring_list.size() * 5 * sizeof(double)) ;
+    data.insert(data.end(), CHECKPOINT_TOPOLOGY_MAGIC, CHECKPOINT_TOPOLOGY_MAGIC + 8) ;
+    put(data, token) ;
+    put(data, (int64_t)mass_list.size()) ;
+    put(data, (int64_t)spring_list.size()) ;
+    for (std::vector<Mass *>::iterator it = mass_list.begin(); it != mass_list.end(); ++it) {
+      put(data, (*it)->getMass()) ;
+      put(data, (*it)->getRadius()) ;
+      put(data, (*it)->getBoxMin()) ;
+      put(data, (*it)->getBoxMax()) ;
+    }
+    for (std::vector<Spring>::iterator it = spring_list.begin(); it != spring_list.end(); ++it) {
+      put(data, (int64_t)mass_index[(*it).getMass1()]) ;
+      put(data, (int64_t)mass_index[(*it).getMass2()]) ;
+      put(data, (*it).getNaturalLength()) ;
+      put(data, (*it).getStiffness()) ;
+      put(data, (*it).getDamping()) ;
+    }
+    if (! writeAtomically(topologyName(fileName, token), data)) {
+      std::cerr << "SpringMass: cannot write " << topologyName(fileName, token) << std::endl ;
+      return false ;
+    }
+    checkpoint_version = topology_version ;
+    checkpoint_token = token ;
+    checkpoint_name = fileName ;
+  }
+
+  // dynamic state
+  updateTopology() ;
+  size_t numIslands = (sleep_threshold > 0) ? island_asleep.size() : 0 ;
+  data.clear() ;
+  data.reserve(80 + mass_list.size() * 9 * sizeof(double) + numIslands * 5 * sizeof(double)) ;
+  data.insert(data.end(), CHECKPOINT_STATE_MAGIC, CHECKPOINT_STATE_MAGIC + 8) ;
+  put(data, checkpoint_token) ;
+  put(data, (int64_t)mass_list.size()) ;
+  put(data, time) ;
+  put(data, gravity) ;
+  put(data, sleep_threshold) ;
+  put(data, (int64_t)sleep_steps) ;
+  // only the serial step leaves the forces of the state in the
+  // masses; the parallel ones keep them apart
+  put(data, (int64_t)(forces_valid && !pool && !deterministic)) ;
+  put(data, (int64_t)numIslands) ;
+  for (std::vector<Mass *>::iterator it = mass_list.begin(); it != mass_list.end(); ++it) {
+    put(data, (*it)->getPosition()) ;
+    put(data, (*it)->getVelocity()) ;
+    put(data, (*it)->getForce()) ;
+  }
+  for (size_t j = 0 ; j < numIslands ; ++j) {
+    put(data, (int64_t)island_asleep[j]) ;
+    put(data, (int64_t)island_quiet_steps[j]) ;
+    put(data, island_potential[j]) ;
+    put(data, island_elastic[j]) ;
+    put(data, island_max_strain[j]) ;
+  }
+  if (! writeAtomically(fileName, data)) {
+    std::cerr << "SpringMass: cannot write " << fileName << std::endl ;
+    return false ;
+  }
+  if (replacing && previousToken != checkpoint_token) {
+    std::remove(topologyName(fileName, previousToken).c_str()) ;
+  }
+  return true ;
+}
+
+bool SpringMass::restoreCheckpoint(std::string fileName) {
+  std::vector<char> state ;
+  size_t offset = 8 ;
+  uint64_t token = 0 ;
+  int64_t numMasses = 0, sleepSteps = 0, forcesValid = 0, numIslands = 0 ;
+  double _time = 0, _gravity = 0, sleepThreshold = 0 ;
+  // the counts are bounded by the size of the file before they are
+  // multiplied, so that a corrupt one cannot overflow
+  if (! readFile(fileName, state) || state.size() < 8 ||
+      std::memcmp(&state[0], CHECKPOINT_STATE_MAGIC, 8) != 0 ||
+      ! get(state, offset, token) || ! get(state, offset, numMasses) ||
+      ! get(state, offset, _time) || ! get(state, offset, _gravity) ||
+      ! get(state, offset, sleepThreshold) || ! get(state, offset, sleepSteps) ||
+      ! get(state, offset, forcesValid) || ! get(state, offset, numIslands) ||
+      numMasses < 0 || numIslands < 0 || numIslands > numMasses ||
+      (uint64_t)numMasses > (state.size() - offset) / (9 * sizeof(double)) ||
+      state.size() - offset != (size_t)(numMasses * 9 + numIslands * 5) * sizeof(double)) {
+    std::cerr << "SpringMass: " << fileName << " is not a valid checkpoint" << std::endl ;
+    return false ;
+  }
+
+  // rebuild the masses and springs unless this simulation wrote the
+  // checkpoint and has not changed since
+  if (token != checkpoint_token || topology_version != checkpoint_version) {
+    std::vector<char> topology ;
+    size_t at = 8 ;
+    uint64_t topologyToken ;
+    int64_t topologyMasses = 0, numSprings = 0 ;
+    if (! readFile(topologyName(fileName, token), topology) || topology.size() < 8 ||
+        std::memcmp(&topology[0], CHECKPOINT_TOPOLOGY_MAGIC, 8) != 0 ||
+        ! get(topology, at, topologyToken) || ! get(topology, at, topologyMasses) ||
+        ! get(topology, at, numSprings) || topologyToken != token || topologyMasses != numMasses ||
+        numSprings < 0 || (uint64_t)numSprings > (topology.size() - at) / (5 * sizeof(double)) ||
+        topology.size() - at != (size_t)(numMasses * 8 + numSprings * 5) * sizeof(double)) {
+      std::cerr << "SpringMass: " << topologyName(fileName, token) << " is missing or does not match" << std::endl ;
+      return false ;
+    }
+
+    std::vector<Spring> springs ;
+    Mass * masses = (numMasses > 0) ? new Mass [numMasses] : NULL ;
+    for (int64_t i = 0 ; i < numMasses ; ++i) {
+      double mass, radius ;
+      Vector3 boxMin, boxMax ;
+      get(topology, at, mass) ;
+      get(topology, at, radius) ;
+      get(topology, at, boxMin) ;
+      get(topology, at, boxMax) ;
+      masses[i] = Mass(Vector3(), Vector3(), mass, radius) ;
+      masses[i].setBox(boxMin, boxMax) ;
+    }
+    for (int64_t s = 0 ; s < numSprings ; ++s) {
+      int64_t i1 = -1, i2 = -1 ;
+      double naturalLength, stiffness, damping ;
+      get(topology, at, i1) ;
+      get(topology, at, i2) ;
+      get(topology, at, naturalLength) ;
+      get(topology, at, stiffness) ;
+      get(topology, at, damping) ;
+      if (i1 < 0 || i1 >= numMasses || i2 < 0 || i2 >= numMasses) {
+        std::cerr << "SpringMass: " << topologyName(fileName, token) << " is corrupt" << std::endl ;
+        delete [] masses ;
+        return false ;
+      }
+      springs.push_back(Spring(masses + i1, masses + i2, naturalLength, stiffness, damping)) ;
+    }
+
+    clear() ;
+    if (masses) owned_blocks.push_back(masses) ;
+    spring_list.swap(springs) ;
+    for (int64_t i = 0 ; i < numMasses ; ++i) {
+      mass_list.push_back(masses + i) ;
+      mass_index[masses + i] = (int)i ;
+    }
+    checkpoint_version = topology_version ;
+    checkpoint_token = token ;
+    checkpoint_name = fileName ;
+  }
+
+  // islands are numbered from the topology, so a sleep state for
+  // another number of them cannot be this one
+  updateTopology() ;
+  if (numIslands > 0 && (size_t)numIslands != island_asleep.size()) {
+    std::cerr << "SpringMass: " << fileName << " has the sleep state of " << numIslands
+              << " islands, the topology has " << island_asleep.size() << std::endl ;
+    return false ;
+  }
+
+  time = _time ;
+  gravity = _gravity ;
+  invalidate() ;
+  for (std::vector<Mass *>::iterator it = mass_list.begin(); it != mass_list.end(); ++it) {
+    Vector3 position, velocity, force ;
+    get(state, offset, position) ;
+    get(state, offset, velocity) ;
+    get(state, offset, force) ;
+    (*it)->setState(position, velocity) ;
+    (*it)->setForce(force) ;
+  }
+
+  // islands go back to sleep with the energies they fell asleep with
+  setSleeping(sleepThreshold, (int)sleepSteps) ;
+  for (int64_t j = 0 ; j < numIslands ; ++j) {
+    int64_t asleep = 0, quietSteps = 0 ;
+    get(state, offset, asleep) ;
+    get(state, offset, quietSteps) ;
+    get(state, offset, island_potential[j]) ;
+    get(state, offset, island_elastic[j]) ;
+    get(state, offset, island_max_strain[j]) ;
+    island_asleep[j] = (asleep != 0) ;
+    island_quiet_steps[j] = (int)quietSteps ;
+    if (island_asleep[j]) ++ num_sleeping ;
+  }
+  updateSleepingTotals() ;
+  updateActive() ;
+  forces_valid = forcesValid != 0 && !pool && !deterministic ;
+  return true ;
+}
+
+/* ---------------------------------------------------------------- */
+// fused and parallel stepping
+/* ---------------------------------------------------------------- */
+
+// The step has three variants:
+//  serial         springs add their force to the masses directly
+//  scatter        (threads, not deterministic) each thread adds its
+//                 springs into a private buffer, summed per mass
+//  gather         (deterministic) spring forces go to an array and
+//                 each mass sums its springs in spring order, which is
+//                 the serial order whatever the number of threads
+// Energies are summed per fixed block of ENERGY_BLOCK elements and
+// the blocks reduced pairwise, except in the serial variant.
+
+#define STEP_GRAIN 4096
+#define ENERGY_BLOCK 1024
+
+static inline size_t numBlocks(size_t n) { return (n + ENERGY_BLOCK - 1) / ENERGY_BLOCK ; }
+
+static inline double strain(const Spring & spring, double elongation) {
+  double length = spring.getNaturalLength() ;
+  return std::fabs(elongation) / ((length > 0) ? length : 1) ;
+}
+
+// sum of the values in a fixed pairwise order, overwriting them
+static double pairwiseSum(double * values, size_t n) {
+  if (n == 0) return 0 ;
+  for (size_t stride = 1 ; stride < n ; stride *= 2) {
+    for (size_t i = 0 ; i + stride < n ; i += 2 * stride) {
+      values[i] += values[i + stride] ;
+    }
+  }
+  return values[0] ;
+}
+
+// the variants keep their forces in different places, so changing
+// variant evaluates them again; the state itself, and which islands
+// are asleep, do not change
+void SpringMass::setNumThreads(int numThreads) {
+  if (numThreads == getNumThreads()) return ;
+  delete pool ;
+  pool = (numThreads > 1) ? new ThreadPool(numThreads) : NULL ;
+  thread_forces.clear() ;
+  active_valid = false ;
+  forces_valid = false ;
+}
+
+int SpringMass::getNumThreads() const {
+  return pool ? pool->getNumThreads() : 1 ;
+}
+
+void SpringMass::setDeterministic(bool _deterministic) {
+  deterministic = _deterministic ;
+  forces_valid = false ;
+}
+
+bool SpringMass::isDeterministic() const {
+  return deterministic ;
+}
+
+void SpringMass::setIslandParallel(bool _island_parallel) {
+  island_parallel = _island_parallel ;
+  active_valid = false ;
+  forces_valid = false ;
+}
+
+bool SpringMass::isIslandParallel() const {
+  return island_parallel ;
+}
+
+void SpringMass::setIntegrator(Integrator _integrator) {
+  integrator = _integrator ;
+}
+
+Integrator SpringMass::getIntegrator() const {
+  return integrator ;
+}
+
+void SpringMass::parallelFor(size_t n, size_t grain, const std::function<void (size_t, size_t, int)> & body) {
+  if (pool) {
+    pool->parallelFor(n, grain, body) ;
+  } else if (n > 0) {
+    body(0, n, 0) ;
+  }
+}
+
+void SpringMass::updateTopology() {
+  if (topology_cache_version == topology_version) return ;
+  size_t numSprings = spring_list.size() ;
+  size_t numMasses = mass_list.size() ;
+
+  spring_mass1.resize(numSprings) ;
+  spring_mass2.resize(numSprings) ;
+  incident_offsets.assign(numMasses + 1, 0) ;
+  for (size_t s = 0 ; s < numSprings ; ++s) {
+    spring_mass1[s] = mass_index[spring_list[s].getMass1()] ;
+    spring_mass2[s] = mass_index[spring_list[s].getMass2()] ;
+    incident_offsets[spring_mass1[s] + 1] ++ ;
+    incident_offsets[spring_mass2[s] + 1] ++ ;
+  }
+  for (size_t i = 0 ; i < numMasses ; ++i) {
+    incident_offsets[i + 1] += incident_offsets[i] ;
+  }
+
+  // filling in spring order keeps every row sorted
+  std::vector<int> fill(incident_offsets.begin(), incident_offsets.end() - 1) ;
+  incident_springs.resize(2 * numSprings) ;
+  for (size_t s = 0 ; s < numSprings ; ++s) {
+    incident_springs[fill[spring_mass1[s]]++] = (int)s + 1 ;
+    incident_springs[fill[spring_mass2[s]]++] = -((int)s + 1) ;
+  }
+
+  spring_forces.resize(numSprings) ;
+  spring_elongation.resize(numSprings) ;
+  thread_forces.clear() ;
+  topology_cache_version = topology_version ;
+  forces_valid = false ;
+  energy_valid = false ;
+  updateIslands() ;
+}
+
+// union-find over the springs, each root being the smallest mass index
+// of its island, so that islands come numbered in mass order
+void SpringMass::updateIslands() {
+  size_t numSprings = spring_list.size() ;
+  size_t numMasses = mass_list.size() ;
+  std::vector<int> parent(numMasses) ;
+  for (size_t i = 0 ; i < numMasses ; ++i) parent[i] = (int)i ;
+  auto find = [&](int i) {
+    while (parent[i] != i) {
+      parent[i] = parent[parent[i]] ;
+      i = parent[i] ;
+    }
+    return i ;
+  } ;
+  for (size_t s = 0 ; s < numSprings ; ++s) {
+    int a = find(spring_mass1[s]) ;
+    int b = find(spring_mass2[s]) ;
+    if (a < b) parent[b] = a ;
+    else if (b < a) parent[a] = b ;
+  }
+
+  int numIslands = 0 ;
+  mass_island.resize(numMasses) ;
+  island_mass_offsets.assign(1, 0) ;
+  for (size_t i = 0 ; i < numMasses ; ++i) {
+    int root = find((int)i) ;
+    if (root == (int)i) {
+      mass_island[i] = numIslands++ ;
+      island_mass_offsets.push_back(0) ;
+    } else {
+      mass_island[i] = mass_island[root] ;
+    }
+    island_mass_offsets[mass_island[i] + 1] ++ ;
+  }
+  island_spring_offsets.assign(numIslands + 1, 0) ;
+  for (size_t s = 0 ; s < numSprings ; ++s) island_spring_offsets[mass_island[spring_mass1[s]] + 1] ++ ;
+  for (int j = 0 ; j < numIslands ; ++j) {
+    island_mass_offsets[j + 1] += island_mass_offsets[j] ;
+    island_spring_offsets[j + 1] += island_spring_offsets[j] ;
+  }
+  std::vector<int> fill(island_mass_offsets.begin(), island_mass_offsets.end() - 1) ;
+  island_masses.resize(numMasses) ;
+  for (size_t i = 0 ; i < numMasses ; ++i) island_masses[fill[mass_island[i]]++] = (int)i ;
+  fill.assign(island_spring_offsets.begin(), island_spring_offsets.end() - 1) ;
+  island_springs.resize(numSprings) ;
+  for (size_t s = 0 ; s < numSprings ; ++s) island_springs[fill[mass_island[spring_mass1[s]]]++] = (int)s ;
+
+  island_asleep.assign(numIslands, 0) ;
+  island_quiet_steps.assign(numIslands, 0) ;
+  island_potential.assign(numIslands, 0.0) ;
+  island_elastic.assign(numIslands, 0.0) ;
+  island_max_strain.assign(numIslands, 0.0) ;
+  num_sleeping = 0 ;
+  updateSleepingTotals() ;
+  active_valid = false ;
+}
+
+// the masses and springs of the islands awake, in the order of the
+// lists, so that with no island asleep the passes are the same; in
+// island-parallel mode, only those of the islands too large for a
+// task of their own
+void SpringMass::updateActive() {
+  size_t numIslands = island_asleep.size() ;
+  active_masses.clear() ;
+  active_springs.clear() ;
+  island_tasks.clear() ;
+  island_is_task.assign(numIslands, 0) ;
+  if (pool && island_parallel) {
+    std::vector<int> size(numIslands) ;
+    size_t work = 0 ;
+    for (size_t j = 0 ; j < numIslands ; ++j) {
+      size[j] = (island_mass_offsets[j + 1] - island_mass_offsets[j]) +
+                (island_spring_offsets[j + 1] - island_spring_offsets[j]) ;
+      if (!island_asleep[j]) work += size[j] ;
+    }
+    size_t giant = std::max((size_t)STEP_GRAIN, work / (2 * getNumThreads())) ;
+    for (size_t j = 0 ; j < numIslands ; ++j) {
+      if (!island_asleep[j] && (size_t)size[j] <= giant) {
+        island_tasks.push_back((int)j) ;
+        island_is_task[j] = 1 ;
+      }
+    }
+    std::stable_sort(island_tasks.begin(), island_tasks.end(), [&](int a, int b) { return size[a] > size[b] ; }) ;
+    island_kinetic.resize(numIslands) ;
+    island_momentum.resize(numIslands) ;
+    island_max_speed2.resize(numIslands) ;
+  }
+  for (size_t i = 0 ; i < mass_list.size() ; ++i) {
+    int j = mass_island[i] ;
+    if (!island_asleep[j] && !island_is_task[j]) active_masses.push_back((int)i) ;
+  }
+  for (size_t s = 0 ; s < spring_list.size() ; ++s) {
+    int j = mass_island[spring_mass1[s]] ;
+    if (!island_asleep[j] && !island_is_task[j]) active_springs.push_back((int)s) ;
+  }
+  active_valid = true ;
+  // the parallel passes keep spring forces apart from the masses, so
+  // an island moving between them and the tasks needs its forces again
+  forces_valid = false ;
+}
+
+// energies of the islands asleep, summed in island order
+void SpringMass::updateSleepingTotals() {
+  sleeping_potential = sleeping_elastic = sleeping_max_strain = 0 ;
+  if (num_sleeping == 0) return ;
+  for (size_t j = 0 ; j < island_asleep.size() ; ++j) {
+    if (!island_asleep[j]) continue ;
+    sleeping_potential += island_potential[j] ;
+    sleeping_elastic += island_elastic[j] ;
+    sleeping_max_strain = std::max(sleeping_max_strain, island_max_strain[j]) ;
+  }
+}
+
+// after a step: count the quiet steps of each island awake and put to
+// sleep those quiet for long enough, keeping their energies
+void SpringMass::updateSleeping() {
+  bool changed = false ;
+  for (size_t j = 0 ; j < island_asleep.size() ; ++j) {
+    if (island_asleep[j]) continue ;
+    int first = island_mass_offsets[j] ;
+    int last = island_mass_offsets[j + 1] ;
+    double kinetic = 0 ;
+    if (island_is_task[j]) {
+      kinetic = island_kinetic[j] ;
+    } else {
+      for (int k = first ; k < last ; ++k) kinetic += mass_list[island_masses[k]]->getKineticEnergy() ;
+    }
+    if (kinetic >= sleep_threshold * (last - first)) {
+      island_quiet_steps[j] = 0 ;
+      continue ;
+    }
+    if (++ island_quiet_steps[j] < sleep_steps) continue ;
+
+    double potential = 0 ;
+    Vector3 p ;
+    for (int k = first ; k < last ; ++k) {
+      int i = island_masses[k] ;
+      Mass * mass = mass_list[i] ;
+      p = p + mass->getMass() * mass->getVelocity() ;
+      mass->setState(mass->getPosition(), Vector3()) ;
+      potential += mass->getPotentialEnergy(gravity) ;
+      if (!sample_velocities.empty()) {
+        Vector3 x = mass->getPosition() ;
+        double * position = &sample_positions[3 * i] ;
+        position[0] = x.x ; position[1] = x.y ; position[2] = x.z ;
+        std::fill(&sample_velocities[3 * i], &sample_velocities[3 * i] + 3, 0.0) ;
+      }
+    }
+    double elastic = 0 ;
+    double maxStrain = 0 ;
+    for (int k = island_spring_offsets[j] ; k < island_spring_offsets[j + 1] ; ++k) {
+      int s = island_springs[k] ;
+      double dl = spring_elongation[s] ;
+      elastic += 0.5 * spring_list[s].getStiffness() * dl * dl ;
+      maxStrain = std::max(maxStrain, strain(spring_list[s], dl)) ;
+    }
+    island_potential[j] = potential ;
+    island_elastic[j] = elastic ;
+    island_max_strain[j] = maxStrain ;
+    island_asleep[j] = 1 ;
+    ++ num_sleeping ;
+    kinetic_energy -= kinetic ;
+    momentum = momentum - p ;
+    changed = true ;
+  }
+  if (changed) {
+    updateSleepingTotals() ;
+    active_valid = false ;
+  }
+}
+
+void SpringMass::resetForces() {
+  if (pool || deterministic) return ; // forces are assembled by massPass
+  PROFILE_SCOPE(PHASE_FORCE_RESET) ;
   Vector3 g(0, -gravity, 0) ;
   for (std::vector<Mass *>::iterator it = mass_list.begin(); it != mass_list.end(); ++it) {
     (*it) -> setForce(g * (*it)->getMass());
-  } 
-  
+  }
+}
 
-  // get spring force and add force
-  for (std::vector<Spring>::iterator it = spring_list.begin(); it != spring_list.end(); ++it) {
-    // get mass
-    Mass * mass1 = (*it).getMass1();
-    Mass * mass2 = (*it).getMass2();
+void SpringMass::springPass() {
+  PROFILE_SCOPE(PHASE_SPRING_FORCES) ;
+  size_t numSprings = active_springs.size() ;
+  size_t numMasses = active_masses.size() ;
+  const int * springs = active_springs.data() ;
+  const int * masses = active_masses.data() ;
+
+  if (!pool && !deterministic) {
+    double elastic = 0 ;
+    double maxStrain = 0 ;
+    for (size_t k = 0 ; k < numSprings ; ++k) {
+      int s = springs[k] ;
+      const Spring & spring = spring_list[s] ;
+      double length ;
+      Vector3 F1 = spring.getForce(length) ;
+      spring.getMass1() -> addForce(F1) ;
+      spring.getMass2() -> addForce(-1 * F1) ;
+      double dl = length - spring.getNaturalLength() ;
+      spring_elongation[s] = dl ;
+      elastic += 0.5 * spring.getStiffness() * dl * dl ;
+      maxStrain = std::max(maxStrain, strain(spring, dl)) ;
+    }
+    elastic_energy = elastic + sleeping_elastic ;
+    max_strain = std::max(maxStrain, sleeping_max_strain) ;
+    return ;
+  }
 
-    // get force
-    Vector3 F1 = (*it).getForce();
-    Vector3 F2 = -1 * F1;
-    
-    // add force to mass
-    mass1 -> addForce(F1);
-    mass2 -> addForce(F2);
+  if (deterministic) {
+    size_t springBlocks = numBlocks(numSprings) ;
+    block_energy.resize(springBlocks) ;
+    block_max.resize(springBlocks) ;
+    parallelFor(springBlocks, STEP_GRAIN / ENERGY_BLOCK, [&](size_t begin, size_t end, int) {
+      for (size_t b = begin ; b < end ; ++b) {
+        size_t last = std::min(numSprings, (b + 1) * ENERGY_BLOCK) ;
+        double elastic = 0 ;
+        double maxStrain = 0 ;
+        for (size_t k = b * ENERGY_BLOCK ; k < last ; ++k) {
+          int s = springs[k] ;
+          const Spring & spring = spring_list[s] ;
+          double length ;
+          spring_forces[s] = spring.getForce(length) ;
+          double dl = length - spring.getNaturalLength() ;
+          spring_elongation[s] = dl ;
+          elastic += 0.5 * spring.getStiffness() * dl * dl ;
+          maxStrain = std::max(maxStrain, strain(spring, dl)) ;
+        }
+        block_energy[b] = elastic ;
+        block_max[b] = maxStrain ;
+      }
+    }) ;
+    elastic_energy = pairwiseSum(block_energy.data(), springBlocks) + sleeping_elastic ;
+    max_strain = sleeping_max_strain ;
+    for (size_t b = 0 ; b < springBlocks ; ++b) max_strain = std::max(max_strain, block_max[b]) ;
+    return ;
   }
 
+  // scatter into per-thread buffers
+  int numThreads = getNumThreads() ;
+  thread_forces.resize(numThreads) ;
+  for (int t = 0 ; t < numThreads ; ++t) thread_forces[t].resize(mass_list.size()) ;
+  std::vector<double> elastic(numThreads, 0.0) ;
+  std::vector<double> maxStrain(numThreads, 0.0) ;
+  parallelFor(numMasses, STEP_GRAIN, [&](size_t begin, size_t end, int) {
+    for (int t = 0 ; t < numThreads ; ++t) {
+      for (size_t k = begin ; k < end ; ++k) thread_forces[t][masses[k]] = Vector3() ;
+    }
+  }) ;
+  parallelFor(numSprings, STEP_GRAIN, [&](size_t begin, size_t end, int thread) {
+    std::vector<Vector3> & forces = thread_forces[thread] ;
+    for (size_t k = begin ; k < end ; ++k) {
+      int s = springs[k] ;
+      const Spring & spring = spring_list[s] ;
+      double length ;
+      Vector3 F1 = spring.getForce(length) ;
+      forces[spring_mass1[s]] = forces[spring_mass1[s]] + F1 ;
+      forces[spring_mass2[s]] = forces[spring_mass2[s]] - F1 ;
+      double dl = length - spring.getNaturalLength() ;
+      spring_elongation[s] = dl ;
+      elastic[thread] += 0.5 * spring.getStiffness() * dl * dl ;
+      maxStrain[thread] = std::max(maxStrain[thread], strain(spring, dl)) ;
+    }
+  }) ;
+  elastic_energy = sleeping_elastic ;
+  max_strain = sleeping_max_strain ;
+  for (int t = 0 ; t < numThreads ; ++t) {
+    elastic_energy += elastic[t] ;
+    max_strain = std::max(max_strain, maxStrain[t]) ;
+  }
+}
 
-  // update
-  for (std::vector<Mass *>::iterator it = mass_list.begin(); it != mass_list.end(); ++it) {
-    (*it) -> step(dt);
-  } 
-  
+void SpringMass::massPass(double dt) {
+  PROFILE_SCOPE(PHASE_INTEGRATION) ;
+  const Vector3 g(0, -gravity, 0) ;
+  size_t numMasses = active_masses.size() ;
+  const int * masses = active_masses.data() ;
+
+  if (!pool && !deterministic) {
+    // the force reset for the next spring pass rides along
+    double kinetic = 0 ;
+    double potential = 0 ;
+    Vector3 p ;
+    double maxSpeed2 = 0 ;
+    for (size_t k = 0 ; k < numMasses ; ++k) {
+      int i = masses[k] ;
+      Mass * mass = mass_list[i] ;
+      mass -> step(dt, integrator);
+      kinetic += mass -> getKineticEnergy();
+      potential += mass -> getPotentialEnergy(gravity);
+      Vector3 v = mass -> getVelocity() ;
+      p = p + mass->getMass() * v ;
+      maxSpeed2 = std::max(maxSpeed2, v.norm2()) ;
+      if (sampling) {
+        Vector3 x = mass -> getPosition() ;
+        double * position = &sample_positions[3 * i] ;
+        double * velocity = &sample_velocities[3 * i] ;
+        position[0] = x.x ; position[1] = x.y ; position[2] = x.z ;
+        velocity[0] = v.x ; velocity[1] = v.y ; velocity[2] = v.z ;
+      }
+      mass -> setForce(g * mass->getMass());
+    }
+    kinetic_energy = kinetic ;
+    potential_energy = potential + sleeping_potential ;
+    momentum = p ;
+    max_speed2 = maxSpeed2 ;
+    return ;
+  }
+
+  // blocks of ENERGY_BLOCK masses: kinetic sums, then potential sums
+  size_t massBlocks = numBlocks(numMasses) ;
+  int numThreads = getNumThreads() ;
+  block_energy.resize(2 * massBlocks) ;
+  block_momentum.resize(massBlocks) ;
+  block_max.resize(massBlocks) ;
+  parallelFor(massBlocks, STEP_GRAIN / ENERGY_BLOCK, [&](size_t begin, size_t end, int) {
+    for (size_t b = begin ; b < end ; ++b) {
+      size_t last = std::min(numMasses, (b + 1) * ENERGY_BLOCK) ;
+      double kinetic = 0 ;
+      double potential = 0 ;
+      Vector3 p ;
+      double maxSpeed2 = 0 ;
+      for (size_t k = b * ENERGY_BLOCK ; k < last ; ++k) {
+        int i = masses[k] ;
+        Mass * mass = mass_list[i] ;
+        Vector3 force = g * mass->getMass() ;
+        if (deterministic) {
+          for (int j = incident_offsets[i] ; j < incident_offsets[i + 1] ; ++j) {
+            int s = incident_springs[j] ;
+            force = force + ((s > 0) ? spring_forces[s - 1] : -1 * spring_forces[-s - 1]) ;
+          }
+        } else {
+          for (int t = 0 ; t < numThreads ; ++t) force = force + thread_forces[t][i] ;
+        }
+        mass->setForce(force) ;
+        mass->step(dt, integrator) ;
+        kinetic += mass->getKineticEnergy() ;
+        potential += mass->getPotentialEnergy(gravity) ;
+        Vector3 v = mass->getVelocity() ;
+        p = p + mass->getMass() * v ;
+        maxSpeed2 = std::max(maxSpeed2, v.norm2()) ;
+        if (sampling) {
+          Vector3 x = mass->getPosition() ;
+          double * position = &sample_positions[3 * i] ;
+          double * velocity = &sample_velocities[3 * i] ;
+          position[0] = x.x ; position[1] = x.y ; position[2] = x.z ;
+          velocity[0] = v.x ; velocity[1] = v.y ; velocity[2] = v.z ;
+        }
+      }
+      block_energy[b] = kinetic ;
+      block_energy[massBlocks + b] = potential ;
+      block_momentum[b] = p ;
+      block_max[b] = maxSpeed2 ;
+    }
+  }) ;
+  kinetic_energy = pairwiseSum(block_energy.data(), massBlocks) ;
+  potential_energy = pairwiseSum(block_energy.data() + massBlocks, massBlocks) + sleeping_potential ;
+  momentum = Vector3() ;
+  max_speed2 = 0 ;
+  for (size_t b = 0 ; b < massBlocks ; ++b) {
+    momentum = momentum + block_momentum[b] ;
+    max_speed2 = std::max(max_speed2, block_max[b]) ;
+  }
+}
+
+// island-parallel mode: each task steps one island as massPass and
+// springPass do serially (computing its forces first if they are not
+// valid), then the islands are reduced in island order
+void SpringMass::islandPass(double dt, bool forces_were_valid) {
+  PROFILE_SCOPE(PHASE_INTEGRATION) ;
+  const Vector3 g(0, -gravity, 0) ;
+  pool->parallelFor(island_tasks.size(), 1, [&](size_t begin, size_t end, int) {
+    for (size_t t = begin ; t < end ; ++t) {
+      int j = island_tasks[t] ;
+      const int * masses = island_masses.data() + island_mass_offsets[j] ;
+      const int * springs = island_springs.data() + island_spring_offsets[j] ;
+      int numMasses = island_mass_offsets[j + 1] - island_mass_offsets[j] ;
+      int numSprings = island_spring_offsets[j + 1] - island_spring_offsets[j] ;
+
+      if (!forces_were_valid) {
+        for (int k = 0 ; k < numMasses ; ++k) {
+          Mass * mass = mass_list[masses[k]] ;
+          mass -> setForce(g * mass->getMass()) ;
+        }
+        for (int k = 0 ; k < numSprings ; ++k) {
+          const Spring & spring = spring_list[springs[k]] ;
+          Vector3 F1 = spring.getForce() ;
+          spring.getMass1() -> addForce(F1) ;
+          spring.getMass2() -> addForce(-1 * F1) ;
+        }
+      }
+
+      double kinetic = 0 ;
+      double potential = 0 ;
+      Vector3 p ;
+      double maxSpeed2 = 0 ;
+      for (int k = 0 ; k < numMasses ; ++k) {
+        int i = masses[k] ;
+        Mass * mass = mass_list[i] ;
+        mass -> step(dt, integrator) ;
+        kinetic += mass -> getKineticEnergy() ;
+        potential += mass -> getPotentialEnergy(gravity) ;
+        Vector3 v = mass -> getVelocity() ;
+        p = p + mass->getMass() * v ;
+        maxSpeed2 = std::max(maxSpeed2, v.norm2()) ;
+        if (sampling) {
+          Vector3 x = mass -> getPosition() ;
+          double * position = &sample_positions[3 * i] ;
+          double * velocity = &sample_velocities[3 * i] ;
+          position[0] = x.x ; position[1] = x.y ; position[2] = x.z ;
+          velocity[0] = v.x ; velocity[1] = v.y ; velocity[2] = v.z ;
+        }
+        mass -> setForce(g * mass->getMass()) ;
+      }
+
+      double elastic = 0 ;
+      double maxStrain = 0 ;
+      for (int k = 0 ; k < numSprings ; ++k) {
+        int s = springs[k] ;
+        const Spring & spring = spring_list[s] ;
+        double length ;
+        Vector3 F1 = spring.getForce(length) ;
+        spring.getMass1() -> addForce(F1) ;
+        spring.getMass2() -> addForce(-1 * F1) ;
+        double dl = length - spring.getNaturalLength() ;
+        spring_elongation[s] = dl ;
+        elastic += 0.5 * spring.getStiffness() * dl * dl ;
+        maxStrain = std::max(maxStrain, strain(spring, dl)) ;
+      }
+
+      island_kinetic[j] = kinetic ;
+      island_potential[j] = potential ;
+      island_elastic[j] = elastic ;
+      island_momentum[j] = p ;
+      island_max_speed2[j] = maxSpeed2 ;
+      island_max_strain[j] = maxStrain ;
+    }
+  }) ;
+
+  for (size_t j = 0 ; j < island_is_task.size() ; ++j) {
+    if (!island_is_task[j]) continue ;
+    kinetic_energy += island_kinetic[j] ;
+    potential_energy += island_potential[j] ;
+    elastic_energy += island_elastic[j] ;
+    momentum = momentum + island_momentum[j] ;
+    max_speed2 = std::max(max_speed2, island_max_speed2[j]) ;
+    max_strain = std::max(max_strain, island_max_strain[j]) ;
+  }
+}
+
+// energies of the current state without stepping
+void SpringMass::computeEnergy() {
+  size_t numMasses = mass_list.size() ;
+  size_t numSprings = spring_list.size() ;
+  size_t massBlocks = numBlocks(numMasses) ;
+  size_t springBlocks = numBlocks(numSprings) ;
+  std::vector<double> sums(2 * massBlocks + springBlocks, 0.0) ;
+  parallelFor(massBlocks + springBlocks, STEP_GRAIN / ENERGY_BLOCK, [&](size_t begin, size_t end, int) {
+    for (size_t b = begin ; b < end ; ++b) {
+      if (b < massBlocks) {
+        size_t last = std::min(numMasses, (b + 1) * ENERGY_BLOCK) ;
+        for (size_t i = b * ENERGY_BLOCK ; i < last ; ++i) {
+          sums[b] += mass_list[i]->getKineticEnergy() ;
+          sums[massBlocks + b] += mass_list[i]->getPotentialEnergy(gravity) ;
+        }
+      } else {
+        size_t first = (b - massBlocks) * ENERGY_BLOCK ;
+        size_t last = std::min(numSprings, first + ENERGY_BLOCK) ;
+        for (size_t s = first ; s < last ; ++s) sums[massBlocks + b] += spring_list[s].getEnergy() ;
+      }
+    }
+  }) ;
+  kinetic_energy = pairwiseSum(sums.data(), massBlocks) ;
+  potential_energy = pairwiseSum(sums.data() + massBlocks, massBlocks) ;
+  elastic_energy = pairwiseSum(sums.data() + 2 * massBlocks, springBlocks) ;
+  energy_valid = true ;
 }
@@ -7,8 +7,13 @@
 #define __springmass__
 
 #include "simulation.h"
+#include "seqlock.h"
 
 #include <cmath>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <initializer_list>
 
@@ -16,6 +21,12 @@
 #define MOON_GRAVITY 1.62
 #define EARTH_GRAVITY 9.82
 
+// time integration of a mass over one step
+enum Integrator {
+  CONSTANT_ACCELERATION,  // exact for a constant force (the original)
+  SYMPLECTIC_EULER        // velocity first, then position with the new velocity
+} ;
+
 /* ---------------------------------------------------------------- */
 // class Vector2
 /* ---------------------------------------------------------------- */
@@ -51,13 +62,19 @@ class Mass {
     Mass(Vector3 position, Vector3 velocity, double mass, double radius) ;
     void setForce(Vector3 f) ;
     void addForce(Vector3 f) ;
+    void setState(Vector3 position, Vector3 velocity) ;
+    void setBox(Vector3 boxMin, Vector3 boxMax) ;
     Vector3 getForce() const ;
     Vector3 getPosition() const ;
     Vector3 getVelocity() const ;
     double getMass() const ;
     double getRadius() const ;
     double getEnergy(double gravity) const ;
-    void step(double dt) ;
+    double getKineticEnergy() const ;
+    double getPotentialEnergy(double gravity) const ;
+    Vector3 getBoxMin() const ;
+    Vector3 getBoxMax() const ;
+    void step(double dt, Integrator integrator = CONSTANT_ACCELERATION) ;
 
     double getScaledR();
 
@@ -86,9 +103,12 @@ class Spring {
     Mass * getMass1() const ;
     Mass * getMass2() const ;
     Vector3 getForce() const ;
+    Vector3 getForce(double & length) const ;
     double getLength() const ;
     double getEnergy() const ;
     double getStiffness() const;
+    double getNaturalLength() const ;
+    double getDamping() const ;
 
   protected:
 
@@ -101,27 +121,208 @@ class Spring {
 
 } ;
 
+class ThreadPool ;
+class TextWriter ;
+
+/* ---------------------------------------------------------------- */
+// struct Diagnostics
+/* ---------------------------------------------------------------- */
+
+// Summary of the state left by SpringMass::step, gathered by the step
+// passes themselves. The strain of a spring is its elongation over its
+// natural length.
+struct Diagnostics {
+  long steps ;
+  double time ;
+  double energy ;
+  double kinetic ;
+  double potential ;
+  double elastic ;
+  Vector3 momentum ;
+  double maxSpeed ;
+  double maxStrain ;
+} ;
+
+/* ---------------------------------------------------------------- */
+// struct StateView
+/* ---------------------------------------------------------------- */
+
+// Read-only view of the state after a step, handed to observers:
+// x y z triplets in the order of SpringMass::getMassList(). The
+// arrays belong to the simulation and are only valid during the call.
+struct StateView {
+  long step ;
+  double time ;
+  int numMasses ;
+  const double * positions ;
+  const double * velocities ;
+} ;
+
+typedef std::function<void (const StateView &)> StepObserver ;
+
+/* ---------------------------------------------------------------- */
+// struct ReorderReport
+/* ---------------------------------------------------------------- */
+
+// What SpringMass::reorder changed. The span is the mean distance
+// between the indices of the two ends of a spring. The misses are
+// those of one step's walk over the masses and springs, simulated on
+// a fully associative LRU cache of REORDER_CACHE_LINES lines of
+// REORDER_LINE_SIZE bytes, a proxy for the real cache misses.
+#define REORDER_LINE_SIZE 64
+#define REORDER_CACHE_LINES 4096
+
+enum Ordering {
+  REVERSE_CUTHILL_MCKEE,  // breadth first over the springs, reversed
+  MORTON                  // Z-order of the positions
+} ;
+
+struct ReorderReport {
+  double spanBefore ;
+  double spanAfter ;
+  long missesBefore ;
+  long missesAfter ;
+  bool relocated ;
+} ;
+
 /* ---------------------------------------------------------------- */
-// class SpringMass : public Simulation
+// class SpringMass : public StaticSimulation<SpringMass>
 /* ---------------------------------------------------------------- */
 
-class SpringMass : public Simulation {
+class SpringMass : public StaticSimulation<SpringMass> {
   public:
     // constructor
     SpringMass();
+    virtual ~SpringMass();
 
     // add elements
     void addSpring(std::vector<Spring> more_springs);
     void setGravity(double _gravity);
     
     // simulation
+    // step() ends by evaluating the forces of the state it produced and
+    // keeps them for the next step, so after a step Mass::getForce()
+    // returns the forces the next step will integrate with, not those
+    // of the step just taken. stepN() checks the topology and the
+    // cached forces once and publishes the diagnostics once, at the end
     void step(double dt) ;
+    void stepN(double dt, long n) ;
     void display() ;
 
     // calculation
+    // step() leaves the energies of the new state behind, so these are
+    // O(1) right after a step
     double getEnergy() ;
+    double getKineticEnergy() ;
+    double getPotentialEnergy() ;
+    double getElasticEnergy() ;
+
+    // forces are evaluated at the end of step() for the state it
+    // produced; call this after changing a mass directly
+    void invalidate() ;
+
+    // diagnostics of the last step, published by step() when it is
+    // done; safe to call from any thread while another one steps,
+    // without locking or touching the masses (all zero before the
+    // first step)
+    Diagnostics getDiagnostics() const ;
+
+    // observers are called on the stepping thread after every every-th
+    // step (counted from the first step); the mass pass of those steps
+    // also writes positions and velocities to contiguous arrays, which
+    // the observers see without any further copy. Returns an id for
+    // removeObserver, which an observer may also call, on itself too.
+    int addObserver(const StepObserver & observer, long every = 1) ;
+    void removeObserver(int id) ;
+
+    // time step
+    // The largest dt for which symplectic Euler stays stable on the
+    // springs linearized about the current state, infinity if nothing
+    // constrains it. Each spring alone gives sqrt(stiffness / reduced
+    // mass) and its damping rate; since springs sharing a mass stiffen
+    // each other, powerIterations > 0 also estimates the largest
+    // eigenvalue of the whole stiffness operator, which is sharper
+    // (about half the per-spring bound for a cloth). The power estimate
+    // approaches that eigenvalue from below, so use a safety factor.
+    // The constant acceleration integrator gains some energy at any
+    // dt and has no such bound; this one still sets its scale.
+    // The result is cached: addSpring() only adds the new springs to
+    // it and invalidate() starts over (call it after changing a mass);
+    // the power iteration restarts from its previous vector.
+    double getStableTimeStep(int powerIterations = 0) ;
+
+    // islands and sleeping
+    // Islands are the connected components of the spring graph. With a
+    // threshold > 0, an island whose kinetic energy per mass stays below
+    // it for the given number of consecutive steps goes to sleep: its
+    // velocities are zeroed and step() skips its masses and springs,
+    // counting its energies as they were when it fell asleep. Islands
+    // wake up on invalidate() (a mass or a parameter changed, e.g. the
+    // gravity), when springs are added, or on wake(), for instance when
+    // something hits them.
+    void setSleeping(double threshold, int steps = 60) ;
+    int getNumIslands() ;
+    int getNumSleepingIslands() const ;
+    void wake(const Mass * mass) ;
+    void wakeAll() ;
+
+    // renumbering
+    // Renumbers the masses so that the ends of each spring are close
+    // in the mass list, then sorts the springs by their ends. Reverse
+    // Cuthill-McKee follows the springs and suits any scene; Morton
+    // follows the positions, so for a deforming scene it can be run
+    // again every so often. With relocate, the masses are also copied
+    // into a single block owned by the simulation, in the new order,
+    // so that memory follows the numbering: pointers to masses taken
+    // before (getMassList(), or the caller's own masses) then no
+    // longer refer to the simulated ones. Either way the mass order of
+    // outputs changes, and forces are summed in a different order, so
+    // trajectories change in the last digits. Islands asleep stay
+    // asleep.
+    ReorderReport reorder(Ordering ordering = REVERSE_CUTHILL_MCKEE, bool relocate = true) ;
+
+    // state
+    // The masses may be changed through getMassList(), but the next
+    // step only sees the change after invalidate(): until then it uses
+    // the forces cached for the old state (and sleeping islands stay
+    // asleep)
+    double getTime() const ;
+    int getNumMasses() const ;
+    const std::vector<Mass *> & getMassList() const ;
+    const std::vector<Spring> & getSpringList() const ;
 
     void loadSample();
+    void loadCloth(int rows, int columns);
+    void loadClusters(int count);
+
+    // checkpoint and restart
+    // The sleeping parameters and the sleep state of the islands are
+    // saved and restored with the masses, so a restart with sleeping on
+    // continues the same trajectory.
+    bool saveCheckpoint(std::string fileName);
+    bool restoreCheckpoint(std::string fileName);
+
+    // parallel stepping
+    // In deterministic mode each mass sums its spring forces in spring
+    // order and energies are reduced over fixed blocks, so the result
+    // does not depend on the number of threads (and the trajectory is
+    // the same as the serial one).
+    void setNumThreads(int numThreads);
+    int getNumThreads() const;
+    void setDeterministic(bool _deterministic);
+    bool isDeterministic() const;
+
+    // With threads, island-parallel mode steps each island as a whole,
+    // serially, in a task of its own: tasks go largest first to the
+    // pool, and islands too large to balance that way go through the
+    // parallel passes above instead. An island's trajectory is then the
+    // serial one and its energies are reduced in island order, so only
+    // the large islands depend on setDeterministic().
+    void setIslandParallel(bool _island_parallel);
+    bool isIslandParallel() const;
+
+    void setIntegrator(Integrator _integrator);
+    Integrator getIntegrator() const;
 
   protected:
 
@@ -129,8 +330,135 @@ class SpringMass : public Simulation {
     std::vector<Mass * > mass_list;
     
     double gravity;
+    double time;
+    Integrator integrator;
+
+    // masses created by the simulation itself (e.g. by restoreCheckpoint),
+    // deleted with it
+    std::vector<Mass *> owned_blocks;
+    Mass * allocateMasses(int n);
+    void clear();
+
+    // bumped whenever masses or springs change, so that a checkpoint
+    // knows when the topology must be written again
+    long topology_version;
+    long checkpoint_version;
+    uint64_t checkpoint_token;
+    std::string checkpoint_name;
+    
+    // parallel stepping state, rebuilt lazily when the topology changes:
+    // mass index of each spring endpoint and, for each mass, the
+    // springs attached to it in increasing order (compressed rows,
+    // entry s + 1 if the mass is the first endpoint, -(s + 1) otherwise)
+    std::unordered_map<const Mass *, int> mass_index;
+    std::vector<int> spring_mass1;
+    std::vector<int> spring_mass2;
+    std::vector<int> incident_offsets;
+    std::vector<int> incident_springs;
+    std::vector<Vector3> spring_forces;
+    std::vector<std::vector<Vector3> > thread_forces;
+    long topology_cache_version;
+    ThreadPool * pool;
+    bool deterministic;
+    TextWriter * display_writer;
+
+    // fused step: a mass pass integrates and accumulates kinetic and
+    // potential energy, then a spring pass evaluates the forces of the
+    // new state, caching each spring's elongation (for the strain of
+    // islands put to sleep) and accumulating the elastic energy
+    std::vector<double> spring_elongation;
+    std::vector<double> block_energy;
+    double kinetic_energy;
+    double potential_energy;
+    double elastic_energy;
+    std::vector<Vector3> block_momentum;
+    std::vector<double> block_max;
+    Vector3 momentum;
+    double max_speed2;
+    double max_strain;
+    long num_steps;
+    Seqlock<Diagnostics> diagnostics;
+
+    // observers and the arrays they see, filled by massPass when
+    // sampling is set
+    struct ObserverEntry {
+      int id;
+      long every;
+      StepObserver observer;
+    };
+    std::vector<ObserverEntry> observers;
+    int next_observer_id;
+    std::vector<double> sample_positions;
+    std::vector<double> sample_velocities;
+    bool sampling;
+
+    // stable time step: the per-spring bound over the first
+    // timestep_springs springs, and the largest damping rate among
+    // them; the power estimate of the largest eigenvalue and its vector
+    size_t timestep_springs;
+    double timestep_bound;
+    double timestep_damping;
+    std::vector<double> timestep_vector;
+    double timestep_eigenvalue;
+    int timestep_iterations;
+
+    // islands, rebuilt with the topology: the island of each mass and,
+    // for each island, its masses and springs (compressed rows, in
+    // mass and spring order); the passes only visit the active masses
+    // and springs, those of the islands awake
+    std::vector<int> mass_island;
+    std::vector<int> island_mass_offsets;
+    std::vector<int> island_masses;
+    std::vector<int> island_spring_offsets;
+    std::vector<int> island_springs;
+    std::vector<char> island_asleep;
+    std::vector<int> island_quiet_steps;
+    std::vector<double> island_potential;
+    std::vector<double> island_elastic;
+    std::vector<double> island_max_strain;
+    std::vector<int> active_masses;
+    std::vector<int> active_springs;
+    bool active_valid;
+
+    // island-parallel mode: the islands stepped as tasks, largest
+    // first, and what each of them adds to the energies and diagnostics
+    bool island_parallel;
+    std::vector<int> island_tasks;
+    std::vector<char> island_is_task;
+    std::vector<double> island_kinetic;
+    std::vector<Vector3> island_momentum;
+    std::vector<double> island_max_speed2;
+    double sleep_threshold;
+    int sleep_steps;
+    int num_sleeping;
+    double sleeping_potential;
+    double sleeping_elastic;
+    double sleeping_max_strain;
+    bool forces_valid;
+    bool energy_valid;
+
+    void updateTopology();
+    void updateIslands();
+    void updateActive();
+    void updateSleeping();
+    void updateSleepingTotals();
+    void parallelFor(size_t n, size_t grain, const std::function<void (size_t, size_t, int)> & body);
+    void resetForces();
+    void springPass();
+    void massPass(double dt);
+    void islandPass(double dt, bool forces_were_valid);
+    double getSpan() const;
+    long simulateCacheMisses() const;
+    void computeEnergy();
+    void publishDiagnostics();
+    bool isSampleDue(long step) const;
+    void notifyObservers();
     
     void addMass(Spring);
+
+  private:
+    SpringMass(const SpringMass &);
+    SpringMass & operator= (const SpringMass &);
 } ;
 
 #endif /* defined(__springmass__) */
@@ -1,6 +1,12 @@
-ball = load("springmass.txt");
-plot(ball(:, 1), ball(:, 2), ball(:, 3), ball(:, 4))
+% springmass.csv from trajectory-slice: the time, then x,y,z of each
+% mass; springmass.txt from test-springmass: x,y,z of each mass
+if exist('springmass.csv', 'file')
+    springmass = load('springmass.csv');
+    springmass = springmass(:, 2:end);
+else
+    springmass = load('springmass.txt');
+end
+plot(springmass(:, 1:3:end), springmass(:, 2:3:end))
 axis square
 xlim([-1, 1])
-ylim([-1, 1])
-
+ylim([-1, 1])
\ No newline at end of file
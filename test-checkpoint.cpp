@@ -0,0 +1,208 @@
+/** file: test-checkpoint.cpp
+ ** brief: Tests checkpoint and restart of SpringMass
+ **/
+
+#include "springmass.h"
+#include "testing.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static std::vector<Vector3> positions(const SpringMass & springmass) {
+  std::vector<Vector3> result ;
+  for (int i = 0 ; i < springmass.getNumMasses() ; ++i) {
+    result.push_back(springmass.getMassList()[i]->getPosition()) ;
+  }
+  return result ;
+}
+
+static std::vector<Vector3> forces(const SpringMass & springmass) {
+  std::vector<Vector3> result ;
+  for (int i = 0 ; i < springmass.getNumMasses() ; ++i) {
+    result.push_back(springmass.getMassList()[i]->getForce()) ;
+  }
+  return result ;
+}
+
+static bool sameBits(const std::vector<Vector3> & a, const std::vector<Vector3> & b) {
+  return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(Vector3)) == 0 ;
+}
+
+// the topology file that the checkpoint fileName refers to
+static std::string topologyOf(std::string fileName) {
+  uint64_t token = 0 ;
+  FILE * file = std::fopen(fileName.c_str(), "rb") ;
+  if (file) {
+    std::fseek(file, 8, SEEK_SET) ;
+    if (std::fread(&token, sizeof(token), 1, file) != 1) token = 0 ;
+    std::fclose(file) ;
+  }
+  char suffix [32] ;
+  std::snprintf(suffix, sizeof(suffix), ".topology.%016llx", (unsigned long long)token) ;
+  return fileName + suffix ;
+}
+
+static bool exists(std::string fileName) {
+  FILE * file = std::fopen(fileName.c_str(), "rb") ;
+  if (file) std::fclose(file) ;
+  return file != NULL ;
+}
+
+// overwrites the int64 at offset in fileName
+static bool patch(std::string fileName, long offset, int64_t value) {
+  FILE * file = std::fopen(fileName.c_str(), "r+b") ;
+  if (!file) return false ;
+  bool ok = std::fseek(file, offset, SEEK_SET) == 0 && std::fwrite(&value, sizeof(value), 1, file) == 1 ;
+  return (std::fclose(file) == 0) && ok ;
+}
+
+static bool copyFile(std::string from, std::string to, long truncate = -1) {
+  FILE * in = std::fopen(from.c_str(), "rb") ;
+  if (!in) return false ;
+  std::vector<char> data ;
+  char buffer [4096] ;
+  size_t n ;
+  while ((n = std::fread(buffer, 1, sizeof(buffer), in)) > 0) data.insert(data.end(), buffer, buffer + n) ;
+  std::fclose(in) ;
+  if (truncate >= 0 && (size_t)truncate < data.size()) data.resize(truncate) ;
+  FILE * out = std::fopen(to.c_str(), "wb") ;
+  if (!out) return false ;
+  bool ok = std::fwrite(data.data(), 1, data.size(), out) == data.size() ;
+  return (std::fclose(out) == 0) && ok ;
+}
+
+int main(int argc, char** argv) {
+  const double dt = 1.0/240 ;
+  const std::string name = "test-checkpoint.ck" ;
+  const std::string other = "test-checkpoint-other.ck" ;
+  int failures = 0 ;
+
+  // straight through
+  SpringMass reference ;
+  reference.loadCloth(12, 12) ;
+  for (int i = 0 ; i < 300 ; ++i) reference.step(dt) ;
+
+  // stopped at 120, restored into a new simulation, continued
+  std::string firstTopology ;
+  std::vector<Vector3> saved ;
+  {
+    SpringMass springmass ;
+    springmass.loadCloth(12, 12) ;
+    for (int i = 0 ; i < 120 ; ++i) springmass.step(dt) ;
+    report("save", springmass.saveCheckpoint(name), failures) ;
+    firstTopology = topologyOf(name) ;
+    saved = forces(springmass) ;
+  }
+  SpringMass restored ;
+  report("restore", restored.restoreCheckpoint(name), failures) ;
+  report("forces restored", sameBits(forces(restored), saved), failures) ;
+  for (int i = 120 ; i < 300 ; ++i) restored.step(dt) ;
+  report("restart is bit-identical", sameBits(positions(restored), positions(reference)) &&
+         restored.getTime() == reference.getTime(), failures) ;
+
+  // saving again only rewrites the state; a new topology replaces the
+  // old one once the state refers to it
+  bool ok = restored.saveCheckpoint(name) && topologyOf(name) == firstTopology && exists(firstTopology) ;
+  report("state only checkpoint", ok, failures) ;
+  SpringMass changed ;
+  changed.loadCloth(5, 7) ;
+  ok = changed.saveCheckpoint(name) && topologyOf(name) != firstTopology &&
+       exists(topologyOf(name)) && ! exists(firstTopology) ;
+  report("topology replaced", ok, failures) ;
+  restored.saveCheckpoint(name) ;
+
+  // a topology with another token is rejected
+  SpringMass third ;
+  third.loadCloth(12, 12) ;
+  third.saveCheckpoint(other) ;
+  ok = copyFile(topologyOf(other), topologyOf(name)) ;
+  SpringMass mismatched ;
+  report("token mismatch rejected", ok && ! mismatched.restoreCheckpoint(name), failures) ;
+  restored.saveCheckpoint(other) ; // new topology for name below
+  restored.saveCheckpoint(name) ;
+
+  // truncated files are rejected
+  std::string topology = topologyOf(name) ;
+  SpringMass truncated ;
+  ok = copyFile(name, name + ".bak") && copyFile(name + ".bak", name, 100) && ! truncated.restoreCheckpoint(name) ;
+  report("truncated state rejected", ok, failures) ;
+  ok = copyFile(name + ".bak", name) && copyFile(topology, topology + ".bak") &&
+       copyFile(topology + ".bak", topology, 200) && ! truncated.restoreCheckpoint(name) ;
+  report("truncated topology rejected", ok, failures) ;
+  ok = copyFile(topology + ".bak", topology) && truncated.restoreCheckpoint(name) ;
+  report("restore after repair", ok, failures) ;
+
+  // counts that would overflow the size check are rejected (the
+  // number of masses follows the magic and the token, the number of
+  // islands ends the 72 bytes of header)
+  ok = true ;
+  const int64_t huge [] = {(int64_t)1 << 60, ((int64_t)1 << 61) + 1, INT64_MAX} ;
+  for (int k = 0 ; k < 3 ; ++k) {
+    ok = ok && copyFile(name + ".bak", name) && patch(name, 16, huge[k]) && ! truncated.restoreCheckpoint(name) ;
+    ok = ok && copyFile(name + ".bak", name) && patch(name, 64, huge[k]) && ! truncated.restoreCheckpoint(name) ;
+  }
+  ok = ok && copyFile(name + ".bak", name) ;
+  report("huge counts rejected", ok, failures) ;
+
+  // the restored forces are the ones the first step uses, unless they
+  // were stale when saved: a mass moved after the last step is moved
+  // with the forces of its new position
+  SpringMass moved, movedReference ;
+  moved.loadCloth(12, 12) ;
+  movedReference.loadCloth(12, 12) ;
+  for (int i = 0 ; i < 60 ; ++i) {
+    moved.step(dt) ;
+    movedReference.step(dt) ;
+  }
+  Mass * corner = moved.getMassList()[0] ;
+  corner->setState(corner->getPosition() + Vector3(0.05, 0, 0), corner->getVelocity()) ;
+  moved.invalidate() ;
+  corner = movedReference.getMassList()[0] ;
+  corner->setState(corner->getPosition() + Vector3(0.05, 0, 0), corner->getVelocity()) ;
+  movedReference.invalidate() ;
+  SpringMass movedRestored ;
+  ok = moved.saveCheckpoint(name) && movedRestored.restoreCheckpoint(name) ;
+  for (int i = 0 ; i < 60 ; ++i) {
+    movedReference.step(dt) ;
+    movedRestored.step(dt) ;
+  }
+  report("stale forces evaluated again", ok && sameBits(positions(movedRestored), positions(movedReference)), failures) ;
+
+  // with sleeping on, islands asleep at the checkpoint stay asleep
+  // and the quiet steps of the others carry on; setting the stepping
+  // mode after the restore, as run-springmass does, wakes nothing
+  SpringMass sleepy ;
+  sleepy.loadClusters(50) ;
+  sleepy.setSleeping(1e-4) ;
+  for (int i = 0 ; i < 1000 ; ++i) sleepy.step(dt) ;
+  ok = true ;
+  for (int stop = 700 ; stop <= 900 ; stop += 200) {
+    SpringMass first ;
+    first.loadClusters(50) ;
+    first.setSleeping(1e-4) ;
+    for (int i = 0 ; i < stop ; ++i) first.step(dt) ;
+    ok = ok && first.saveCheckpoint(name) ;
+    SpringMass second ;
+    ok = ok && second.restoreCheckpoint(name) && second.getNumSleepingIslands() == first.getNumSleepingIslands() ;
+    second.setNumThreads(1) ;
+    second.setDeterministic(false) ;
+    second.setIslandParallel(false) ;
+    second.setSleeping(1e-4) ;
+    for (int i = stop ; i < 1000 ; ++i) second.step(dt) ;
+    ok = ok && sameBits(positions(second), positions(sleepy)) && second.getEnergy() == sleepy.getEnergy() &&
+         second.getNumSleepingIslands() == sleepy.getNumSleepingIslands() ;
+  }
+  report("restart with sleeping is bit-identical", ok && sleepy.getNumSleepingIslands() > 0, failures) ;
+
+  std::remove((name + ".bak").c_str()) ;
+  std::remove((topology + ".bak").c_str()) ;
+  std::remove(topologyOf(name).c_str()) ;
+  std::remove(topologyOf(other).c_str()) ;
+  std::remove(name.c_str()) ;
+  std::remove(other.c_str()) ;
+  return failures ? 1 : 0 ;
+}
@@ -0,0 +1,76 @@
+/** file: test-islands.cpp
+ ** brief: Tests that island-parallel stepping follows the serial
+ **        trajectory
+ **/
+
+#include "springmass.h"
+#include "testing.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct Run {
+  std::vector<Vector3> positions ;
+  double energy ;
+  int sleeping ;
+} ;
+
+// 1000 steps of a 40 x 40 cloth, too large to be a task of its own,
+// and 100 small sheets, one task each, which settle and can sleep
+static Run simulate(int numThreads, bool islandParallel, bool deterministic, double sleepThreshold) {
+  SpringMass springmass ;
+  springmass.loadCloth(40, 40) ;
+  springmass.loadClusters(100) ;
+  springmass.setNumThreads(numThreads) ;
+  springmass.setIslandParallel(islandParallel) ;
+  springmass.setDeterministic(deterministic) ;
+  springmass.setSleeping(sleepThreshold) ;
+  for (int k = 0 ; k < 1000 ; ++k) springmass.step(1.0/240) ;
+  Run run ;
+  for (int i = 0 ; i < springmass.getNumMasses() ; ++i) run.positions.push_back(springmass.getMassList()[i]->getPosition()) ;
+  run.energy = springmass.getEnergy() ;
+  run.sleeping = springmass.getNumSleepingIslands() ;
+  return run ;
+}
+
+static bool sameBits(const Run & a, const Run & b, size_t first) {
+  return a.positions.size() == b.positions.size() &&
+         std::memcmp(&a.positions[first], &b.positions[first], (a.positions.size() - first) * sizeof(Vector3)) == 0 ;
+}
+
+// energies are reduced in island order rather than mass order
+static bool sameEnergy(const Run & a, const Run & b) {
+  return std::abs(a.energy - b.energy) <= 1e-12 * std::abs(b.energy) ;
+}
+
+int main(int argc, char** argv) {
+  const size_t clothMasses = 40 * 40 ;
+  int failures = 0 ;
+
+  Run serial = simulate(1, false, false, 0) ;
+  Run sleepingSerial = simulate(1, false, false, 1e-4) ;
+  for (int numThreads = 2 ; numThreads <= 4 ; numThreads *= 2) {
+    std::string threads = std::to_string(numThreads) + " threads" ;
+
+    // deterministic: the cloth goes through the gather passes, so all
+    // of it is the serial trajectory
+    Run run = simulate(numThreads, true, true, 0) ;
+    report(threads + ", deterministic", sameBits(run, serial, 0) && sameEnergy(run, serial), failures) ;
+
+    // otherwise only the islands stepped as tasks are
+    run = simulate(numThreads, true, false, 0) ;
+    report(threads + ", islands as tasks", sameBits(run, serial, clothMasses), failures) ;
+
+    // islands fall asleep at the same steps
+    run = simulate(numThreads, true, true, 1e-4) ;
+    report(threads + ", sleeping", sameBits(run, sleepingSerial, 0) && sameEnergy(run, sleepingSerial) &&
+           run.sleeping == sleepingSerial.sleeping, failures) ;
+  }
+  std::cout << sleepingSerial.sleeping << " islands asleep at the end" << std::endl ;
+  if (sleepingSerial.sleeping == 0) ++ failures ;
+
+  return failures ? 1 : 0 ;
+}
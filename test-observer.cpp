@@ -0,0 +1,109 @@
+/** file: test-observer.cpp
+ ** brief: Tests SpringMass step observers: the cadence of the calls and
+ **        the contents of the StateView they receive
+ **/
+
+#include "springmass.h"
+#include "testing.h"
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// the view against the masses themselves, which the step has already
+// written when the observers are called
+static bool sameState(const StateView & view, const SpringMass & springmass) {
+  if (view.numMasses != springmass.getNumMasses() || view.time != springmass.getTime()) return false ;
+  const std::vector<Mass *> & masses = springmass.getMassList() ;
+  for (int i = 0 ; i < view.numMasses ; ++i) {
+    Vector3 p = masses[i]->getPosition() ;
+    Vector3 v = masses[i]->getVelocity() ;
+    double expected [6] = {p.x, p.y, p.z, v.x, v.y, v.z} ;
+    if (std::memcmp(view.positions + 3 * i, expected, 3 * sizeof(double)) ||
+        std::memcmp(view.velocities + 3 * i, expected + 3, 3 * sizeof(double))) return false ;
+  }
+  return true ;
+}
+
+static std::vector<double> positions(const SpringMass & springmass) {
+  std::vector<double> result ;
+  for (int i = 0 ; i < springmass.getNumMasses() ; ++i) {
+    Vector3 p = springmass.getMassList()[i]->getPosition() ;
+    result.push_back(p.x) ;
+    result.push_back(p.y) ;
+    result.push_back(p.z) ;
+  }
+  return result ;
+}
+
+static void setup(SpringMass & springmass, const std::string & mode) {
+  springmass.loadClusters(30) ;
+  if (mode != "serial") springmass.setNumThreads(4) ;
+  if (mode == "deterministic") springmass.setDeterministic(true) ;
+  if (mode == "island-parallel") springmass.setIslandParallel(true) ;
+  if (mode == "sleeping") springmass.setSleeping(1e-3, 10) ;
+}
+
+// 40 steps as stepN(7) batches, one observer every step and one every
+// 3 steps; the steps they see, and whether every view matched the masses
+static void observe(const std::string & mode, int & failures) {
+  const double dt = 1.0/240 ;
+  SpringMass springmass ;
+  setup(springmass, mode) ;
+  std::vector<long> all, third ;
+  bool contents = true ;
+  springmass.addObserver([&](const StateView & view) {
+    all.push_back(view.step) ;
+    contents = contents && sameState(view, springmass) ;
+  }) ;
+  springmass.addObserver([&](const StateView & view) {
+    third.push_back(view.step) ;
+    contents = contents && sameState(view, springmass) ;
+  }, 3) ;
+  for (int k = 0 ; k < 40 ; k += 7) springmass.stepN(dt, std::min(7, 40 - k)) ;
+
+  bool cadence = all.size() == 40 && third.size() == 13 ;
+  for (size_t k = 0 ; k < all.size() && cadence ; ++k) cadence = all[k] == (long)k + 1 ;
+  for (size_t k = 0 ; k < third.size() && cadence ; ++k) cadence = third[k] == 3 * ((long)k + 1) ;
+  report(mode + ", cadence", cadence, failures) ;
+  report(mode + ", contents", contents, failures) ;
+
+  // observing does not change the trajectory
+  SpringMass unobserved ;
+  setup(unobserved, mode) ;
+  unobserved.stepN(dt, 40) ;
+  report(mode + ", trajectory unchanged", positions(unobserved) == positions(springmass), failures) ;
+}
+
+int main(int argc, char** argv) {
+  const double dt = 1.0/240 ;
+  int failures = 0 ;
+
+  const char * modes [] = {"serial", "threaded", "deterministic", "island-parallel", "sleeping"} ;
+  for (size_t m = 0 ; m < sizeof(modes) / sizeof(modes[0]) ; ++m) observe(modes[m], failures) ;
+
+  // an observer may remove itself; the others are still called, and
+  // removing one that is gone is harmless
+  SpringMass springmass ;
+  springmass.loadCloth(6, 6) ;
+  int once = 0, every = 0 ;
+  int id = -1 ;
+  id = springmass.addObserver([&](const StateView &) {
+    ++ once ;
+    springmass.removeObserver(id) ;
+  }, 2) ;
+  springmass.addObserver([&](const StateView &) { ++ every ; }) ;
+  springmass.stepN(dt, 10) ;
+  springmass.removeObserver(id) ;
+  report("self removal", once == 1 && every == 10, failures) ;
+
+  // the count goes on from where it was, and a new observer starts
+  // from the steps already taken
+  long first = -1 ;
+  springmass.addObserver([&](const StateView & view) { if (first < 0) first = view.step ; }, 4) ;
+  springmass.stepN(dt, 5) ;
+  report("cadence counted from the first step", first == 12 && every == 15, failures) ;
+
+  return failures ? 1 : 0 ;
+}
@@ -0,0 +1,85 @@
+/** file: test-profiler.cpp
+ ** brief: Tests the percentiles of PhaseStats against the exact ones
+ **/
+
+#include "profiler.h"
+#include "testing.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// the sample of rank p (n - 1), as getPercentile() picks it
+static uint64_t exact(std::vector<uint64_t> values, double p) {
+  std::sort(values.begin(), values.end()) ;
+  return values[(size_t)(p * (values.size() - 1))] ;
+}
+
+// below PROFILE_SUB_BUCKETS ns every bucket holds one value, above it
+// a percentile is the lower edge of the bucket of the exact one, at
+// most 1/PROFILE_SUB_BUCKETS of it lower
+static bool withinBucket(double percentile, uint64_t value) {
+  if (value < PROFILE_SUB_BUCKETS) return percentile == value * 1e-9 ;
+  double low = (double)value * (PROFILE_SUB_BUCKETS - 1) / PROFILE_SUB_BUCKETS * 1e-9 ;
+  return percentile <= value * 1e-9 && percentile >= low ;
+}
+
+static bool check(const std::vector<uint64_t> & values) {
+  PhaseStats stats ;
+  for (size_t i = 0 ; i < values.size() ; ++i) stats.add(values[i]) ;
+  const double ps [] = {0, 0.1, 0.5, 0.9, 0.99, 0.999, 1} ;
+  bool ok = stats.getCount() == values.size() ;
+  for (size_t k = 0 ; k < sizeof(ps) / sizeof(ps[0]) ; ++k) {
+    ok = ok && withinBucket(stats.getPercentile(ps[k]), exact(values, ps[k])) ;
+  }
+  // the minimum is its own bucket's lower edge or above it
+  return ok && stats.getPercentile(0) == stats.getMin() ;
+}
+
+int main(int argc, char** argv) {
+  int failures = 0 ;
+
+  PhaseStats empty ;
+  report("empty", empty.getCount() == 0 && empty.getPercentile(0.5) == 0, failures) ;
+
+  // small values are exact
+  std::vector<uint64_t> small ;
+  for (uint64_t ns = 0 ; ns < PROFILE_SUB_BUCKETS ; ++ns) small.push_back(ns) ;
+  report("values below the sub-buckets", check(small), failures) ;
+
+  // bucket edges: a power of two starts a bucket, the last value of a
+  // bucket falls back to its lower edge, the next one starts the next
+  // bucket (the buckets above 1024 are 64 ns wide)
+  bool ok = true ;
+  const uint64_t edges [][2] = {{16, 16}, {17, 17}, {31, 31}, {32, 32}, {33, 32}, {1024, 1024},
+                                {1087, 1024}, {1088, 1088}, {2047, 1984}, {2048, 2048}} ;
+  for (size_t k = 0 ; k < sizeof(edges) / sizeof(edges[0]) ; ++k) {
+    PhaseStats one ;
+    one.add(0) ;
+    one.add(edges[k][0]) ;
+    one.add(edges[k][0] + 1000000) ;
+    ok = ok && one.getPercentile(0.5) == edges[k][1] * 1e-9 ;
+  }
+  report("bucket edges", ok, failures) ;
+
+  // a single sample is every percentile
+  PhaseStats single ;
+  single.add(123457) ;
+  ok = single.getPercentile(0) == 123457 * 1e-9 && single.getPercentile(0.99) == 123457 * 1e-9 ;
+  report("single sample", ok, failures) ;
+
+  // spread over many powers of two, and up to the largest durations
+  std::mt19937_64 random(1) ;
+  std::vector<uint64_t> uniform, logUniform, huge ;
+  for (int i = 0 ; i < 100000 ; ++i) uniform.push_back(random() % 100000) ;
+  for (int i = 0 ; i < 100000 ; ++i) logUniform.push_back(random() >> (random() % 64)) ;
+  for (int i = 0 ; i < 1000 ; ++i) huge.push_back((random() >> 2) | ((uint64_t)1 << 61)) ;
+  report("uniform", check(uniform), failures) ;
+  report("log-uniform", check(logUniform), failures) ;
+  report("near 2^62", check(huge), failures) ;
+
+  return failures ? 1 : 0 ;
+}
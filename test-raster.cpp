@@ -0,0 +1,133 @@
+/** file: test-raster.cpp
+ ** brief: Tests that Raster images do not depend on the number of
+ **        threads, and the pixels of shapes across tile edges
+ **/
+
+#include "font.h"
+#include "raster.h"
+#include "testing.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// scene coordinates of a pixel position (column, row), exact for
+// quarter pixels when the size is a power of two
+static double sceneX(const Raster & raster, double column) { return column * 2.0 / raster.getWidth() - 1 ; }
+static double sceneY(const Raster & raster, double row) { return 1 - row * 2.0 / raster.getHeight() ; }
+
+static const uint8_t * pixel(const Raster & raster, int column, int row) {
+  return raster.getPixels() + 4 * ((size_t)row * raster.getWidth() + column) ;
+}
+
+static bool isColor(const Raster & raster, int column, int row, int r, int g, int b) {
+  const uint8_t * p = pixel(raster, column, row) ;
+  return p[0] == r && p[1] == g && p[2] == b && p[3] == 255 ;
+}
+
+// the pixels of a and b are the same at offset (dc, dr), wherever
+// both are in the image
+static bool shifted(const Raster & a, const Raster & b, int dc, int dr) {
+  for (int row = 0 ; row < a.getHeight() ; ++row) {
+    for (int column = 0 ; column < a.getWidth() ; ++column) {
+      int c = column - dc, r = row - dr ;
+      if (c < 0 || r < 0 || c >= b.getWidth() || r >= b.getHeight()) continue ;
+      if (std::memcmp(pixel(a, column, row), pixel(b, c, r), 4)) return false ;
+    }
+  }
+  return true ;
+}
+
+// the grid, and shapes on the tile edges of a size that is not a
+// multiple of the tiles: a circle on a tile corner, one on the edge
+// of the last partial tiles, one off the left edge, a line from a
+// column that is not a multiple of four, text clipped at the top and
+// left, and a few hundred masses
+static void drawScene(Raster & raster) {
+  raster.clear() ;
+  raster.drawGrid() ;
+  raster.setColor(1, 0, 0) ;
+  raster.drawCircle(sceneX(raster, 64.3), sceneY(raster, 63.8), 0.08) ;
+  raster.drawCircle(sceneX(raster, 191), sceneY(raster, 128.5), 0.05) ;
+  raster.drawCircle(sceneX(raster, -3), sceneY(raster, 100), 0.04) ;
+  raster.setColor(0, 0, 1) ;
+  raster.drawLine(sceneX(raster, 66.3), sceneY(raster, 20), sceneX(raster, 201.7), sceneY(raster, 170.2), 1) ;
+  raster.drawLine(sceneX(raster, 5.5), sceneY(raster, 127), sceneX(raster, 130), sceneY(raster, 60), 4) ;
+  raster.setColor(0, 0.5, 0) ;
+  raster.drawString(sceneX(raster, 61), sceneY(raster, 3), "clipped at the top") ;
+  raster.drawString(sceneX(raster, -2), sceneY(raster, 70), "left") ;
+  std::mt19937 random(3) ;
+  std::uniform_real_distribution<double> position(-1.1, 1.1), radius(0.005, 0.05) ;
+  for (int k = 0 ; k < 300 ; ++k) {
+    raster.setColor(k % 3 == 0, k % 3 == 1, 0.5) ;
+    raster.drawCircle(position(random), position(random), radius(random)) ;
+  }
+  raster.render() ;
+}
+
+int main(int argc, char** argv) {
+  int failures = 0 ;
+
+  // 1 and N threads, the same bytes
+  Raster serial(250, 190, 1) ;
+  drawScene(serial) ;
+  bool ok = true ;
+  for (int numThreads = 2 ; numThreads <= 8 ; numThreads *= 2) {
+    Raster parallel(250, 190, numThreads) ;
+    drawScene(parallel) ;
+    ok = ok && std::memcmp(serial.getPixels(), parallel.getPixels(), 4 * 250 * 190) == 0 ;
+  }
+  report("threads, same image", ok, failures) ;
+
+  // a circle on a tile corner is the one inside a tile moved there:
+  // its center is full, outside is white
+  const int size = 256 ;
+  const int T = RASTER_TILE_SIZE ;
+  Raster corner(size, size), inside(size, size) ;
+  corner.setColor(1, 0, 0) ;
+  corner.drawCircle(sceneX(corner, T + 0.25), sceneY(corner, T - 0.25), 10.0 / (size / 2)) ;
+  corner.render() ;
+  inside.setColor(1, 0, 0) ;
+  inside.drawCircle(sceneX(inside, T / 2 + 0.25), sceneY(inside, T / 2 - 0.25), 10.0 / (size / 2)) ;
+  inside.render() ;
+  ok = shifted(corner, inside, T / 2, T / 2) && isColor(corner, T, T - 1, 255, 0, 0) &&
+       isColor(corner, T - 1, T, 255, 0, 0) && isColor(corner, T, T + 12, 255, 255, 255) ;
+  report("circle across tiles", ok, failures) ;
+
+  // a one pixel line through pixel centers from column 66, not a
+  // multiple of four, and the same one a column to the left
+  Raster line(size, size), left(size, size) ;
+  line.setColor(0, 0, 1) ;
+  line.drawLine(sceneX(line, 66.5), sceneY(line, 100.5), sceneX(line, 190.5), sceneY(line, 100.5), 1) ;
+  line.render() ;
+  left.setColor(0, 0, 1) ;
+  left.drawLine(sceneX(left, 65.5), sceneY(left, 100.5), sceneX(left, 189.5), sceneY(left, 100.5), 1) ;
+  left.render() ;
+  ok = shifted(line, left, 1, 0) && isColor(line, 66, 100, 0, 0, 255) && isColor(line, 128, 100, 0, 0, 255) &&
+       isColor(line, 190, 100, 0, 0, 255) && isColor(line, 128, 99, 255, 255, 255) &&
+       isColor(line, 128, 101, 255, 255, 255) && isColor(line, 64, 100, 255, 255, 255) ;
+  report("line from an unaligned column", ok, failures) ;
+
+  // a glyph whose top rows are above the image: the rows left are
+  // those of the font, and the same as lower down
+  Raster top(size, size), lower(size, size) ;
+  top.drawString(sceneX(top, 70), sceneY(top, 4), "H") ;
+  top.render() ;
+  lower.drawString(sceneX(lower, 70), sceneY(lower, 40), "H") ;
+  lower.render() ;
+  const uint8_t * glyph = font5x8['H' - FONT_FIRST_CHAR] ;
+  int row = 4 - FONT_ASCENT ;
+  ok = shifted(top, lower, 0, -36) ;
+  for (int r = 0 ; r < FONT_HEIGHT ; ++r) {
+    for (int c = 0 ; c < FONT_WIDTH && row + r >= 0 ; ++c) {
+      int v = (glyph[c] & (1 << r)) ? 0 : 255 ;
+      ok = ok && isColor(top, 70 + c, row + r, v, v, v) ;
+    }
+  }
+  report("glyph clipped at the top", ok, failures) ;
+
+  return failures ? 1 : 0 ;
+}
@@ -0,0 +1,109 @@
+/** file: test-sleeping.cpp
+ ** brief: Tests that resting islands go to sleep and that wake() and
+ **        invalidate() wake them
+ **/
+
+#include "springmass.h"
+#include "testing.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static std::vector<Vector3> positions(const SpringMass & springmass, int first, int last) {
+  std::vector<Vector3> result ;
+  for (int i = first ; i < last ; ++i) result.push_back(springmass.getMassList()[i]->getPosition()) ;
+  return result ;
+}
+
+static bool sameBits(const std::vector<Vector3> & a, const std::vector<Vector3> & b) {
+  return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(Vector3)) == 0 ;
+}
+
+static bool atRest(const SpringMass & springmass, int first, int last) {
+  for (int i = first ; i < last ; ++i) {
+    if (springmass.getMassList()[i]->getVelocity().norm() != 0) return false ;
+  }
+  return true ;
+}
+
+int main(int argc, char** argv) {
+  const double dt = 1.0/240 ;
+  const int quietSteps = 60 ;
+  int failures = 0 ;
+
+  // four 3 x 3 sheets, 9 masses each in mass order, shaken and left
+  // to settle on the floor; the last one is kept moving
+  SpringMass springmass ;
+  springmass.loadClusters(4) ;
+  springmass.setSleeping(1e-4, quietSteps) ;
+  const std::vector<Mass *> & masses = springmass.getMassList() ;
+  int steps = 0 ;
+  for ( ; steps < 5000 && springmass.getNumSleepingIslands() < 3 ; ++steps) {
+    Mass * kicked = masses[27] ;
+    if (steps % 30 == 0) {
+      kicked->setState(kicked->getPosition(), Vector3(0, 1, 0)) ;
+      springmass.wake(kicked) ;
+    }
+    springmass.step(dt) ;
+  }
+  std::cout << "asleep after " << steps << " steps" << std::endl ;
+  report("resting islands sleep", springmass.getNumIslands() == 4 && springmass.getNumSleepingIslands() == 3 &&
+         atRest(springmass, 0, 27) && ! atRest(springmass, 27, 36), failures) ;
+
+  // asleep, they do not move and count with the energies they fell
+  // asleep with, which are those of their state
+  std::vector<Vector3> frozen = positions(springmass, 0, 27) ;
+  for (int k = 0 ; k < 100 ; ++k) springmass.step(dt) ;
+  bool ok = sameBits(positions(springmass, 0, 27), frozen) && atRest(springmass, 0, 27) ;
+  report("sleeping islands do not move", ok, failures) ;
+  double energy = springmass.getEnergy() ;
+  SpringMass awake ;
+  awake.loadClusters(4) ;
+  for (int i = 0 ; i < 36 ; ++i) {
+    awake.getMassList()[i]->setState(masses[i]->getPosition(), masses[i]->getVelocity()) ;
+  }
+  awake.invalidate() ;
+  report("sleeping energies", std::abs(awake.getEnergy() - energy) <= 1e-12 * std::abs(energy), failures) ;
+
+  // wake() wakes the island of the mass only, which then needs the
+  // quiet steps again before it sleeps
+  masses[4]->setState(masses[4]->getPosition(), Vector3(0.5, 0.5, 0)) ;
+  springmass.wake(masses[4]) ;
+  frozen = positions(springmass, 9, 27) ;
+  std::vector<Vector3> before = positions(springmass, 0, 9) ;
+  springmass.step(dt) ;
+  ok = springmass.getNumSleepingIslands() == 2 && ! sameBits(positions(springmass, 0, 9), before) &&
+       sameBits(positions(springmass, 9, 27), frozen) ;
+  report("wake() wakes one island", ok, failures) ;
+
+  // invalidate() and turning sleeping off wake all of them
+  springmass.invalidate() ;
+  ok = springmass.getNumSleepingIslands() == 0 ;
+  for (int k = 0 ; k < 3 * quietSteps && springmass.getNumSleepingIslands() < 2 ; ++k) springmass.step(dt) ;
+  ok = ok && springmass.getNumSleepingIslands() >= 2 ;
+  springmass.setSleeping(0) ;
+  report("invalidate() and setSleeping(0) wake all", ok && springmass.getNumSleepingIslands() == 0, failures) ;
+
+  // renumbering keeps the islands asleep, with their energies
+  SpringMass renumbered ;
+  renumbered.loadClusters(4) ;
+  renumbered.setSleeping(1e-4, quietSteps) ;
+  for (int k = 0 ; k < 5000 && renumbered.getNumSleepingIslands() < 4 ; ++k) renumbered.step(dt) ;
+  std::vector<Mass *> objects = renumbered.getMassList() ;
+  frozen = positions(renumbered, 0, 36) ;
+  energy = renumbered.getEnergy() ;
+  renumbered.reorder(REVERSE_CUTHILL_MCKEE, false) ;
+  ok = renumbered.getNumSleepingIslands() == 4 && std::abs(renumbered.getEnergy() - energy) <= 1e-12 * std::abs(energy) ;
+  for (int k = 0 ; k < 100 ; ++k) renumbered.step(dt) ;
+  std::vector<Vector3> same ;
+  for (int i = 0 ; i < 36 ; ++i) same.push_back(objects[i]->getPosition()) ;
+  ok = ok && sameBits(same, frozen) ;
+  renumbered.reorder(MORTON) ;
+  renumbered.step(dt) ;
+  report("islands stay asleep across reorder()", ok && renumbered.getNumSleepingIslands() == 4, failures) ;
+
+  return failures ? 1 : 0 ;
+}
@@ -0,0 +1,89 @@
+/** file: test-springmass-deterministic.cpp
+ ** brief: Tests that deterministic parallel stepping is bit-identical
+ **        for any number of threads
+ **/
+
+#include "springmass.h"
+
+#include <cstring>
+#include <iostream>
+
+// a square cloth of rows x rows masses with structural and shear springs
+static void makeCloth(std::vector<Mass> & masses, SpringMass & springmass, int rows) {
+  const double mass = 0.01 ;
+  const double radius = 0.005 ;
+  const double spacing = 1.6 / rows ;
+  masses.clear() ;
+  masses.reserve(rows * rows) ; // springs keep pointers to the masses
+  for (int i = 0 ; i < rows ; ++i) {
+    for (int j = 0 ; j < rows ; ++j) {
+      Vector3 position(-0.8 + j * spacing, -0.8 + i * spacing, 0) ;
+      Vector3 velocity(0.1 * ((i * 7 + j * 3) % 5 - 2), 0.1 * ((i * 5 + j) % 3 - 1), 0) ;
+      masses.push_back(Mass(position, velocity, mass, radius)) ;
+    }
+  }
+
+  std::vector<Spring> springs ;
+  const double stiff = 5 ;
+  const double damping = 0.01 ;
+  for (int i = 0 ; i < rows ; ++i) {
+    for (int j = 0 ; j < rows ; ++j) {
+      Mass * m = &masses[i * rows + j] ;
+      if (j + 1 < rows) springs.push_back(Spring(m, m + 1, spacing, stiff, damping)) ;
+      if (i + 1 < rows) springs.push_back(Spring(m, m + rows, spacing, stiff, damping)) ;
+      if (i + 1 < rows && j + 1 < rows) springs.push_back(Spring(m, m + rows + 1, spacing * std::sqrt(2.0), stiff, damping)) ;
+    }
+  }
+  springmass.addSpring(springs) ;
+}
+
+// run and return the final positions and energy
+static void simulate(int numThreads, bool deterministic, std::vector<Vector3> & positions, double & energy) {
+  std::vector<Mass> masses ;
+  SpringMass springmass ;
+  makeCloth(masses, springmass, 80) ;
+  springmass.setNumThreads(numThreads) ;
+  springmass.setDeterministic(deterministic) ;
+
+  const double dt = 1.0/240 ;
+  for (int i = 0 ; i < 100 ; ++i) {
+    springmass.step(dt) ;
+  }
+
+  positions.clear() ;
+  for (int i = 0 ; i < springmass.getNumMasses() ; ++i) {
+    positions.push_back(springmass.getMassList()[i]->getPosition()) ;
+  }
+  energy = springmass.getEnergy() ;
+}
+
+static bool sameBits(const std::vector<Vector3> & a, const std::vector<Vector3> & b) {
+  return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(Vector3)) == 0 ;
+}
+
+int main(int argc, char** argv) {
+
+  // serial reference
+  std::vector<Vector3> reference ;
+  double serialEnergy ;
+  simulate(1, false, reference, serialEnergy) ;
+
+  // deterministic runs
+  const int threads [] = {1, 2, 3, 8, 64} ;
+  double referenceEnergy = 0 ;
+  int failures = 0 ;
+  for (int k = 0 ; k < 5 ; ++k) {
+    std::vector<Vector3> positions ;
+    double energy ;
+    simulate(threads[k], true, positions, energy) ;
+    if (k == 0) referenceEnergy = energy ;
+
+    bool ok = sameBits(positions, reference) &&
+              std::memcmp(&energy, &referenceEnergy, sizeof(double)) == 0 ;
+    std::cout << threads[k] << " threads: " << (ok ? "ok" : "MISMATCH")
+              << " (energy " << energy << ")" << std::endl ;
+    if (!ok) ++ failures ;
+  }
+
+  return failures ? 1 : 0 ;
+}
@@ -5,53 +5,103 @@
 
 #include "graphics.h"
 #include "springmass.h"
+#include "trajectory.h"
+#include "triplebuffer.h"
 
 #include <iostream>
-#include <sstream>
-#include <iomanip>
-
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+
+// what draw() needs from a step, published through a triple buffer
+// so that the simulation can run on its own thread; positions before
+// and after the step, to interpolate between (the energy comes from
+// the diagnostics the step publishes). The springs are copied
+// again only when the topology changes
+struct SpringMassSnapshot {
+  Frame previous ;
+  Frame frame ;
+  std::vector<double> radii ;
+  long topologyVersion ;
+  std::vector<int> springMass1 ;
+  std::vector<int> springMass2 ;
+  std::vector<double> thickness ;
+  SpringMassSnapshot() : topologyVersion(-1) { }
+} ;
 
 class SpringMassDrawable : public SpringMass, public Drawable {
 
   private:
     Figure figure ;
+    TripleBuffer<SpringMassSnapshot> snapshots ;
+    Frame last ; // last published frame
+    std::vector<double> positions ;
+
+    // frame time measurement
+    bool benchmark ;
+    long frames ;
+    double drawTime ;
 
   public:
-    SpringMassDrawable() : figure("Spring Mass") {
+    SpringMassDrawable() : figure("Spring Mass"), benchmark(false), frames(0), drawTime(0) {
       figure.addDrawable(this) ;
     }
 
+    // print the mean time to draw a frame (until the GPU is done)
+    // every 100 frames
+    void setBenchmark(bool _benchmark) {
+      benchmark = _benchmark ;
+    }
+
+    void publish() {
+      SpringMassSnapshot & snapshot = snapshots.getBack() ;
+      snapshot.frame.capture(*this) ;
+      snapshot.previous = (last.positions.size() != snapshot.frame.positions.size()) ? snapshot.frame : last ;
+      last = snapshot.frame ;
+      snapshot.radii.resize(mass_list.size()) ;
+      for (size_t i = 0 ; i < mass_list.size() ; ++i) {
+        snapshot.radii[i] = mass_list[i]->getScaledR() ;
+      }
+      updateTopology() ;
+      if (snapshot.topologyVersion != topology_version) {
+        snapshot.topologyVersion = topology_version ;
+        snapshot.springMass1 = spring_mass1 ;
+        snapshot.springMass2 = spring_mass2 ;
+        snapshot.thickness.resize(spring_list.size()) ;
+        for (size_t s = 0 ; s < spring_list.size() ; ++s) {
+          snapshot.thickness[s] = spring_list[s].getStiffness() ;
+        }
+      }
+      snapshots.publish() ;
+    }
+
     void draw() {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now() ;
+      snapshots.update() ;
+      const SpringMassSnapshot & snapshot = snapshots.getFront() ;
+      const std::vector<double> & p0 = snapshot.previous.positions ;
+      const std::vector<double> & p1 = snapshot.frame.positions ;
+      if (p1.empty()) return ; // nothing published yet
+
+      double alpha = getInterpolation() ;
+      positions.resize(p1.size()) ;
+      for (size_t k = 0 ; k < p1.size() ; ++k) positions[k] = p0[k] + alpha * (p1[k] - p0[k]) ;
+      const std::vector<double> & p = positions ;
 
       // draw mass
-      for (std::vector<Mass *>::iterator it = mass_list.begin() ; it != end (mass_list); ++it) {
-        
-        // position and radius
-        Vector3 position = (*it)->getPosition();
-        double x = position.x;
-        double y = position.y;
-        double z = position.z;
-
-        double r_scaled = (*it)->getScaledR();
-        
-        // draw
-        figure.drawCircle(x, y, r_scaled) ;
+      for (size_t i = 0 ; i < snapshot.radii.size() ; ++i) {
+        figure.batchCircle(p[3*i], p[3*i+1], snapshot.radii[i]) ;
       }
       
       // draw spring
-      for (std::vector<Spring>::iterator it = begin(spring_list); it != end (spring_list); ++it) {
-        // position
-        Mass * m1 = (*it).getMass1();
-        Mass * m2 = (*it).getMass2();
+      // from the snapshot only: the simulation thread owns the lists
+      for (size_t s = 0 ; s < snapshot.thickness.size() ; ++s) {
+        int i1 = snapshot.springMass1[s] ;
+        int i2 = snapshot.springMass2[s] ;
 
-        Vector3 p1 = m1->getPosition();
-        Vector3 p2 = m2->getPosition();
-
-        // thickness
-        double thickness = (*it).getStiffness();
-        
         // draw
-        figure.drawLine(p1.x, p1.y, p2.x, p2.y, thickness) ;
+        figure.batchLine(p[3*i1], p[3*i1+1], p[3*i2], p[3*i2+1], snapshot.thickness[s]) ;
       }
 
 
@@ -60,13 +110,18 @@ class SpringMassDrawable : public SpringMass, public Drawable {
       double x = 0;
       double y = 0;
       // energy  
-      double energy = getEnergy();
-      std::stringstream ss;
-      ss << energy;
-      std::string energy_str = ss.str();
-
-      figure.drawString(x, y, energy_str);
-
+      figure.drawNumber(x, y, getDiagnostics().energy);
+
+      if (benchmark) {
+        figure.drawBatch() ;
+        glFinish() ;
+        drawTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() ;
+        if (++ frames % 100 == 0) {
+          std::cerr << "frame time " << 1e3 * drawTime / 100 << " ms ("
+                    << snapshot.radii.size() << " masses, " << snapshot.thickness.size() << " springs)" << std::endl ;
+          drawTime = 0 ;
+        }
+      }
     }
 
     void display() {
@@ -84,6 +139,26 @@ int main(int argc, char** argv) {
   SpringMassDrawable springmass;
 
 
+  // -cloth N simulates an N x N cloth instead, -bench N also prints
+  // the frame time
+  int arg = 1 ;
+  bool threaded = false ;
+  int clothRows = 0 ;
+  for ( ; arg < argc ; ++arg) {
+    if (!std::strcmp(argv[arg], "-threaded")) threaded = true ;
+    else if (!std::strcmp(argv[arg], "-cloth") && arg + 1 < argc) clothRows = std::atoi(argv[++arg]) ;
+    else if (!std::strcmp(argv[arg], "-bench") && arg + 1 < argc) {
+      clothRows = std::atoi(argv[++arg]) ;
+      springmass.setBenchmark(true) ;
+    }
+  }
+  if (clothRows > 1) {
+    springmass.loadCloth(clothRows, clothRows) ;
+    if (threaded) runThreaded(&springmass, 1.0/240.0) ;
+    else run(&springmass, 1.0/240.0) ;
+    return 0 ;
+  }
+
   // springmass.loadSample();
   // mass
   const double mass = 1 ;
@@ -108,7 +183,12 @@ int main(int argc, char** argv) {
   // springmass
   springmass.addSpring(more_springs);
 
-  run(&springmass, 1.0/240.0);
+  // -threaded steps on a separate thread
+  if (threaded) {
+    runThreaded(&springmass, 1.0/240.0);
+  } else {
+    run(&springmass, 1.0/240.0);
+  }
 
   // return 
   return 0 ;
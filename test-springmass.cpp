@@ -4,6 +4,7 @@
  **/
 
 #include "springmass.h"
+#include "textwriter.h"
 
 int main(int argc, char** argv) {
   
@@ -29,10 +30,12 @@ int main(int argc, char** argv) {
 
 
   // simulation
+  // same output as display(), without a flush per line
+  TextWriter output ;
   const double dt = 1.0/30 ;
   for (int i = 0 ; i < 400 ; ++i) {
     springmass.step(dt) ;
-    springmass.display() ;
+    output.write(springmass) ;
   }
 
   return 0 ;
@@ -0,0 +1,83 @@
+/** file: test-timestep.cpp
+ ** brief: Tests the stable time step estimate on a two-mass spring
+ **/
+
+#include "springmass.h"
+#include "testing.h"
+
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static bool close(double a, double b, double tolerance) {
+  return std::abs(a - b) <= tolerance * std::abs(b) ;
+}
+
+// two masses along x joined by a spring, stretched by 1%, without
+// gravity; the caller owns the masses
+static void makeSpring(std::vector<Mass> & masses, SpringMass & springmass,
+                       double m1, double m2, double stiff, double damping) {
+  const double length = 0.2 ;
+  masses.clear() ;
+  masses.reserve(2) ;
+  masses.push_back(Mass(Vector3(-0.101, 0, 0), Vector3(), m1, 0.01)) ;
+  masses.push_back(Mass(Vector3(+0.101, 0, 0), Vector3(), m2, 0.01)) ;
+  springmass.setGravity(0) ;
+  springmass.setIntegrator(SYMPLECTIC_EULER) ;
+  springmass.addSpring(std::vector<Spring>(1, Spring(&masses[0], &masses[1], length, stiff, damping))) ;
+}
+
+// largest |extension| over n steps of dt, relative to the initial one
+static double growth(double m1, double m2, double stiff, double damping, double dt, int n) {
+  std::vector<Mass> masses ;
+  SpringMass springmass ;
+  makeSpring(masses, springmass, m1, m2, stiff, damping) ;
+  double initial = 0.002 ;
+  double largest = 0 ;
+  for (int k = 0 ; k < n ; ++k) {
+    springmass.step(dt) ;
+    double extension = (masses[1].getPosition() - masses[0].getPosition()).norm() - 0.2 ;
+    largest = std::max(largest, std::abs(extension)) ;
+  }
+  return largest / initial ;
+}
+
+int main(int argc, char** argv) {
+  const double m1 = 0.02, m2 = 0.05, stiff = 5, damping = 0.01 ;
+  int failures = 0 ;
+
+  // symplectic Euler on the relative coordinate, x'' = -w2 x - gamma x'
+  double mu = m1 * m2 / (m1 + m2) ;
+  double w2 = stiff / mu ;
+  double gamma = damping / mu ;
+  double analytic = (std::sqrt(gamma * gamma + 4 * w2) - gamma) / w2 ;
+
+  std::vector<Mass> masses ;
+  SpringMass springmass ;
+  makeSpring(masses, springmass, m1, m2, stiff, damping) ;
+  double perSpring = springmass.getStableTimeStep() ;
+  double power = springmass.getStableTimeStep(30) ;
+  std::cout << "analytic " << analytic << " s, per spring " << perSpring << " s, power " << power << " s" << std::endl ;
+  report("per spring bound is the analytic one", close(perSpring, analytic, 1e-12), failures) ;
+  report("power estimate is the analytic one", close(power, analytic, 1e-9), failures) ;
+
+  // stable: the same again, with more iterations, and after stepping
+  // and starting over (the spring stays along x)
+  bool ok = springmass.getStableTimeStep(30) == power && close(springmass.getStableTimeStep(60), analytic, 1e-9) ;
+  for (int k = 0 ; k < 100 ; ++k) springmass.step(0.5 * analytic) ;
+  springmass.invalidate() ;
+  ok = ok && close(springmass.getStableTimeStep(30), analytic, 1e-9) ;
+  report("estimate stable", ok, failures) ;
+
+  // and it is where the integrator actually turns unstable (near the
+  // bound symplectic Euler's orbit is a long ellipse, so even a stable
+  // run stretches further than it started)
+  double below = growth(m1, m2, stiff, damping, 0.95 * analytic, 2000) ;
+  double above = growth(m1, m2, stiff, damping, 1.05 * analytic, 2000) ;
+  std::cout << "growth at 0.95 dt " << below << ", at 1.05 dt " << above << std::endl ;
+  report("stable below the bound", below <= 5, failures) ;
+  report("unstable above the bound", above >= 100, failures) ;
+
+  return failures ? 1 : 0 ;
+}
@@ -0,0 +1,227 @@
+/** file: test-trajectory.cpp
+ ** brief: Tests the compressed trajectory codec and the random-access
+ **        reader
+ **/
+
+#include "reader.h"
+#include "trajectory.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// smooth motion plus a little jitter, so that the residuals are not
+// all zero, inside the box [-1,1] x [-0.5,0.5] x [0,0.25]
+static void makeFrames(std::vector<Frame> & frames, int numMasses, int numFrames) {
+  frames.resize(numFrames) ;
+  unsigned seed = 1 ;
+  for (int k = 0 ; k < numFrames ; ++k) {
+    frames[k].time = k / 240.0 ;
+    frames[k].resize(numMasses) ;
+    for (int m = 0 ; m < numMasses ; ++m) {
+      seed = seed * 1103515245u + 12345u ;
+      double jitter = ((seed >> 16) % 1000) * 1e-7 ;
+      frames[k].positions[3*m+0] = 0.9 * std::sin(0.05 * k + m) + jitter ;
+      frames[k].positions[3*m+1] = 0.4 * std::cos(0.11 * k * (1 + m % 3)) ;
+      frames[k].positions[3*m+2] = 0.1 + 0.1 * std::sin(0.02 * k * m) ;
+    }
+  }
+}
+
+// a cloth run written both raw and compressed (keyframes every 16
+// frames); amplitude scales the initial velocities
+static void record(std::string rawName, std::string compressedName, double amplitude, int numFrames) {
+  SpringMass springmass ;
+  springmass.loadCloth(8, 8) ;
+  const std::vector<Mass *> & masses = springmass.getMassList() ;
+  for (size_t i = 0 ; i < masses.size() ; ++i) {
+    masses[i]->setState(masses[i]->getPosition(), Vector3(amplitude * ((i * 7) % 5 - 2), 0, 0)) ;
+  }
+  springmass.invalidate() ;
+  RawTrajectoryWriter raw(rawName, springmass.getNumMasses()) ;
+  CompressedTrajectoryWriter compressed(compressedName, springmass, 1e-5, 16) ;
+  Frame frame ;
+  for (int k = 0 ; k < numFrames ; ++k) {
+    springmass.step(1.0/240) ;
+    frame.capture(springmass) ;
+    raw.writeFrame(frame) ;
+    compressed.writeFrame(frame) ;
+  }
+  raw.close() ;
+  compressed.close() ;
+}
+
+// random seeks and strided single mass reads against a sequential read
+static bool checkReader(std::string fileName, const char * what) {
+  TrajectoryReader reader ;
+  if (! reader.open(fileName)) return false ;
+  long numFrames = reader.getNumFrames() ;
+  std::vector<Frame> sequential(numFrames) ;
+  bool ok = numFrames > 0 ;
+  for (long k = 0 ; k < numFrames ; ++k) ok = ok && reader.readFrame(k, sequential[k]) ;
+
+  Frame frame ;
+  std::srand(7) ;
+  for (int t = 0 ; t < 200 && ok ; ++t) {
+    long k = std::rand() % numFrames ;
+    ok = reader.readFrame(k, frame) && frame.time == sequential[k].time &&
+         frame.positions == sequential[k].positions ;
+  }
+
+  std::vector<double> times, xyz ;
+  const int mass = 29 ;
+  const long first = 5, last = numFrames - 3, stride = 7 ;
+  ok = ok && reader.readMass(mass, first, last, stride, times, xyz) ;
+  size_t j = 0 ;
+  for (long k = first ; k < last && ok ; k += stride, ++j) {
+    ok = j < times.size() && times[j] == sequential[k].time &&
+         std::memcmp(&xyz[3*j], &sequential[k].positions[3*mass], 3 * sizeof(double)) == 0 ;
+  }
+  ok = ok && j == times.size() ;
+  std::cout << what << ": " << (ok ? "ok" : "MISMATCH") << " (" << numFrames << " frames)" << std::endl ;
+  return ok ;
+}
+
+// a copy of a file with one int32 of its header replaced; true if the
+// reader then refuses it
+static bool rejectsHeader(std::string fileName, long offset, int32_t value) {
+  std::string badName = "test-trajectory-bad" ;
+  FILE * in = std::fopen(fileName.c_str(), "rb") ;
+  FILE * out = std::fopen(badName.c_str(), "wb") ;
+  bool ok = in && out ;
+  char buffer [4096] ;
+  size_t n ;
+  while (ok && (n = std::fread(buffer, 1, sizeof(buffer), in)) > 0) ok = std::fwrite(buffer, 1, n, out) == n ;
+  ok = ok && std::fseek(out, offset, SEEK_SET) == 0 && std::fwrite(&value, sizeof(value), 1, out) == 1 ;
+  if (in) std::fclose(in) ;
+  if (out) std::fclose(out) ;
+  TrajectoryReader reader ;
+  ok = ok && ! reader.open(badName) && reader.getNumMasses() == 0 && reader.getNumFrames() == 0 ;
+  std::remove(badName.c_str()) ;
+  std::remove((badName + ".idx").c_str()) ;
+  return ok ;
+}
+
+// the compressed frames are within the quantization of the raw ones
+static bool sameTrajectory(std::string rawName, std::string compressedName) {
+  TrajectoryReader raw, compressed ;
+  if (! raw.open(rawName) || ! compressed.open(compressedName)) return false ;
+  bool ok = raw.getNumFrames() == compressed.getNumFrames() ;
+  Frame a, b ;
+  for (long k = 0 ; k < raw.getNumFrames() && ok ; ++k) {
+    ok = raw.readFrame(k, a) && compressed.readFrame(k, b) ;
+    for (size_t i = 0 ; i < a.positions.size() && ok ; ++i) {
+      ok = std::abs(a.positions[i] - b.positions[i]) <= 1.01e-5 ;
+    }
+  }
+  return ok ;
+}
+
+int main(int argc, char** argv) {
+  const int numMasses = 100 ;
+  const int numFrames = 70 ;
+  const int keyframeInterval = 16 ;
+  const double tolerance = 1e-5 ;
+  const Vector3 boxMin(-1, -0.5, 0) ;
+  const Vector3 boxMax(1, 0.5, 0.25) ;
+  const double quantum [3] = {2 * tolerance, 1 * tolerance, 0.25 * tolerance} ;
+  int failures = 0 ;
+
+  std::vector<Frame> frames ;
+  makeFrames(frames, numMasses, numFrames) ;
+
+  // encode
+  TrajectoryCodec encoder(numMasses, boxMin, boxMax, tolerance, keyframeInterval) ;
+  std::vector<std::vector<uint8_t> > records(numFrames) ;
+  std::vector<TrajectoryCodec::Kind> kinds(numFrames) ;
+  size_t bytes = 0 ;
+  for (int k = 0 ; k < numFrames ; ++k) {
+    kinds[k] = encoder.encode(frames[k], records[k]) ;
+    bytes += records[k].size() ;
+    bool keyframe = (k % keyframeInterval == 0) ;
+    if ((kinds[k] == TrajectoryCodec::KEYFRAME) != keyframe) {
+      std::cout << "frame " << k << ": wrong kind" << std::endl ;
+      ++ failures ;
+    }
+  }
+
+  // decode everything, across the keyframes at 0, 16, 32 and 48
+  TrajectoryCodec decoder(numMasses, boxMin, boxMax, tolerance, keyframeInterval) ;
+  std::vector<Frame> decoded(numFrames) ;
+  double worst = 0 ;
+  for (int k = 0 ; k < numFrames ; ++k) {
+    if (! decoder.decode(kinds[k], records[k].data(), records[k].size(), decoded[k])) {
+      std::cout << "frame " << k << ": decode failed" << std::endl ;
+      ++ failures ;
+      continue ;
+    }
+    for (int i = 0 ; i < 3 * numMasses ; ++i) {
+      double error = std::abs(decoded[k].positions[i] - frames[k].positions[i]) / quantum[i % 3] ;
+      worst = std::max(worst, error) ;
+    }
+  }
+  bool ok = worst <= 0.5 + 1e-6 ;
+  std::cout << "round trip: " << (ok ? "ok" : "MISMATCH") << " (worst error " << worst
+            << " quanta, " << bytes << " bytes for " << numFrames * numMasses * 24 << ")" << std::endl ;
+  if (!ok) ++ failures ;
+
+  // one mass only, starting from the keyframe at 32, gives the same
+  // values as the full decode
+  TrajectoryCodec partial(numMasses, boxMin, boxMax, tolerance, keyframeInterval) ;
+  const int mass = 37 ;
+  ok = true ;
+  for (int k = 32 ; k < numFrames ; ++k) {
+    double p [3] ;
+    ok = ok && partial.decodeRange(kinds[k], records[k].data(), records[k].size(), 3 * mass, 3 * mass + 3, p) ;
+    for (int a = 0 ; a < 3 ; ++a) ok = ok && p[a] == decoded[k].positions[3 * mass + a] ;
+  }
+  std::cout << "single mass from a keyframe: " << (ok ? "ok" : "MISMATCH") << std::endl ;
+  if (!ok) ++ failures ;
+
+  // a truncated record is rejected
+  TrajectoryCodec truncated(numMasses, boxMin, boxMax, tolerance, keyframeInterval) ;
+  Frame frame ;
+  ok = ! truncated.decode(kinds[0], records[0].data(), records[0].size() - 1, frame) ;
+  std::cout << "truncated record: " << (ok ? "ok" : "MISMATCH") << std::endl ;
+  if (!ok) ++ failures ;
+
+  // reader, raw and compressed
+  const std::string rawName = "test-trajectory.raw" ;
+  const std::string compressedName = "test-trajectory.smz" ;
+  const std::string indexName = compressedName + ".idx" ;
+  std::remove(indexName.c_str()) ;
+  record(rawName, compressedName, 0.1, 100) ;
+  if (! checkReader(rawName, "raw reader")) ++ failures ;
+  if (! checkReader(compressedName, "compressed reader, index built")) ++ failures ;
+  if (! checkReader(compressedName, "compressed reader, index cached")) ++ failures ;
+
+  // a cached index whose offsets point outside the file is rebuilt
+  FILE * f = std::fopen(indexName.c_str(), "r+b") ;
+  int64_t bad = (int64_t)1 << 40 ;
+  ok = f && std::fseek(f, 40 + 50 * sizeof(int64_t), SEEK_SET) == 0 &&
+       std::fwrite(&bad, sizeof(bad), 1, f) == 1 ;
+  if (f) std::fclose(f) ;
+  if (! ok || ! checkReader(compressedName, "compressed reader, corrupt index")) ++ failures ;
+
+  // headers with a bad number of masses or keyframe interval are
+  // refused rather than sized from
+  ok = rejectsHeader(compressedName, 8, -1) && rejectsHeader(compressedName, 8, 0) &&
+       rejectsHeader(compressedName, 8, 1 << 30) && rejectsHeader(compressedName, 12, 0) &&
+       rejectsHeader(compressedName, 12, -5) && rejectsHeader(rawName, 8, -1) && rejectsHeader(rawName, 8, 0) ;
+  std::cout << "corrupt headers: " << (ok ? "ok" : "MISMATCH") << std::endl ;
+  if (!ok) ++ failures ;
+
+  // a rewritten trajectory does not reuse the index of the old one
+  record(rawName, compressedName, 0.3, 100) ;
+  ok = checkReader(compressedName, "compressed reader, stale index") && sameTrajectory(rawName, compressedName) ;
+  std::cout << "rewritten trajectory: " << (ok ? "ok" : "MISMATCH") << std::endl ;
+  if (!ok) ++ failures ;
+
+  std::remove(rawName.c_str()) ;
+  std::remove(compressedName.c_str()) ;
+  std::remove(indexName.c_str()) ;
+  std::remove((rawName + ".idx").c_str()) ;
+  return failures ? 1 : 0 ;
+}
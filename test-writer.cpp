@@ -0,0 +1,229 @@
+/** file: test-writer.cpp
+ ** brief: Tests the AsyncWriter policies against a slow sink
+ **/
+
+#include "reader.h"
+#include "testing.h"
+#include "trajectory.h"
+#include "writer.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define NUM_MASSES 5
+
+/* ---------------------------------------------------------------- */
+// class GatedSink : public FrameSink
+/* ---------------------------------------------------------------- */
+
+// Passes frames on to a file, but each writeFrame() waits until the
+// test releases it (or opens the gate for good) and then sleeps for
+// delay. While frames are held, the I/O thread is stuck and what the
+// simulation thread sees is exactly determined by its own pushes.
+
+class GatedSink : public FrameSink {
+  public:
+    GatedSink(FrameSink * next, bool open, int delayMs = 0)
+    : entered(0), next(next), open(open), credits(0), delay(delayMs) { }
+
+    void writeFrame(const Frame & frame) {
+      ++ entered ;
+      {
+        std::unique_lock<std::mutex> lock(mutex) ;
+        changed.wait(lock, [&] { return open || credits > 0 ; }) ;
+        if (!open) -- credits ;
+      }
+      if (delay > 0) std::this_thread::sleep_for(std::chrono::milliseconds(delay)) ;
+      next->writeFrame(frame) ;
+    }
+    void flush() { next->flush() ; }
+
+    void release(int n) {
+      std::lock_guard<std::mutex> lock(mutex) ;
+      credits += n ;
+      changed.notify_all() ;
+    }
+    void openGate() {
+      std::lock_guard<std::mutex> lock(mutex) ;
+      open = true ;
+      changed.notify_all() ;
+    }
+
+    std::atomic<int> entered ; // writeFrame() calls begun
+
+  private:
+    FrameSink * next ;
+    std::mutex mutex ;
+    std::condition_variable changed ;
+    bool open ;
+    int credits ;
+    int delay ;
+} ;
+
+/* ---------------------------------------------------------------- */
+// helpers
+/* ---------------------------------------------------------------- */
+
+// frame k: time k / 100, positions derived from k
+static void makeState(long k, std::vector<double> & positions, StateView & state) {
+  positions.resize(3 * NUM_MASSES) ;
+  for (int i = 0 ; i < 3 * NUM_MASSES ; ++i) positions[i] = k + 0.001 * i ;
+  state.step = k ;
+  state.time = 0.01 * k ;
+  state.numMasses = NUM_MASSES ;
+  state.positions = positions.data() ;
+  state.velocities = NULL ;
+}
+
+static bool push(AsyncWriter & writer, long k) {
+  std::vector<double> positions ;
+  StateView state ;
+  makeState(k, positions, state) ;
+  return writer.push(state) ;
+}
+
+// waits up to 10 s for condition
+static bool waitFor(const std::function<bool ()> & condition) {
+  for (int i = 0 ; i < 10000 ; ++i) {
+    if (condition()) return true ;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1)) ;
+  }
+  return condition() ;
+}
+
+// the file holds exactly the frames in accepted, in order
+static bool fileHolds(const std::string & fileName, const std::vector<long> & accepted) {
+  TrajectoryReader reader ;
+  if (! reader.open(fileName, false) || reader.getNumMasses() != NUM_MASSES ||
+      reader.getNumFrames() != (long)accepted.size()) return false ;
+  Frame frame ;
+  for (size_t j = 0 ; j < accepted.size() ; ++j) {
+    std::vector<double> positions ;
+    StateView state ;
+    makeState(accepted[j], positions, state) ;
+    if (! reader.readFrame((long)j, frame) || frame.time != state.time || frame.positions != positions) return false ;
+  }
+  return true ;
+}
+
+/* ---------------------------------------------------------------- */
+// main
+/* ---------------------------------------------------------------- */
+
+int main(int argc, char** argv) {
+  const std::string name = "test-writer.traj" ;
+  const int numBuffers = 4 ;
+  int failures = 0 ;
+
+  // BLOCK: every push waits for a frame, nothing is lost
+  {
+    RawTrajectoryWriter file(name, NUM_MASSES) ;
+    GatedSink sink(&file, true, 1) ;
+    AsyncWriter writer(&sink, NUM_MASSES, 2, AsyncWriter::BLOCK) ;
+    std::vector<long> accepted ;
+    bool ok = true ;
+    for (long k = 0 ; k < 40 ; ++k) {
+      ok = ok && push(writer, k) && writer.getQueueDepth() <= 2 ;
+      accepted.push_back(k) ;
+    }
+    writer.close() ;
+    file.close() ;
+    ok = ok && writer.getWrittenFrames() == 40 && writer.getDroppedFrames() == 0 && writer.getQueueDepth() == 0 ;
+    report("block, nothing lost", ok && fileHolds(name, accepted), failures) ;
+  }
+
+  // DROP: with the first frame held in the sink, the other buffers
+  // fill up and every later frame is dropped and counted
+  {
+    RawTrajectoryWriter file(name, NUM_MASSES) ;
+    GatedSink sink(&file, false) ;
+    AsyncWriter writer(&sink, NUM_MASSES, numBuffers, AsyncWriter::DROP) ;
+    std::vector<long> accepted ;
+    bool ok = push(writer, 0) && waitFor([&] { return sink.entered == 1 ; }) ;
+    accepted.push_back(0) ;
+    for (long k = 1 ; k < numBuffers ; ++k) {
+      ok = ok && push(writer, k) && writer.getQueueDepth() == k ;
+      accepted.push_back(k) ;
+    }
+    long refused = 0 ;
+    for (long k = numBuffers ; k < 20 ; ++k) {
+      if (! push(writer, k)) ++ refused ;
+    }
+    ok = ok && refused == 20 - numBuffers && writer.getDroppedFrames() == refused &&
+         writer.getQueueDepth() == numBuffers - 1 && writer.getWrittenFrames() == 0 ;
+
+    // one frame written frees one buffer, taken by the next push
+    sink.release(1) ;
+    ok = ok && waitFor([&] { return writer.getWrittenFrames() == 1 && sink.entered == 2 ; }) ;
+    ok = ok && writer.getQueueDepth() == numBuffers - 2 && push(writer, 20) && ! push(writer, 21) ;
+    accepted.push_back(20) ;
+    sink.openGate() ;
+    writer.close() ;
+    file.close() ;
+    ok = ok && writer.getWrittenFrames() == numBuffers + 1 && writer.getDroppedFrames() == refused + 1 ;
+    report("drop, counted exactly", ok && fileHolds(name, accepted), failures) ;
+  }
+
+  // DECIMATE: congestion doubles k, then with a frame freed just in
+  // time for every k-th push the file gets exactly those
+  {
+    RawTrajectoryWriter file(name, NUM_MASSES) ;
+    GatedSink sink(&file, false) ;
+    AsyncWriter writer(&sink, NUM_MASSES, numBuffers, AsyncWriter::DECIMATE) ;
+    std::vector<long> accepted ;
+    long k = 0, refused = 0 ;
+    bool ok = push(writer, k++) && waitFor([&] { return sink.entered == 1 ; }) ;
+    accepted.push_back(0) ;
+    for ( ; k < numBuffers ; ++k) {
+      ok = ok && push(writer, k) ;
+      accepted.push_back(k) ;
+    }
+    for ( ; writer.getDecimation() < 8 && k < 1000 ; ++k) {
+      if (push(writer, k)) accepted.push_back(k) ; else ++ refused ;
+    }
+    ok = ok && writer.getDecimation() == 8 && accepted.size() == (size_t)numBuffers ;
+    report("decimate, congestion raises k", ok, failures) ;
+
+    // steady: k stays 8 and only the multiples of 8 get through
+    int released = 0 ;
+    long start = k ;
+    for ( ; k < start + 100 ; ++k) {
+      if (k % 8 == 0) {
+        sink.release(1) ;
+        ++ released ;
+        ok = ok && waitFor([&] { return writer.getWrittenFrames() == released && sink.entered == released + 1 ; }) ;
+      }
+      if (push(writer, k)) accepted.push_back(k) ; else ++ refused ;
+    }
+    bool every = writer.getDecimation() == 8 && accepted.size() == (size_t)(numBuffers + released) ;
+    for (size_t j = numBuffers ; j < accepted.size() && every ; ++j) every = accepted[j] % 8 == 0 ;
+    ok = ok && every && writer.getDroppedFrames() == refused &&
+         writer.getQueueDepth() == numBuffers - 1 ;
+
+    // drained: k halves on every push that finds the queue empty
+    sink.openGate() ;
+    for (int j = 0 ; j < 3 ; ++j) {
+      long expected = (long)accepted.size() ;
+      ok = ok && waitFor([&] { return writer.getWrittenFrames() == expected && writer.getQueueDepth() == 0 ; }) ;
+      if (push(writer, k)) accepted.push_back(k) ; else ++ refused ;
+      ++ k ;
+    }
+    ok = ok && writer.getDecimation() == 1 ;
+    writer.close() ;
+    file.close() ;
+    ok = ok && writer.getWrittenFrames() == (long)accepted.size() && writer.getDroppedFrames() == refused &&
+         (long)accepted.size() + refused == k ;
+    report("decimate, every k-th frame kept", ok && fileHolds(name, accepted), failures) ;
+  }
+
+  std::remove(name.c_str()) ;
+  return failures ? 1 : 0 ;
+}
@@ -0,0 +1,18 @@
+/** file: testing.h
+ ** brief: Reporting shared by the test programs
+ **/
+
+#ifndef __testing__
+#define __testing__
+
+#include <iostream>
+#include <string>
+
+// prints "what: ok" or "what: MISMATCH" and counts the mismatches;
+// the tests return nonzero when failures is not 0
+inline void report(const std::string & what, bool ok, int & failures) {
+  std::cout << what << ": " << (ok ? "ok" : "MISMATCH") << std::endl ;
+  if (!ok) ++ failures ;
+}
+
+#endif
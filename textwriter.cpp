@@ -0,0 +1,115 @@
+/** file: textwriter.cpp
+ ** brief: Fast text trajectory writer - implementation
+ **/
+
+#include "textwriter.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <fcntl.h>
+#if defined(_WIN32)
+#include <io.h>
+#define write_fd _write
+#define close_fd _close
+#define open_fd(name) _open(name, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644)
+#else
+#include <unistd.h>
+#define write_fd ::write
+#define close_fd ::close
+#define open_fd(name) ::open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)
+#endif
+
+/* ---------------------------------------------------------------- */
+// class TextWriter : public FrameSink
+/* ---------------------------------------------------------------- */
+
+TextWriter::TextWriter(int fd, size_t bufferSize)
+: fd(fd), ownsFd(false), buffer(std::max(bufferSize, (size_t)4 * TEXT_WRITER_MAX_NUMBER)), used(0),
+  format(GENERAL), precision(6), fields(POSITION), time(false) { }
+
+TextWriter::TextWriter(std::string fileName, size_t bufferSize)
+: fd(-1), ownsFd(true), buffer(std::max(bufferSize, (size_t)4 * TEXT_WRITER_MAX_NUMBER)), used(0),
+  format(GENERAL), precision(6), fields(POSITION), time(false) {
+  fd = open_fd(fileName.c_str()) ;
+  if (fd < 0) {
+    std::cerr << "TextWriter: cannot open " << fileName << std::endl ;
+  }
+}
+
+TextWriter::~TextWriter() {
+  flush() ;
+  if (ownsFd && fd >= 0) close_fd(fd) ;
+}
+
+bool TextWriter::isOpen() const {
+  return fd >= 0 ;
+}
+
+void TextWriter::setFormat(Format _format, int _precision) {
+  format = _format ;
+  precision = std::min(std::max(_precision, 0), 17) ;
+}
+
+void TextWriter::setFields(unsigned _fields) {
+  fields = _fields ;
+}
+
+void TextWriter::setMasses(const std::vector<int> & _masses) {
+  masses = _masses ;
+}
+
+void TextWriter::setTime(bool _time) {
+  time = _time ;
+}
+
+void TextWriter::flush() {
+  const char * data = buffer.data() ;
+  size_t remaining = used ;
+  while (fd >= 0 && remaining > 0) {
+    long n = (long)write_fd(fd, data, (unsigned)remaining) ;
+    if (n <= 0) {
+      std::cerr << "TextWriter: write failed" << std::endl ;
+      break ;
+    }
+    data += n ;
+    remaining -= (size_t)n ;
+  }
+  used = 0 ;
+}
+
+void TextWriter::newline() {
+  if (used == buffer.size()) flush() ;
+  buffer[used++] = '\n' ;
+}
+
+void TextWriter::putVector(Vector3 v, unsigned shift) {
+  if (fields & (POSITION_X << shift)) put(v.x) ;
+  if (fields & (POSITION_Y << shift)) put(v.y) ;
+  if (fields & (POSITION_Z << shift)) put(v.z) ;
+}
+
+void TextWriter::write(const SpringMass & springmass) {
+  PROFILE_SCOPE(PHASE_OUTPUT) ;
+  const std::vector<Mass *> & list = springmass.getMassList() ;
+  if (time) put(springmass.getTime()) ;
+  size_t n = masses.empty() ? list.size() : masses.size() ;
+  for (size_t i = 0 ; i < n ; ++i) {
+    const Mass * mass = list[masses.empty() ? i : masses[i]] ;
+    if (fields & POSITION) putVector(mass->getPosition(), 0) ;
+    if (fields & VELOCITY) putVector(mass->getVelocity(), 3) ;
+    if (fields & FORCE) putVector(mass->getForce(), 6) ;
+  }
+  newline() ;
+}
+
+void TextWriter::writeFrame(const Frame & frame) {
+  if (time) put(frame.time) ;
+  size_t n = masses.empty() ? (size_t)frame.getNumMasses() : masses.size() ;
+  for (size_t i = 0 ; i < n ; ++i) {
+    const double * p = &frame.positions[3 * (masses.empty() ? i : masses[i])] ;
+    putVector(Vector3(p[0], p[1], p[2]), 0) ;
+  }
+  newline() ;
+}
@@ -0,0 +1,91 @@
+/** file: textwriter.h
+ ** brief: Fast text trajectory writer
+ **/
+
+#ifndef __textwriter__
+#define __textwriter__
+
+#include "trajectory.h"
+
+#include <charconv>
+#include <string>
+#include <vector>
+
+/* ---------------------------------------------------------------- */
+// class TextWriter : public FrameSink
+/* ---------------------------------------------------------------- */
+
+// Formats numbers with std::to_chars into a large reusable buffer and
+// hands the buffer to the OS with a single write() when it fills up,
+// instead of going through iostream and flushing every line.
+//
+// Each line is one frame: the selected fields of the selected masses,
+// every number followed by a space, as SpringMass::display() does.
+// The default GENERAL format with 6 digits reproduces the iostream
+// output exactly; SHORTEST prints the shortest string that reads back
+// to the same double.
+
+class TextWriter : public FrameSink {
+  public:
+    enum Format { GENERAL, FIXED, SHORTEST } ;
+    enum Field {
+      POSITION_X = 1 << 0, POSITION_Y = 1 << 1, POSITION_Z = 1 << 2,
+      VELOCITY_X = 1 << 3, VELOCITY_Y = 1 << 4, VELOCITY_Z = 1 << 5,
+      FORCE_X    = 1 << 6, FORCE_Y    = 1 << 7, FORCE_Z    = 1 << 8,
+      POSITION = POSITION_X | POSITION_Y | POSITION_Z,
+      VELOCITY = VELOCITY_X | VELOCITY_Y | VELOCITY_Z,
+      FORCE    = FORCE_X | FORCE_Y | FORCE_Z
+    } ;
+
+    // write to an open file descriptor (1 is the standard output)
+    TextWriter(int fd = 1, size_t bufferSize = 1 << 20) ;
+    TextWriter(std::string fileName, size_t bufferSize = 1 << 20) ;
+    ~TextWriter() ;
+    bool isOpen() const ;
+
+    void setFormat(Format format, int precision = 6) ;
+    void setFields(unsigned fields) ;
+    void setMasses(const std::vector<int> & masses) ; // empty selects all
+    void setTime(bool time) ;                          // prefix the time
+
+    void write(const SpringMass & springmass) ;
+    void writeFrame(const Frame & frame) ;   // positions only
+    void flush() ;
+
+  protected:
+    int fd ;
+    bool ownsFd ;
+    std::vector<char> buffer ;
+    size_t used ;
+    Format format ;
+    int precision ;
+    unsigned fields ;
+    bool time ;
+    std::vector<int> masses ;
+
+    void put(double value) ;
+    void newline() ;
+    void putVector(Vector3 v, unsigned shift) ;
+
+    TextWriter(const TextWriter &) ;
+    TextWriter & operator= (const TextWriter &) ;
+} ;
+
+// longest number put() can emit, plus the separator
+#define TEXT_WRITER_MAX_NUMBER 352
+
+inline void TextWriter::put(double value) {
+  if (buffer.size() - used < TEXT_WRITER_MAX_NUMBER) flush() ;
+  char * first = buffer.data() + used ;
+  char * last = buffer.data() + buffer.size() ;
+  std::to_chars_result r ;
+  switch (format) {
+    case FIXED: r = std::to_chars(first, last, value, std::chars_format::fixed, precision) ; break ;
+    case SHORTEST: r = std::to_chars(first, last, value) ; break ;
+    default: r = std::to_chars(first, last, value, std::chars_format::general, precision) ; break ;
+  }
+  *r.ptr++ = ' ' ;
+  used = r.ptr - buffer.data() ;
+}
+
+#endif /* defined(__textwriter__) */
@@ -0,0 +1,78 @@
+/** file: threadpool.cpp
+ ** brief: Fixed-size thread pool - implementation
+ **/
+
+#include "threadpool.h"
+
+/* ---------------------------------------------------------------- */
+// class ThreadPool
+/* ---------------------------------------------------------------- */
+
+ThreadPool::ThreadPool(int numThreads)
+: body(NULL), size(0), grain(1), next(0), pending(0), generation(0), stopping(false) {
+  for (int t = 1 ; t < numThreads ; ++t) {
+    workers.push_back(std::thread(&ThreadPool::work, this, t)) ;
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex) ;
+    stopping = true ;
+  }
+  wake.notify_all() ;
+  for (size_t t = 0 ; t < workers.size() ; ++t) workers[t].join() ;
+}
+
+int ThreadPool::getNumThreads() const {
+  return (int)workers.size() + 1 ;
+}
+
+void ThreadPool::runChunks(int thread) {
+  for (;;) {
+    size_t begin = next.fetch_add(grain) ;
+    if (begin >= size) break ;
+    size_t end = (begin + grain < size) ? begin + grain : size ;
+    (*body)(begin, end, thread) ;
+  }
+}
+
+void ThreadPool::work(int thread) {
+  long seen = 0 ;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex) ;
+      while (!stopping && generation == seen) wake.wait(lock) ;
+      if (stopping) return ;
+      seen = generation ;
+    }
+    runChunks(thread) ;
+    {
+      std::lock_guard<std::mutex> lock(mutex) ;
+      if (-- pending == 0) done.notify_one() ;
+    }
+  }
+}
+
+void ThreadPool::parallelFor(size_t n, size_t _grain, const Body & _body) {
+  if (n == 0) return ;
+  if (_grain == 0) _grain = 1 ;
+  if (workers.empty() || n <= _grain) {
+    _body(0, n, 0) ;
+    return ;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex) ;
+    body = &_body ;
+    size = n ;
+    grain = _grain ;
+    next.store(0) ;
+    pending = (int)workers.size() ;
+    ++ generation ;
+  }
+  wake.notify_all() ;
+  runChunks(0) ;
+  std::unique_lock<std::mutex> lock(mutex) ;
+  while (pending > 0) done.wait(lock) ;
+  body = NULL ;
+}
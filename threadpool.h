@@ -0,0 +1,57 @@
+/** file: threadpool.h
+ ** brief: Fixed-size thread pool with a blocking parallel for
+ **/
+
+#ifndef __threadpool__
+#define __threadpool__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* ---------------------------------------------------------------- */
+// class ThreadPool
+/* ---------------------------------------------------------------- */
+
+// The calling thread takes part in the work, so a pool of n threads
+// starts n - 1 workers. Chunks are claimed in increasing order from a
+// shared counter, so which thread runs which chunk varies from call
+// to call: callers needing reproducible results must not depend on it.
+
+class ThreadPool {
+  public:
+    typedef std::function<void (size_t begin, size_t end, int thread)> Body ;
+
+    ThreadPool(int numThreads) ;
+    ~ThreadPool() ;
+    int getNumThreads() const ;
+
+    // run body over [0, n) in chunks of at most grain elements and
+    // return when all of them are done; thread is in [0, getNumThreads())
+    void parallelFor(size_t n, size_t grain, const Body & body) ;
+
+  private:
+    std::vector<std::thread> workers ;
+    std::mutex mutex ;
+    std::condition_variable wake ;
+    std::condition_variable done ;
+    const Body * body ;
+    size_t size ;
+    size_t grain ;
+    std::atomic<size_t> next ;
+    int pending ;
+    long generation ;
+    bool stopping ;
+
+    void work(int thread) ;
+    void runChunks(int thread) ;
+
+    ThreadPool(const ThreadPool &) ;
+    ThreadPool & operator= (const ThreadPool &) ;
+} ;
+
+#endif /* defined(__threadpool__) */
@@ -0,0 +1,98 @@
+/** file: trajectory-slice.cpp
+ ** brief: Exports a slice of a recorded trajectory to CSV
+ **/
+
+#include "reader.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// Each output row is a frame: the time followed by x,y,z of the
+// selected mass, or of all the masses. There is no header row, so
+// MATLAB's load() reads the file directly; plot_springmass.m and
+// springmass_trajectory.m read springmass.csv in this layout.
+
+static void usage() {
+  std::cerr << "usage: trajectory-slice FILE [-m MASS] [-f FIRST] [-l LAST] [-s STRIDE] [-o OUT.csv]" << std::endl
+            << "  -m MASS    export only this mass (default: all)" << std::endl
+            << "  -f FIRST   first frame (default: 0)" << std::endl
+            << "  -l LAST    one past the last frame (default: end)" << std::endl
+            << "  -s STRIDE  frame stride (default: 1)" << std::endl
+            << "  -o OUT     output file (default: standard output)" << std::endl ;
+}
+
+int main(int argc, char** argv) {
+
+  // parse arguments
+  const char * fileName = NULL ;
+  const char * outName = NULL ;
+  int mass = -1 ;
+  long first = 0 ;
+  long last = -1 ;
+  long stride = 1 ;
+  bool negative = false ;
+  for (int i = 1 ; i < argc ; ++i) {
+    bool hasValue = i + 1 < argc ;
+    if (!std::strcmp(argv[i], "-m") && hasValue) {
+      mass = std::atoi(argv[++i]) ;
+      negative = negative || mass < 0 ;
+    } else if (!std::strcmp(argv[i], "-f") && hasValue) {
+      first = std::atol(argv[++i]) ;
+      negative = negative || first < 0 ;
+    } else if (!std::strcmp(argv[i], "-l") && hasValue) {
+      last = std::atol(argv[++i]) ;
+      negative = negative || last < 0 ;
+    }
+    else if (!std::strcmp(argv[i], "-s") && hasValue) stride = std::atol(argv[++i]) ;
+    else if (!std::strcmp(argv[i], "-o") && hasValue) outName = argv[++i] ;
+    else if (argv[i][0] != '-' && !fileName) fileName = argv[i] ;
+    else { usage() ; return 1 ; }
+  }
+  if (!fileName || negative || stride < 1) { usage() ; return 1 ; }
+
+  // open
+  TrajectoryReader reader ;
+  if (! reader.open(fileName)) return 1 ;
+  if (last < 0 || last > reader.getNumFrames()) last = reader.getNumFrames() ;
+  if (mass >= reader.getNumMasses()) {
+    std::cerr << "trajectory-slice: mass " << mass << " out of range, the file has "
+              << reader.getNumMasses() << " masses" << std::endl ;
+    return 1 ;
+  }
+
+  FILE * out = outName ? std::fopen(outName, "w") : stdout ;
+  if (!out) {
+    std::cerr << "trajectory-slice: cannot open " << outName << std::endl ;
+    return 1 ;
+  }
+
+  // export
+  bool ok = true ;
+  if (mass >= 0) {
+    std::vector<double> times, xyz ;
+    ok = reader.readMass(mass, first, last, stride, times, xyz) ;
+    for (size_t i = 0 ; ok && i < times.size() ; ++i) {
+      std::fprintf(out, "%.9g,%.9g,%.9g,%.9g\n", times[i], xyz[3*i], xyz[3*i+1], xyz[3*i+2]) ;
+    }
+  } else {
+    Frame frame ;
+    for (long k = first ; ok && k < last ; k += stride) {
+      ok = reader.readFrame(k, frame) ;
+      if (!ok) break ;
+      std::fprintf(out, "%.9g", frame.time) ;
+      for (size_t i = 0 ; i < frame.positions.size() ; ++i) {
+        std::fprintf(out, ",%.9g", frame.positions[i]) ;
+      }
+      std::fputc('\n', out) ;
+    }
+  }
+
+  if (out != stdout) std::fclose(out) ;
+  if (!ok) {
+    std::cerr << "trajectory-slice: corrupt trajectory " << fileName << std::endl ;
+    return 1 ;
+  }
+  return 0 ;
+}
@@ -0,0 +1,379 @@
+/** file: trajectory.cpp
+ ** brief: Trajectory frames and file formats - implementation
+ **/
+
+#include "trajectory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+/* ---------------------------------------------------------------- */
+// class Frame
+/* ---------------------------------------------------------------- */
+
+void Frame::resize(int numMasses) {
+  positions.resize(3 * numMasses) ;
+}
+
+int Frame::getNumMasses() const {
+  return (int)positions.size() / 3 ;
+}
+
+void Frame::capture(const SpringMass & springmass) {
+  const std::vector<Mass *> & masses = springmass.getMassList() ;
+  positions.resize(3 * masses.size()) ;
+  double * out = positions.data() ;
+  for (std::vector<Mass *>::const_iterator it = masses.begin(); it != masses.end(); ++it) {
+    Vector3 p = (*it)->getPosition() ;
+    *out++ = p.x ;
+    *out++ = p.y ;
+    *out++ = p.z ;
+  }
+  time = springmass.getTime() ;
+}
+
+void Frame::capture(const StateView & state) {
+  positions.assign(state.positions, state.positions + 3 * state.numMasses) ;
+  time = state.time ;
+}
+
+/* ---------------------------------------------------------------- */
+// class RawTrajectoryWriter : public FrameSink
+/* ---------------------------------------------------------------- */
+
+RawTrajectoryWriter::RawTrajectoryWriter(std::string fileName, int numMasses)
+: file(NULL), numMasses(numMasses) {
+  file = std::fopen(fileName.c_str(), "wb") ;
+  if (!file) {
+    std::cerr << "RawTrajectoryWriter: cannot open " << fileName << std::endl ;
+    return ;
+  }
+  // large stdio buffer so that a frame is rarely a syscall of its own
+  std::setvbuf(file, NULL, _IOFBF, 1 << 20) ;
+
+  char header [RAW_HEADER_SIZE] ;
+  std::memset(header, 0, sizeof(header)) ;
+  std::memcpy(header, RAW_TRAJECTORY_MAGIC, 8) ;
+  int n = numMasses ;
+  std::memcpy(header + 8, &n, sizeof(n)) ;
+  std::fwrite(header, 1, sizeof(header), file) ;
+}
+
+RawTrajectoryWriter::~RawTrajectoryWriter() {
+  close() ;
+}
+
+bool RawTrajectoryWriter::close() {
+  if (!file) return false ;
+  bool ok = !std::ferror(file) ;
+  ok = (std::fclose(file) == 0) && ok ;
+  file = NULL ;
+  if (!ok) std::cerr << "RawTrajectoryWriter: write failed" << std::endl ;
+  return ok ;
+}
+
+bool RawTrajectoryWriter::isOpen() const {
+  return file != NULL ;
+}
+
+void RawTrajectoryWriter::writeFrame(const Frame & frame) {
+  if (!file) return ;
+  if (frame.getNumMasses() != numMasses) {
+    std::cerr << "RawTrajectoryWriter: frame has " << frame.getNumMasses()
+              << " masses, expected " << numMasses << std::endl ;
+    return ;
+  }
+  std::fwrite(&frame.time, sizeof(double), 1, file) ;
+  std::fwrite(frame.positions.data(), sizeof(double), frame.positions.size(), file) ;
+}
+
+void RawTrajectoryWriter::flush() {
+  if (file) std::fflush(file) ;
+}
+
+/* ---------------------------------------------------------------- */
+// class TrajectoryCodec
+/* ---------------------------------------------------------------- */
+
+static inline uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63) ; }
+static inline int64_t unzigzag(uint64_t u) { return (int64_t)(u >> 1) ^ -(int64_t)(u & 1) ; }
+
+static inline int bitWidth(uint64_t v) {
+  int w = 0 ;
+  while (v) { ++ w ; v >>= 1 ; }
+  return w ;
+}
+
+// append values as blocks of CODEC_BLOCK_SIZE, each a width byte
+// followed by the values packed LSB first with that many bits
+static void packBlocks(const uint64_t * values, size_t n, std::vector<uint8_t> & out) {
+  for (size_t begin = 0 ; begin < n ; begin += CODEC_BLOCK_SIZE) {
+    size_t end = std::min(n, begin + CODEC_BLOCK_SIZE) ;
+    uint64_t all = 0 ;
+    for (size_t i = begin ; i < end ; ++i) all |= values[i] ;
+    int width = bitWidth(all) ;
+    out.push_back((uint8_t)width) ;
+    if (width == 0) continue ;
+
+    uint64_t acc = 0 ;
+    int bits = 0 ;
+    for (size_t i = begin ; i < end ; ++i) {
+      uint64_t v = values[i] ;
+      acc |= v << bits ;
+      if (bits + width >= 64) {
+        for (int b = 0 ; b < 8 ; ++b) out.push_back((uint8_t)(acc >> (8*b))) ;
+        acc = (bits == 0) ? 0 : v >> (64 - bits) ;
+        bits = bits + width - 64 ;
+      } else {
+        bits += width ;
+      }
+    }
+    for ( ; bits > 0 ; bits -= 8, acc >>= 8) out.push_back((uint8_t)acc) ;
+  }
+}
+
+// decode the values in the ascending ranges [first, last) given as
+// numRanges pairs of the n packed values into the corresponding
+// entries of values; blocks outside the ranges are skipped by reading
+// only their width byte
+static bool unpackBlocks(const uint8_t * data, size_t size, uint64_t * values, size_t n,
+                         const size_t * ranges, int numRanges) {
+  const uint8_t * end = data + size ;
+  size_t last = (numRanges > 0) ? ranges[2 * numRanges - 1] : 0 ;
+  for (size_t begin = 0 ; begin < n && begin < last ; begin += CODEC_BLOCK_SIZE) {
+    size_t count = std::min(n - begin, (size_t)CODEC_BLOCK_SIZE) ;
+    if (data >= end) return false ;
+    int width = *data++ ;
+    if (width > 64) return false ;
+    size_t bytes = (count * width + 7) / 8 ;
+    if ((size_t)(end - data) < bytes) return false ;
+
+    for (int r = 0 ; r < numRanges ; ++r) {
+      if (ranges[2*r] >= begin + count || ranges[2*r+1] <= begin) continue ;
+      size_t i0 = std::max(ranges[2*r], begin) - begin ;
+      size_t i1 = std::min(ranges[2*r+1], begin + count) - begin ;
+      size_t bit = i0 * width ;
+      for (size_t i = i0 ; i < i1 ; ++i) {
+        uint64_t v = 0 ;
+        for (int got = 0 ; got < width ; ) {
+          int shift = (int)(bit & 7) ;
+          int take = std::min(8 - shift, width - got) ;
+          v |= (uint64_t)((data[bit >> 3] >> shift) & ((1u << take) - 1)) << got ;
+          got += take ;
+          bit += take ;
+        }
+        values[begin + i] = v ;
+      }
+    }
+    data += bytes ;
+  }
+  return last < n || data == end ;
+}
+
+TrajectoryCodec::TrajectoryCodec()
+: numMasses(0), keyframeInterval(1), tolerance(0), frameNumber(0), sinceKeyframe(0) {
+  quantum[0] = quantum[1] = quantum[2] = 1 ;
+}
+
+TrajectoryCodec::TrajectoryCodec(int numMasses, Vector3 boxMin, Vector3 boxMax,
+                                 double tolerance, int keyframeInterval)
+: numMasses(numMasses), keyframeInterval(std::max(1, keyframeInterval)), tolerance(tolerance),
+  boxMin(boxMin), boxMax(boxMax), frameNumber(0), sinceKeyframe(0),
+  previous(3 * numMasses), previous2(3 * numMasses), previous3(3 * numMasses),
+  residuals(3 * numMasses) {
+  Vector3 extent = boxMax - boxMin ;
+  quantum[0] = tolerance * extent.x ;
+  quantum[1] = tolerance * extent.y ;
+  quantum[2] = tolerance * extent.z ;
+  for (int a = 0 ; a < 3 ; ++a) if (quantum[a] <= 0) quantum[a] = 1 ;
+}
+
+void TrajectoryCodec::reset() {
+  frameNumber = 0 ;
+  sinceKeyframe = 0 ;
+}
+
+// prediction of coordinate i in a delta frame
+inline int64_t TrajectoryCodec::predict(size_t i) const {
+  if (sinceKeyframe == 0) return previous[i] ;
+  if (sinceKeyframe == 1) return 2 * previous[i] - previous2[i] ;
+  return 3 * (previous[i] - previous2[i]) + previous3[i] ;
+}
+
+inline void TrajectoryCodec::advance(size_t i, int64_t q) {
+  previous3[i] = previous2[i] ;
+  previous2[i] = previous[i] ;
+  previous[i] = q ;
+}
+
+TrajectoryCodec::Kind TrajectoryCodec::encode(const Frame & frame, std::vector<uint8_t> & out) {
+  const double origin [3] = {boxMin.x, boxMin.y, boxMin.z} ;
+  const double upper [3] = {boxMax.x, boxMax.y, boxMax.z} ;
+  Kind kind = (frameNumber % keyframeInterval == 0) ? KEYFRAME : DELTA ;
+  size_t n = 3 * (size_t)numMasses ;
+
+  // coordinate i = 3 * mass + axis goes to residual axis * numMasses + mass
+  for (size_t m = 0 ; m < (size_t)numMasses ; ++m) {
+    for (int a = 0 ; a < 3 ; ++a) {
+      size_t i = 3 * m + a ;
+      double p = std::min(std::max(frame.positions[i], origin[a]), upper[a]) ;
+      int64_t q = (int64_t)std::llround((p - origin[a]) / quantum[a]) ;
+      int64_t prediction = (kind == DELTA) ? predict(i) : 0 ;
+      residuals[a * (size_t)numMasses + m] = zigzag(q - prediction) ;
+      advance(i, q) ;
+    }
+  }
+  packBlocks(residuals.data(), n, out) ;
+
+  sinceKeyframe = (kind == KEYFRAME) ? 0 : sinceKeyframe + 1 ;
+  ++ frameNumber ;
+  return kind ;
+}
+
+bool TrajectoryCodec::decode(Kind kind, const uint8_t * data, size_t size, Frame & frame) {
+  size_t n = 3 * (size_t)numMasses ;
+  frame.positions.resize(n) ;
+  return decodeRange(kind, data, size, 0, n, frame.positions.data()) ;
+}
+
+bool TrajectoryCodec::decodeRange(Kind kind, const uint8_t * data, size_t size,
+                                  size_t first, size_t last, double * out) {
+  const double origin [3] = {boxMin.x, boxMin.y, boxMin.z} ;
+  size_t n = 3 * (size_t)numMasses ;
+  if (last > n || first > last) return false ;
+
+  // the masses [lo, hi) with a coordinate of axis a in the range, and
+  // where their residuals are
+  size_t lo [3], hi [3], ranges [6] ;
+  for (int a = 0 ; a < 3 ; ++a) {
+    lo[a] = (first + 2 - a) / 3 ;
+    hi[a] = std::max(lo[a], (last + 2 - a) / 3) ;
+    ranges[2*a] = a * (size_t)numMasses + lo[a] ;
+    ranges[2*a+1] = a * (size_t)numMasses + hi[a] ;
+  }
+  if (! unpackBlocks(data, size, residuals.data(), n, ranges, 3)) return false ;
+
+  for (int a = 0 ; a < 3 ; ++a) {
+    for (size_t m = lo[a] ; m < hi[a] ; ++m) {
+      size_t i = 3 * m + a ;
+      int64_t prediction = (kind == DELTA) ? predict(i) : 0 ;
+      int64_t q = prediction + unzigzag(residuals[a * (size_t)numMasses + m]) ;
+      advance(i, q) ;
+      out[i - first] = origin[a] + q * quantum[a] ;
+    }
+  }
+
+  sinceKeyframe = (kind == KEYFRAME) ? 0 : sinceKeyframe + 1 ;
+  ++ frameNumber ;
+  return true ;
+}
+
+/* ---------------------------------------------------------------- */
+// class CompressedTrajectoryWriter : public FrameSink
+/* ---------------------------------------------------------------- */
+
+template <typename T>
+static void appendBytes(std::vector<uint8_t> & out, const T & value) {
+  const uint8_t * bytes = (const uint8_t *)&value ;
+  out.insert(out.end(), bytes, bytes + sizeof(T)) ;
+}
+
+// union of the boxes of all the masses
+static void springMassBox(const SpringMass & springmass, Vector3 & boxMin, Vector3 & boxMax) {
+  const std::vector<Mass *> & masses = springmass.getMassList() ;
+  boxMin = Vector3(-1,-1,-1) ;
+  boxMax = Vector3(+1,+1,+1) ;
+  for (size_t i = 0 ; i < masses.size() ; ++i) {
+    Vector3 a = masses[i]->getBoxMin() ;
+    Vector3 b = masses[i]->getBoxMax() ;
+    if (i == 0) { boxMin = a ; boxMax = b ; continue ; }
+    boxMin = Vector3(std::min(boxMin.x, a.x), std::min(boxMin.y, a.y), std::min(boxMin.z, a.z)) ;
+    boxMax = Vector3(std::max(boxMax.x, b.x), std::max(boxMax.y, b.y), std::max(boxMax.z, b.z)) ;
+  }
+}
+
+CompressedTrajectoryWriter::CompressedTrajectoryWriter(std::string fileName, const SpringMass & springmass,
+                                                       double tolerance, int keyframeInterval)
+: file(NULL), numFrames(0), offset(0), failed(false) {
+  Vector3 boxMin, boxMax ;
+  springMassBox(springmass, boxMin, boxMax) ;
+  codec = TrajectoryCodec(springmass.getNumMasses(), boxMin, boxMax, tolerance, keyframeInterval) ;
+
+  file = std::fopen(fileName.c_str(), "wb") ;
+  if (!file) {
+    std::cerr << "CompressedTrajectoryWriter: cannot open " << fileName << std::endl ;
+    return ;
+  }
+  std::setvbuf(file, NULL, _IOFBF, 1 << 20) ;
+
+  buffer.clear() ;
+  buffer.insert(buffer.end(), COMPRESSED_TRAJECTORY_MAGIC, COMPRESSED_TRAJECTORY_MAGIC + 8) ;
+  appendBytes(buffer, (int32_t)codec.getNumMasses()) ;
+  appendBytes(buffer, (int32_t)codec.getKeyframeInterval()) ;
+  appendBytes(buffer, tolerance) ;
+  appendBytes(buffer, boxMin) ;
+  appendBytes(buffer, boxMax) ;
+  failed = std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size() ;
+  offset = (long)buffer.size() ;
+}
+
+CompressedTrajectoryWriter::~CompressedTrajectoryWriter() {
+  close() ;
+}
+
+bool CompressedTrajectoryWriter::close() {
+  if (!file) return false ;
+  buffer.clear() ;
+  for (size_t k = 0 ; k < keyframes.size() ; k += 2) {
+    appendBytes(buffer, keyframes[k]) ;
+    appendBytes(buffer, keyframes[k+1]) ;
+  }
+  appendBytes(buffer, (int64_t)(keyframes.size() / 2)) ;
+  appendBytes(buffer, (int64_t)numFrames) ;
+  buffer.insert(buffer.end(), COMPRESSED_INDEX_MAGIC, COMPRESSED_INDEX_MAGIC + 8) ;
+  bool ok = !failed && std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size() ;
+  ok = (std::fclose(file) == 0) && ok ;
+  file = NULL ;
+  if (!ok) std::cerr << "CompressedTrajectoryWriter: write failed" << std::endl ;
+  return ok ;
+}
+
+bool CompressedTrajectoryWriter::isOpen() const {
+  return file != NULL ;
+}
+
+void CompressedTrajectoryWriter::writeFrame(const Frame & frame) {
+  if (!file) return ;
+  if (frame.getNumMasses() != codec.getNumMasses()) {
+    std::cerr << "CompressedTrajectoryWriter: frame has " << frame.getNumMasses()
+              << " masses, expected " << codec.getNumMasses() << std::endl ;
+    return ;
+  }
+
+  // reserve the record header, encode, then fill the header in
+  buffer.resize(COMPRESSED_RECORD_HEADER_SIZE) ;
+  TrajectoryCodec::Kind kind = codec.encode(frame, buffer) ;
+  uint32_t size = (uint32_t)(buffer.size() - sizeof(uint32_t)) ;
+  uint8_t kindByte = (uint8_t)kind ;
+  std::memcpy(&buffer[0], &size, sizeof(size)) ;
+  std::memcpy(&buffer[4], &kindByte, 1) ;
+  std::memcpy(&buffer[5], &frame.time, sizeof(double)) ;
+
+  if (kind == TrajectoryCodec::KEYFRAME) {
+    keyframes.push_back(numFrames) ;
+    keyframes.push_back(offset) ;
+  }
+  if (std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) failed = true ;
+  offset += (long)buffer.size() ;
+  ++ numFrames ;
+}
+
+void CompressedTrajectoryWriter::flush() {
+  if (file) std::fflush(file) ;
+}
+
+long CompressedTrajectoryWriter::getBytesWritten() const {
+  return offset ;
+}
@@ -0,0 +1,176 @@
+/** file: trajectory.h
+ ** brief: Trajectory frames and file formats
+ **/
+
+#ifndef __trajectory__
+#define __trajectory__
+
+#include "springmass.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/* ---------------------------------------------------------------- */
+// class Frame
+/* ---------------------------------------------------------------- */
+
+// A snapshot of the mass positions at one instant, stored as
+// x y z triplets in the order of SpringMass::getMassList().
+
+class Frame {
+  public:
+    double time ;
+    std::vector<double> positions ;
+
+    Frame() : time(0) { }
+    void resize(int numMasses) ;
+    int getNumMasses() const ;
+    void capture(const SpringMass & springmass) ;
+    void capture(const StateView & state) ;
+} ;
+
+/* ---------------------------------------------------------------- */
+// class FrameSink
+/* ---------------------------------------------------------------- */
+
+class FrameSink {
+  public:
+    virtual ~FrameSink() { }
+    virtual void writeFrame(const Frame & frame) = 0 ;
+    virtual void flush() { }
+    // finish the file; false if anything failed to reach it
+    virtual bool close() { flush() ; return true ; }
+} ;
+
+/* ---------------------------------------------------------------- */
+// class RawTrajectoryWriter : public FrameSink
+/* ---------------------------------------------------------------- */
+
+// Raw binary trajectory, native byte order:
+//   header: "SMTRAJ01" (8 bytes), int32 numMasses, int32 reserved
+//   frame:  double time, 3 * numMasses doubles
+// Every frame has the same size, so frame k starts at
+// RAW_HEADER_SIZE + k * rawFrameSize(numMasses).
+
+#define RAW_TRAJECTORY_MAGIC "SMTRAJ01"
+#define RAW_HEADER_SIZE 16
+
+inline long rawFrameSize(int numMasses) { return (long)sizeof(double) * (1 + 3 * (long)numMasses) ; }
+
+class RawTrajectoryWriter : public FrameSink {
+  public:
+    RawTrajectoryWriter(std::string fileName, int numMasses) ;
+    ~RawTrajectoryWriter() ;
+    bool isOpen() const ;
+    void writeFrame(const Frame & frame) ;
+    void flush() ;
+    bool close() ;
+
+  protected:
+    FILE * file ;
+    int numMasses ;
+} ;
+
+/* ---------------------------------------------------------------- */
+// class TrajectoryCodec
+/* ---------------------------------------------------------------- */
+
+// Lossy frame codec. Coordinates are quantized to a grid whose step is
+// tolerance * (box extent) along each axis, then predicted from the
+// previous frames (delta against the previous frame right after a
+// keyframe, linear extrapolation from the previous two on the next
+// frame, quadratic from the previous three afterwards). The zig-zag
+// coded residuals are laid out one axis after the other, so that an
+// axis along which nothing moves (z in a planar scene) costs a byte
+// per block, and bit-packed in blocks of CODEC_BLOCK_SIZE values, each
+// block prefixed by one byte holding its bit width. Every
+// keyframeInterval frames a keyframe stores absolute quantized values
+// so that decoding can start there.
+
+#define CODEC_BLOCK_SIZE 64
+
+class TrajectoryCodec {
+  public:
+    enum Kind { KEYFRAME = 0, DELTA = 1 } ;
+
+    TrajectoryCodec() ;
+    TrajectoryCodec(int numMasses, Vector3 boxMin, Vector3 boxMax, double tolerance, int keyframeInterval) ;
+
+    int getNumMasses() const { return numMasses ; }
+    int getKeyframeInterval() const { return keyframeInterval ; }
+    double getTolerance() const { return tolerance ; }
+    Vector3 getBoxMin() const { return boxMin ; }
+    Vector3 getBoxMax() const { return boxMax ; }
+
+    // the frame number (since construction or reset) decides the kind
+    Kind encode(const Frame & frame, std::vector<uint8_t> & out) ;
+    bool decode(Kind kind, const uint8_t * data, size_t size, Frame & frame) ;
+    // decode only the coordinates [first, last) of a record; successive
+    // calls must use the same range since the predictor state is per value
+    bool decodeRange(Kind kind, const uint8_t * data, size_t size,
+                     size_t first, size_t last, double * out) ;
+    void reset() ;
+
+  protected:
+    int numMasses ;
+    int keyframeInterval ;
+    double tolerance ;
+    Vector3 boxMin ;
+    Vector3 boxMax ;
+    double quantum [3] ;
+    long frameNumber ;
+    long sinceKeyframe ;
+    std::vector<int64_t> previous ;
+    std::vector<int64_t> previous2 ;
+    std::vector<int64_t> previous3 ;
+    std::vector<uint64_t> residuals ;
+
+    int64_t predict(size_t i) const ;
+    void advance(size_t i, int64_t q) ;
+} ;
+
+/* ---------------------------------------------------------------- */
+// class CompressedTrajectoryWriter : public FrameSink
+/* ---------------------------------------------------------------- */
+
+// Compressed trajectory file:
+//   header:  "SMTRAJZ2", int32 numMasses, int32 keyframeInterval,
+//            double tolerance, double boxMin[3], double boxMax[3]
+//   record:  uint32 size, uint8 kind, double time, payload
+//            (size counts kind, time and payload)
+//   footer:  keyframe index of (int64 frame, int64 offset) pairs,
+//            int64 numKeyframes, int64 numFrames, "SMTRIDX1"
+// The footer is written by close() (or the destructor); a truncated
+// file is still readable sequentially. On cloth:100x100 over 500 steps
+// at the default tolerance this is about 20x smaller than the raw
+// format.
+
+#define COMPRESSED_TRAJECTORY_MAGIC "SMTRAJZ2"
+#define COMPRESSED_INDEX_MAGIC "SMTRIDX1"
+#define COMPRESSED_HEADER_SIZE 72
+#define COMPRESSED_RECORD_HEADER_SIZE 13
+
+class CompressedTrajectoryWriter : public FrameSink {
+  public:
+    CompressedTrajectoryWriter(std::string fileName, const SpringMass & springmass,
+                               double tolerance = 1e-5, int keyframeInterval = 256) ;
+    ~CompressedTrajectoryWriter() ;
+    bool isOpen() const ;
+    void writeFrame(const Frame & frame) ;
+    void flush() ;
+    bool close() ;
+    long getBytesWritten() const ;
+
+  protected:
+    FILE * file ;
+    TrajectoryCodec codec ;
+    std::vector<uint8_t> buffer ;
+    std::vector<int64_t> keyframes ;
+    long numFrames ;
+    long offset ;
+    bool failed ;
+} ;
+
+#endif /* defined(__trajectory__) */
@@ -0,0 +1,51 @@
+/** file: triplebuffer.h
+ ** brief: Lock-free triple buffer
+ **/
+
+#ifndef __triplebuffer__
+#define __triplebuffer__
+
+#include <atomic>
+
+/* ---------------------------------------------------------------- */
+// class TripleBuffer
+/* ---------------------------------------------------------------- */
+
+// Hands the latest value from one writer thread to one reader thread
+// without either of them ever waiting. The writer fills the back slot
+// and publishes it by swapping it with the middle one; the reader
+// swaps the middle slot with its front one when something new was
+// published. Intermediate values the reader is too slow to see are
+// simply overwritten.
+
+template <typename T>
+class TripleBuffer {
+  public:
+    TripleBuffer() : middle(1), back(2), front(0) { }
+
+    // writer side
+    T & getBack() { return slots[back] ; }
+    void publish() {
+      back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX ;
+    }
+
+    // reader side: returns true if the front slot changed
+    bool update() {
+      if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false ;
+      front = middle.exchange(front, std::memory_order_acq_rel) & INDEX ;
+      return true ;
+    }
+    const T & getFront() const { return slots[front] ; }
+
+  private:
+    enum { INDEX = 3, FRESH = 4 } ;
+    T slots [3] ;
+    alignas(64) std::atomic<int> middle ;
+    alignas(64) int back ;   // writer only
+    alignas(64) int front ;  // reader only
+
+    TripleBuffer(const TripleBuffer &) ;
+    TripleBuffer & operator= (const TripleBuffer &) ;
+} ;
+
+#endif /* defined(__triplebuffer__) */
@@ -0,0 +1,128 @@
+/** file: writer.cpp
+ ** brief: Asynchronous trajectory writer - implementation
+ **/
+
+#include "writer.h"
+#include "profiler.h"
+
+#include <chrono>
+
+#define MAX_DECIMATION 1024
+
+/* ---------------------------------------------------------------- */
+// class AsyncWriter
+/* ---------------------------------------------------------------- */
+
+// spin briefly, then yield, then sleep: keeps latency low when the
+// other side is about to respond without burning a core when idle
+static void backoff(int & spins) {
+  if (spins < 64) {
+    ++ spins ;
+  } else if (spins < 128) {
+    ++ spins ;
+    std::this_thread::yield() ;
+  } else {
+    std::this_thread::sleep_for(std::chrono::microseconds(100)) ;
+  }
+}
+
+AsyncWriter::AsyncWriter(FrameSink * sink, int numMasses, int numBuffers, Policy policy)
+: sink(sink), policy(policy), pool(numBuffers),
+  freeFrames(numBuffers), fullFrames(numBuffers),
+  closing(false), dropped(0), written(0), pushed(0), decimation(1) {
+  for (int i = 0 ; i < numBuffers ; ++i) {
+    pool[i].resize(numMasses) ;
+    freeFrames.push(i) ;
+  }
+  thread = std::thread(&AsyncWriter::loop, this) ;
+}
+
+AsyncWriter::~AsyncWriter() {
+  close() ;
+}
+
+// a free frame, or -1 if the new frame is to be dropped
+int AsyncWriter::acquire() {
+  if (closing.load()) return -1 ;
+
+  if (policy == DECIMATE) {
+    if (decimation > 1 && fullFrames.size() == 0) {
+      decimation /= 2 ;
+    }
+    if ((pushed++) % decimation != 0) {
+      dropped.fetch_add(1, std::memory_order_relaxed) ;
+      return -1 ;
+    }
+  }
+
+  int index ;
+  if (! freeFrames.pop(index)) {
+    if (policy == BLOCK) {
+      int spins = 0 ;
+      while (! freeFrames.pop(index)) backoff(spins) ;
+    } else {
+      if (policy == DECIMATE && decimation < MAX_DECIMATION) decimation *= 2 ;
+      dropped.fetch_add(1, std::memory_order_relaxed) ;
+      return -1 ;
+    }
+  }
+  return index ;
+}
+
+bool AsyncWriter::push(const SpringMass & springmass) {
+  PROFILE_SCOPE(PHASE_OUTPUT) ;
+  int index = acquire() ;
+  if (index < 0) return false ;
+  pool[index].capture(springmass) ;
+  fullFrames.push(index) ; // cannot fail, there are only pool.size() indices
+  return true ;
+}
+
+bool AsyncWriter::push(const StateView & state) {
+  PROFILE_SCOPE(PHASE_OUTPUT) ;
+  int index = acquire() ;
+  if (index < 0) return false ;
+  pool[index].capture(state) ;
+  fullFrames.push(index) ;
+  return true ;
+}
+
+void AsyncWriter::loop() {
+  int spins = 0 ;
+  for (;;) {
+    int index ;
+    if (fullFrames.pop(index)) {
+      sink->writeFrame(pool[index]) ;
+      freeFrames.push(index) ;
+      written.fetch_add(1, std::memory_order_relaxed) ;
+      spins = 0 ;
+    } else if (closing.load(std::memory_order_acquire)) {
+      // closing is set after the last push, so the queue is drained
+      if (fullFrames.size() == 0) break ;
+    } else {
+      backoff(spins) ;
+    }
+  }
+  sink->flush() ;
+}
+
+void AsyncWriter::close() {
+  if (closing.exchange(true)) return ;
+  if (thread.joinable()) thread.join() ;
+}
+
+int AsyncWriter::getQueueDepth() const {
+  return (int)fullFrames.size() ;
+}
+
+long AsyncWriter::getDroppedFrames() const {
+  return dropped.load(std::memory_order_relaxed) ;
+}
+
+long AsyncWriter::getWrittenFrames() const {
+  return written.load(std::memory_order_relaxed) ;
+}
+
+int AsyncWriter::getDecimation() const {
+  return decimation ;
+}
@@ -0,0 +1,114 @@
+/** file: writer.h
+ ** brief: Asynchronous trajectory writer
+ **/
+
+#ifndef __writer__
+#define __writer__
+
+#include "trajectory.h"
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/* ---------------------------------------------------------------- */
+// class SpscQueue
+/* ---------------------------------------------------------------- */
+
+// Bounded lock-free queue for exactly one producer thread and one
+// consumer thread. The capacity is rounded up to a power of two.
+
+template <typename T>
+class SpscQueue {
+  public:
+    SpscQueue(size_t capacity) : head(0), tail(0) {
+      size_t n = 1 ;
+      while (n < capacity + 1) n <<= 1 ;
+      items.resize(n) ;
+      mask = n - 1 ;
+    }
+
+    // producer side
+    bool push(const T & item) {
+      size_t t = tail.load(std::memory_order_relaxed) ;
+      size_t next = (t + 1) & mask ;
+      if (next == head.load(std::memory_order_acquire)) return false ; // full
+      items[t] = item ;
+      tail.store(next, std::memory_order_release) ;
+      return true ;
+    }
+
+    // consumer side
+    bool pop(T & item) {
+      size_t h = head.load(std::memory_order_relaxed) ;
+      if (h == tail.load(std::memory_order_acquire)) return false ; // empty
+      item = items[h] ;
+      head.store((h + 1) & mask, std::memory_order_release) ;
+      return true ;
+    }
+
+    // approximate when called concurrently
+    size_t size() const {
+      return (tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire)) & mask ;
+    }
+
+  private:
+    std::vector<T> items ;
+    size_t mask ;
+    alignas(64) std::atomic<size_t> head ;
+    alignas(64) std::atomic<size_t> tail ;
+} ;
+
+/* ---------------------------------------------------------------- */
+// class AsyncWriter
+/* ---------------------------------------------------------------- */
+
+// Snapshots the simulation into a pool of pre-allocated frames and
+// hands them to a background thread that writes them to a FrameSink.
+// push() must always be called from the same (simulation) thread.
+//
+// When all frames are in flight the policy decides what happens:
+//   BLOCK     wait for the I/O thread to release a frame
+//   DROP      discard the new frame
+//   DECIMATE  discard it and keep only every k-th frame afterwards,
+//             doubling k while congested and halving it once the
+//             queue has drained
+
+class AsyncWriter {
+  public:
+    enum Policy { BLOCK, DROP, DECIMATE } ;
+
+    AsyncWriter(FrameSink * sink, int numMasses, int numBuffers = 8, Policy policy = BLOCK) ;
+    ~AsyncWriter() ;
+
+    bool push(const SpringMass & springmass) ;
+    bool push(const StateView & state) ; // e.g. from a SpringMass observer
+    void close() ;
+
+    int getQueueDepth() const ;
+    long getDroppedFrames() const ;
+    long getWrittenFrames() const ;
+    int getDecimation() const ;
+
+  private:
+    FrameSink * sink ;
+    Policy policy ;
+    std::vector<Frame> pool ;
+    SpscQueue<int> freeFrames ;    // I/O thread -> simulation thread
+    SpscQueue<int> fullFrames ;    // simulation thread -> I/O thread
+    std::thread thread ;
+    std::atomic<bool> closing ;
+    std::atomic<long> dropped ;
+    std::atomic<long> written ;
+    long pushed ;
+    int decimation ;
+
+    int acquire() ;
+    void loop() ;
+
+    AsyncWriter(const AsyncWriter &) ;
+    AsyncWriter & operator= (const AsyncWriter &) ;
+} ;
+
+#endif /* defined(__writer__) */